@@ -8,6 +8,9 @@ bits 16
 GDT_CODE equ 0x08
 GDT_DATA equ 0x10
 
+; Chunks of 64 sectors (32KB) that cover the kernel's part of the reserved area.
+KERNEL_CHUNKS equ (RESERVED_SECTORS - KERNEL_LBA + 63) / 64
+
 start:
     ; Stage 1 passes the boot drive number in DL. We save it immediately.
     mov [boot_drive], dl
@@ -20,10 +23,10 @@ start:
     call enable_a20
 
     ; --- Load Kernel using modern LBA Extended Read in a loop ---
-    ; We will read 16 chunks of 32KB each to load a total of 512KB.
-    ; 256KB = 512 sectors. 512 sectors / 64 sectors_per_chunk = 8 chunks.
-    mov cx, 16                   ; CX will be our loop counter (16 chunks)
-    mov dword [current_lba], 5  ; The kernel starts at LBA 5
+    ; The kernel takes up the rest of the reserved area (RESERVED_SECTORS
+    ; and KERNEL_LBA come from the Makefile), read in chunks of 64 sectors.
+    mov cx, KERNEL_CHUNKS        ; CX will be our loop counter
+    mov dword [current_lba], KERNEL_LBA
     
     ; Set the initial memory destination segment to 0x1000 (for physical addr 0x10000)
     mov ax, 0x1000 ; Set initial destination segment to 0x1000
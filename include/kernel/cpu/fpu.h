@@ -0,0 +1,32 @@
+// myos/include/kernel/cpu/fpu.h
+
+#ifndef FPU_H
+#define FPU_H
+
+#include <kernel/types.h>
+#include <kernel/cpu/process.h>
+
+// Size of an FXSAVE area. FSAVE (CPUs without FXSR) only needs 108 bytes.
+#define FPU_STATE_SIZE 512
+
+// Enables the FPU (and SSE, if the CPU has it) and leaves CR0.TS set, so
+// the first FPU instruction of any task traps into fpu_handle_nm().
+void fpu_init();
+
+// Does the same on an application processor.
+void fpu_init_ap();
+
+// Called on every task switch. Sets CR0.TS unless 'next' already owns the
+// FPU registers, so their state is only moved when a task actually uses them.
+// Each CPU has its own owner; a task whose state is still in one CPU's
+// registers only runs on that CPU (see sched.c).
+void fpu_switch(task_struct_t* next);
+
+// Handles #NM (device not available): saves the previous owner's state and
+// loads the current task's. Returns false if there is no memory for it.
+bool fpu_handle_nm();
+
+// Drops a task's FPU state, e.g. when it is reaped.
+void fpu_release(task_struct_t* task);
+
+#endif
@@ -0,0 +1,31 @@
+// myos/include/kernel/cpu/futex.h
+
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <kernel/types.h>
+
+// Buckets of the futex wait table. Must be a power of two.
+#define FUTEX_HASH_SIZE 64
+
+// What futex_wait() returns.
+#define FUTEX_WOKEN        0  // futex_wake() woke us
+#define FUTEX_CHANGED      1  // The word did not hold the expected value
+#define FUTEX_TIMEDOUT     2  // The timeout ran out first
+#define FUTEX_INTERRUPTED  3  // A signal came first
+#define FUTEX_FAULT       -1  // Not an aligned, mapped user address
+
+// A futex is an aligned 32-bit word in user memory. Waiters are kept in a
+// hash table keyed by its physical address, so tasks that map the same
+// frame (threads, or any shared memory) find each other.
+
+// Blocks the current task on the word at 'uaddr', if it still holds 'val'.
+// The check and the sleep are atomic against futex_wake(). A 'timeout_ms'
+// of 0 waits for ever. A pending signal ends the wait early.
+int futex_wait(uint32_t uaddr, uint32_t val, uint32_t timeout_ms);
+
+// Wakes up to 'count' tasks waiting on the word at 'uaddr', oldest first.
+// Returns how many were woken, or FUTEX_FAULT.
+int futex_wake(uint32_t uaddr, int count);
+
+#endif
@@ -0,0 +1,58 @@
+// myos/include/kernel/cpu/lapic.h
+
+#ifndef LAPIC_H
+#define LAPIC_H
+
+#include <kernel/types.h>
+#include <kernel/paging.h> // For KERNEL_MMIO_START
+#include <kernel/pmm.h>    // For PMM_FRAME_SIZE
+
+// The local APIC registers are mapped into the last page of the MMIO window.
+#define LAPIC_VIRT_ADDR (KERNEL_MMIO_START + KERNEL_MMIO_SIZE - PMM_FRAME_SIZE)
+
+// Interrupt vectors raised by the local APICs. They are above the PIC's
+// 0x20-0x2F and below the syscall vector.
+#define LAPIC_TIMER_VECTOR    0x40 // Periodic tick of an application processor
+#define LAPIC_RESCHED_VECTOR  0x41 // "Look at your ready queues" from another CPU
+#define LAPIC_SPURIOUS_VECTOR 0xFF // Must not be acknowledged
+
+// Returns true if the CPU has a local APIC.
+bool lapic_present();
+
+// Maps the local APIC (on the BSP) and measures its timer against the PIT.
+// Returns false if there is no APIC to use.
+bool lapic_init();
+
+// Enables the calling CPU's local APIC. Every CPU calls this for itself.
+void lapic_enable();
+
+// Starts the calling CPU's local APIC timer at TIMER_HZ.
+void lapic_timer_start();
+
+// APIC timer counts per kernel tick, or 0 if the timer was never measured.
+uint32_t lapic_timer_counts_per_tick();
+
+// Fires LAPIC_TIMER_VECTOR once on the calling CPU, 'counts' timer counts
+// from now. 0 stops the timer.
+void lapic_timer_oneshot(uint32_t counts);
+
+// Counts left before the calling CPU's APIC timer fires, 0 once it has.
+uint32_t lapic_timer_remaining();
+
+// The calling CPU's local APIC ID.
+uint8_t lapic_id();
+
+// Acknowledges the interrupt being handled.
+void lapic_eoi();
+
+// Sends an interrupt to the CPU with the given APIC ID.
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector);
+
+// Sends INIT and then two STARTUP IPIs to every other CPU. They start in
+// real mode at physical address 'vector' * 4KB.
+void lapic_start_aps(uint8_t vector);
+
+// Busy-waits using PIT channel 2. Works before interrupts are enabled.
+void lapic_delay_us(uint32_t us);
+
+#endif
@@ -6,62 +6,173 @@
 #include <kernel/types.h>
 #include <kernel/exceptions.h> // registers_t
 #include <kernel/paging.h>     // For page_directory_t
+#include <kernel/timer.h>      // For kernel_timer_t
+#include <kernel/cpu/signal.h> // For NSIG
 
 #define MAX_ARGS 16 // Maximum number of command arguments
-#define MAX_PROCESSES 16 // Maximum number of processes in the system
+#define PID_MAX 1024 // PIDs go from 0 to PID_MAX - 1
+#define PID_HASH_SIZE 64 // Buckets of the PID lookup table, a power of two
 #define PROCESS_NAME_LEN 32 // Max length of a process name
 
+#define KERNEL_STACK_SIZE PMM_FRAME_SIZE // Every task has its own kernel stack
+
 #define USER_STACK_PAGES  4                                 // and be 16KB (4 pages) in size
 #define USER_STACK_SIZE (USER_STACK_PAGES * PMM_FRAME_SIZE) // 16KB
 #define USER_STACK_TOP    0xC0000000                        // User stacks will start at 3GB
 
+// Threads get stacks of the same size below the main one, in one of
+// THREAD_STACKS_MAX slots. An unmapped guard page separates neighbouring stacks.
+#define THREAD_STACKS_MAX 32
+#define THREAD_STACK_SLOT (USER_STACK_SIZE + PMM_FRAME_SIZE)
+#define THREAD_STACK_TOP(slot) (USER_STACK_TOP - THREAD_STACK_SLOT * ((slot) + 1))
+
 // Enum for process states
 typedef enum {
-    TASK_STATE_UNUSED,    // This entry in the table is free
+    TASK_STATE_UNUSED,    // The task struct is free
     TASK_STATE_RUNNING,   // The process is currently running or ready to run
     TASK_STATE_SLEEPING,  // The task is paused, waiting for a timeout
-    TASK_STATE_WAITING,   // Task is blocked, waiting for a child to exit
+    TASK_STATE_WAITING,   // Task is blocked on a wait queue (see wait.h)
     TASK_STATE_ZOMBIE     // The process has finished but is waiting to be cleaned up
 } task_state_t;
 
-// This struct contains ONLY the registers we need to save for a task switch.
+// CPU time a task used, and how often it was switched away (see sched.c).
 typedef struct {
-    // Pushed by 'pusha' - 7 registers * 4 bytes each = 28 bytes total (starting from 0)
-    uint32_t edi;     // Offset 0
-    uint32_t esi;     // Offset 4
-    uint32_t ebp;     // Offset 8
-    uint32_t ebx;     // Offset 12
-    uint32_t edx;     // Offset 16
-    uint32_t ecx;     // Offset 20
-    uint32_t eax;     // Offset 24
-
-    // Pushed by CPU/IRET frame - 5 registers * 4 bytes each = 20 bytes total (starting from 24)
-    uint32_t eip;     // Offset 28
-    uint32_t cs;      // Offset 32
-    uint32_t eflags;  // Offset 36
-    uint32_t esp;     // Offset 40 (The task's actual stack pointer)
-    uint32_t ss;      // Offset 44
-
-    // Page directory physical address
-    uint32_t cr3; // Offset 48
-} __attribute__((packed)) cpu_state_t;
+    uint32_t utime;          // Ticks that found it in user mode
+    uint32_t stime;          // Ticks that found it in the kernel
+    uint64_t user_cycles;    // TSC cycles spent in user mode
+    uint64_t system_cycles;  // TSC cycles spent in the kernel
+    uint32_t nvcsw;          // Switches away because it blocked, slept or exited
+    uint32_t nivcsw;         // Switches away while still runnable (preempted or yielded)
+} task_usage_t;
 
-// The Process Control Block (PCB)
+// Buckets of a wake-up latency histogram. Bucket i counts the wake-ups
+// that waited 2^i to 2^(i+1) - 1 us before running (bucket 0 takes 0us
+// too), the last one everything longer.
+#define SCHED_LAT_BUCKETS 16
+
+// How long a task waited for a CPU after it was woken (see sched.c).
 typedef struct {
+    uint32_t hist[SCHED_LAT_BUCKETS];
+    uint32_t count;          // Wake-ups measured
+    uint32_t total_us;       // Their latencies added up, for the average
+    uint32_t max_us;         // The longest one
+} sched_latency_t;
+
+// The Process Control Block (PCB)
+typedef struct task_struct {
     int pid;                            // Process ID (4B)
     task_state_t state;                 // The current state of the process (4B)
     char name[PROCESS_NAME_LEN];        // The process name (32B)
     void* user_stack;                   // Pointer to the user-mode stack (4B)
     void* kernel_stack;                 // Pointer to the kernel-mode stack (4B)
-    page_directory_t* page_directory;   // Virtual address of the page directory (4B)
-    cpu_state_t cpu_state;              //store the task's registers
+    uint32_t kernel_esp;                // Saved stack pointer while switched out (4B)
+    page_directory_t* page_directory;   // Physical address of the page directory (4B)
     uint32_t wakeup_time;               // Tick count at which to wake up
+    int priority;                       // Scheduler level, 0 is the highest
+    uint32_t time_slice;                // Ticks left before the task is demoted
+    struct task_struct* run_next;       // Next task in the same ready queue
+    kernel_timer_t sleep_timer;         // Wakes the task up at wakeup_time
+    int policy;                         // SCHED_NORMAL or SCHED_FIFO (see sched.h)
+    int rt_priority;                    // Real-time priority, higher wins
+    uint32_t rt_runtime;                // Ticks a real-time task may run per period
+    uint32_t rt_period;                 // Length of a real-time period, in ticks
+    uint32_t rt_used;                   // Ticks used in the current period
+    uint32_t rt_period_start;           // Tick at which the current period began
+    bool rt_throttled;                  // Out of budget until the next period
+    kernel_timer_t rt_timer;            // Ends the throttling
+    struct sched_group* group;          // CPU bandwidth group (see sched.h)
+    struct task_struct* pid_next;       // Next task in the same PID hash bucket
+    struct task_struct* task_next;      // Next task in task_list
+    struct task_struct* task_prev;      // Previous task in task_list
+    void* fpu_state;                    // FPU/SSE save area, NULL until the task uses the FPU
+    void (*kthread_fn)(void* arg);      // What a kernel thread runs (see kthread_create)
+    void* kthread_arg;                  // Its argument
+    bool reap_requested;                // Zombie to be freed by the reaper work item
+    int cpu;                            // CPU it runs on, or whose ready queue it is on
+    bool on_cpu;                        // It is some CPU's current task right now
+    uint32_t lock_depth;                // Kernel lock nesting, saved while switched out
+    struct wait_queue* wait_queue;      // The wait queue it is on, or NULL
+    int ppid;                           // PID of the parent that waits for it, 0 = none
+    int exit_status;                    // What it passed to exit, for its parent
+    bool is_thread;                     // Shares the address space of the task that created it
+    uint32_t sig_pending;               // Signals sent but not delivered yet, one bit each
+    uint32_t sig_blocked;               // Signals held back until unblocked
+    uint32_t sig_handlers[NSIG];        // User handler of each signal, or SIG_DFL/SIG_IGN
+    uint32_t sig_restorer;              // User code that makes the sigreturn syscall
+    uint32_t sig_frame;                 // Signal frame of the running handler, or 0
+    kernel_timer_t alarm_timer;         // Sends SIGALRM (see signal_alarm)
+    task_usage_t usage;                 // CPU time and context switches
+    task_usage_t child_usage;           // Added up from the children it waited for
+    uint64_t tsc_mark;                  // TSC when the stretch not yet charged began
+    bool in_syscall;                    // Between syscall entry and exit
+    uint64_t wake_tsc;                  // TSC when it was woken, 0 once it ran
+    sched_latency_t latency;            // Time from wake-up to running
+    uint32_t ring_addr;                 // Submission/completion ring (see ring.h), or 0
+    uint32_t ring_entries;              // Slots in each of its rings
+    uint32_t ring_sq_head;              // The kernel's own copies of its ring counters,
+    uint32_t ring_cq_tail;              // so the program cannot move them under it
+    struct task_struct* wait_next;      // Next task on the same wait queue
     // We will add more fields here later (e.g., registers, memory maps)
 } task_struct_t;
 
+// Every live task (including zombies), oldest first, linked through task_next.
+extern task_struct_t* task_list;
+
 void switch_to_user_mode(void* entry_point, void* stack_ptr); // takes  entry point AND user stack pointer
 int exec_program(int argc, char* argv[]);
 void process_init();
-cpu_state_t* schedule(registers_t *r);
+
+// Picks the next task and switches to it. Must be called with interrupts
+// disabled. Returns once the current task is picked again.
+void schedule();
+
+// Finishes the first switch to a new task (see task_start in switch.asm).
+void schedule_tail();
+
+// Switches from 'prev' to 'next': loads next's address space and kernel
+// stack, and continues wherever 'next' last called switch_to().
+void switch_to(task_struct_t* prev, task_struct_t* next);
+
+// Returns the task with the given PID, or NULL if there is none.
+task_struct_t* process_find(int pid);
+
+// Turns a task that has exited into a zombie. It keeps its memory until its
+// parent collects it with process_waitpid(). Tasks without a parent are
+// reaped in the background, and its children lose their parent. When a
+// program's main thread exits, its other threads are killed.
+void process_exit(task_struct_t* task, int status);
+
+// Blocks until a child of the current task with the given PID (-1 for any)
+// has exited, stores its exit status and frees it. Returns the child's PID,
+// or -1 if there is no such child or a signal for the task ended the wait.
+int process_waitpid(int pid, int* status);
+
+// Starts a thread of the current program: a task in the same address space,
+// on a user stack of its own, that enters 'entry' with arg1 and arg2 as its
+// two arguments. Its creator joins it with process_waitpid(). Returns its
+// PID, or -1 if there is no memory, stack slot or PID for it.
+int thread_create(uint32_t entry, uint32_t arg1, uint32_t arg2);
+
+// Returns true if some task with the given address space is running on
+// another CPU right now, so that CPU's TLB may hold its mappings.
+bool process_dir_running_elsewhere(page_directory_t* dir);
+
+// Frees everything a zombie still owns, including its PID and task struct.
+void process_reap(task_struct_t* task);
+
+// Like process_reap(), but done later on the system work queue, so the
+// caller does not wait for the address space to be torn down.
+void process_reap_later(task_struct_t* task);
+
+// Starts a kernel thread that runs fn(arg) in ring 0 on its own kernel stack.
+// It exits (and becomes a zombie) when fn returns. Returns NULL on failure.
+task_struct_t* kthread_create(const char* name, void (*fn)(void* arg), void* arg);
+
+// Creates the idle task of an application processor.
+task_struct_t* process_create_idle(int cpu);
+
+// The task running on this CPU. Needs smp.h, which needs task_struct_t.
+#include <kernel/cpu/smp.h>
+#define current_task (this_cpu()->current)
 
 #endif
\ No newline at end of file
@@ -0,0 +1,64 @@
+// myos/include/kernel/cpu/ring.h
+
+#ifndef RING_H
+#define RING_H
+
+#include <kernel/types.h>
+
+// Most slots a submission or completion ring may have. Must be a power of two.
+#define RING_MAX_ENTRIES 256
+
+// Operations a submission can ask for. The arguments are those of the
+// syscall that does the same thing.
+#define RING_OP_NOP        0 // Does nothing, completes with 0
+#define RING_OP_PRINT      1 // args[0] = string; printed with a newline, like sys_print
+#define RING_OP_READ       2 // args[0] = file name, [1] = buffer, [2] = length, [3] = offset
+#define RING_OP_WRITE      3 // args[0] = buffer, [1] = length; written to the console
+#define RING_OP_SLEEP      4 // args[0] = milliseconds
+#define RING_OP_PLAY_SOUND 5 // args[0] = frequency
+
+// What a failed operation completes with.
+#define RING_ERROR -1
+
+// A ring lives in the program's own memory, registered with ring_setup():
+// this header, then 'entries' submission slots, then as many completion
+// slots. All four counters only grow; a slot is counter & (entries - 1).
+// The program queues submissions and takes completions, the kernel does
+// the other half in ring_enter().
+typedef struct {
+    volatile uint32_t sq_head;   // Submissions the kernel took. Written by the kernel.
+    volatile uint32_t sq_tail;   // Submissions queued. Written by the program.
+    volatile uint32_t cq_head;   // Completions the program took. Written by the program.
+    volatile uint32_t cq_tail;   // Completions posted. Written by the kernel.
+    uint32_t entries;            // Slots in each ring, set by ring_setup()
+} ring_header_t;
+
+// One submission.
+typedef struct {
+    uint32_t op;                 // RING_OP_*
+    uint32_t user_data;          // Handed back in the completion
+    uint32_t args[4];
+} ring_sqe_t;
+
+// One completion.
+typedef struct {
+    uint32_t user_data;          // From the submission
+    int32_t result;              // What the operation returned, or RING_ERROR
+} ring_cqe_t;
+
+// Bytes a ring with 'entries' slots takes up.
+#define RING_SIZE(entries) (sizeof(ring_header_t) + (entries) * (sizeof(ring_sqe_t) + sizeof(ring_cqe_t)))
+
+// Registers the ring at user address 'uaddr' for the current task, with
+// 'entries' slots (a power of two up to RING_MAX_ENTRIES). The kernel
+// starts both rings empty. Replaces a ring registered before. Returns 0,
+// or RING_ERROR for bad arguments or memory the task cannot write.
+int ring_setup(uint32_t uaddr, uint32_t entries);
+
+// Runs up to 'to_submit' queued submissions (0 = all of them) in order,
+// and posts a completion for each. Stops early when the completion ring
+// is full or a signal is waiting. Returns how many were run, or
+// RING_ERROR if the task has no usable ring.
+int ring_enter(uint32_t to_submit);
+
+#endif
@@ -0,0 +1,180 @@
+// myos/include/kernel/cpu/sched.h
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <kernel/types.h>
+#include <kernel/cpu/process.h>
+
+// Scheduling policies.
+#define SCHED_NORMAL 0 // Multilevel feedback, the default
+#define SCHED_FIFO   1 // Real-time: runs before every normal task, within its budget
+
+// Number of real-time priorities. They go from 1 to SCHED_RT_PRIORITIES,
+// and a higher number wins, like POSIX.
+#define SCHED_RT_PRIORITIES 8
+
+// Number of normal priority levels. Level 0 is the highest.
+#define SCHED_PRIORITIES 8
+
+// Load averages are fixed point, with FSHIFT fraction bits, updated every
+// LOAD_FREQ ticks (5s) like on Linux.
+#define FSHIFT    11
+#define FIXED_1   (1 << FSHIFT)
+#define LOAD_FREQ (5 * TIMER_HZ)
+
+// Who sched_getrusage() reports on.
+#define RUSAGE_SELF      0
+#define RUSAGE_CHILDREN -1 // Children that were waited for, and theirs
+
+// What getrusage reports, in the layout user programs see.
+typedef struct {
+    uint32_t utime_ms;       // Time in user mode, counted in ticks
+    uint32_t stime_ms;       // Time in the kernel, counted in ticks
+    uint64_t user_cycles;    // The same, measured with the TSC
+    uint64_t system_cycles;
+    uint32_t nvcsw;          // Voluntary context switches
+    uint32_t nivcsw;         // Involuntary context switches
+} rusage_t;
+
+// Records the switch trace holds. Once it is full, the oldest are dropped.
+#define SCHED_TRACE_SIZE 256
+
+// One context switch, as the switch trace records it.
+typedef struct {
+    uint32_t time_us;          // Since boot, wrapping every 71.6 minutes
+    int cpu;
+    int prev_pid;
+    task_state_t prev_state;   // RUNNING if prev was preempted or yielded
+    int next_pid;
+    uint32_t wait_us;          // How long next waited after its wake-up, 0 if it was not woken
+} sched_switch_t;
+
+// Length of one CPU's ready queues, sampled every tick. The running task
+// is not counted.
+typedef struct {
+    uint32_t samples;
+    uint32_t total;            // The samples added up, for the average
+    uint32_t max;
+} sched_rq_stats_t;
+
+// Real-time levels come first in the ready queues, then the normal ones.
+#define SCHED_LEVELS (SCHED_RT_PRIORITIES + SCHED_PRIORITIES)
+
+// A task at level p may run for SCHED_SLICE(p) ticks before it is demoted.
+// Lower levels get longer slices, since their tasks are the CPU-bound ones.
+#define SCHED_SLICE(p) (1u << ((p) / 2))
+
+// Every SCHED_BOOST_TICKS ticks all tasks go back to level 0, so that tasks
+// at the bottom are never starved. 100 ticks = 1s.
+#define SCHED_BOOST_TICKS 100
+
+// Number of CPU bandwidth groups. Group 0 holds every task that was not put
+// elsewhere and has no limit.
+#define SCHED_MAX_GROUPS 8
+
+// A group of tasks that share one CPU quota.
+typedef struct sched_group {
+    uint32_t quota;            // Ticks the group may run per period, 0 = no limit
+    uint32_t period;           // Length of a period, in ticks
+    uint32_t used;             // Ticks used in the current period
+    uint32_t period_start;     // Tick at which the current period began
+    uint32_t total_ticks;      // Ticks used since boot
+    uint32_t throttle_count;   // Periods in which the quota ran out
+    bool throttled;            // Out of quota until the next period
+    task_struct_t* parked;     // Runnable tasks held back while throttled
+    kernel_timer_t timer;      // Ends the throttling
+} sched_group_t;
+
+// Puts the idle task aside and empties the ready queues.
+void sched_init(task_struct_t* idle);
+
+// Sets up the ready queues of an application processor, which schedules on
+// its own and takes work from busier CPUs when it runs out.
+void sched_init_cpu(task_struct_t* idle);
+
+// Makes a task runnable. A task that was blocked is boosted one level,
+// since it gave up the CPU before using up its slice.
+void sched_wake(task_struct_t* task);
+
+// Returns true if some task other than the current one is ready to run on
+// this CPU.
+bool sched_has_ready();
+
+// Charges one timer tick to the running task, to its user or kernel time
+// depending on where the tick found it. Called from the timer interrupt.
+void sched_tick(task_struct_t* current, bool user_mode);
+
+// Charges the TSC cycles prev ran since its last mark, counts the context
+// switch and starts next's stretch. Called from schedule() before switching.
+void sched_account_switch(task_struct_t* prev, task_struct_t* next);
+
+// Split a task's TSC time at syscall entry (what came before was user
+// time) and exit (the syscall itself was kernel time).
+void sched_syscall_enter(task_struct_t* task);
+void sched_syscall_exit(task_struct_t* task);
+
+// TSC cycles per timer tick, measured at boot.
+uint32_t sched_tsc_per_tick();
+
+// Converts TSC cycles to microseconds, without 64-bit division. Only the
+// low 32 bits are returned, so the result wraps every 2^32us (71.6 minutes).
+uint32_t sched_cycles_to_us(uint64_t cycles);
+
+// Copies the wake-up latencies of every task since boot (or the last reset),
+// including tasks that are gone.
+void sched_get_latency(sched_latency_t* out);
+
+// Copies the ready queue stats of one CPU.
+void sched_get_rq_stats(int cpu, sched_rq_stats_t* out);
+
+// Clears the latency histograms, of every task too, and the queue stats.
+void sched_reset_stats();
+
+// Starts or stops recording context switches in the switch trace.
+void sched_trace_enable(bool on);
+bool sched_trace_enabled();
+
+// Takes up to 'max' of the oldest records off the switch trace. Returns how
+// many it copied to 'out'.
+int sched_trace_read(sched_switch_t* out, int max);
+
+// Records dropped because the trace was full, since tracing was turned on.
+uint32_t sched_trace_lost();
+
+// Copies the 1, 5 and 15 minute load averages (fixed point, see FSHIFT):
+// the number of tasks running or ready to run, averaged over time.
+void sched_get_loadavg(uint32_t loads[3]);
+
+// Fills 'out' with the usage of 'task' itself or of its children.
+void sched_getrusage(task_struct_t* task, int who, rusage_t* out);
+
+// Picks the task to run next, or keeps the current one if it still has time
+// left and nothing more important is ready. Called from schedule().
+task_struct_t* sched_next(task_struct_t* current);
+
+// Changes the policy of the current task. A SCHED_FIFO task may run for
+// 'runtime' ticks in every 'period' ticks; after that it is throttled until
+// the next period starts. Returns 0 on success, -1 on bad arguments.
+int sched_setscheduler(task_struct_t* task, int policy, int rt_priority, uint32_t runtime, uint32_t period);
+
+// Gives up the CPU right away. The current task goes to the back of its
+// level and runs again once the tasks queued before it had their turn.
+void sched_yield();
+
+// Gives up the CPU to 'target', which also gets the rest of the current
+// time slice. Returns 0 on success, -1 if 'target' cannot run on this CPU
+// right now, for instance because another CPU is running it.
+int sched_yield_to(task_struct_t* target);
+
+// Returns bandwidth group 'id', or NULL if there is no such group.
+sched_group_t* sched_get_group(int id);
+
+// Limits a group to 'quota' ticks of CPU time in every 'period' ticks.
+// A quota of 0 removes the limit. Returns 0 on success, -1 on bad arguments.
+int sched_group_set_limit(sched_group_t* group, uint32_t quota, uint32_t period);
+
+// Moves a task into another bandwidth group.
+void sched_set_group(task_struct_t* task, sched_group_t* group);
+
+#endif
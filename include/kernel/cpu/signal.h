@@ -0,0 +1,82 @@
+// myos/include/kernel/cpu/signal.h
+
+#ifndef SIGNAL_H
+#define SIGNAL_H
+
+#include <kernel/types.h>
+#include <kernel/exceptions.h> // registers_t
+
+// Signal numbers, as on Linux. 0 is not a signal; kill() with it only
+// checks that the task exists.
+#define NSIG     32
+#define SIGINT   2
+#define SIGKILL  9
+#define SIGUSR1  10
+#define SIGSEGV  11
+#define SIGUSR2  12
+#define SIGALRM  14
+#define SIGTERM  15
+#define SIGCHLD  17
+
+// Handlers that are not user code.
+#define SIG_DFL 0 // The default: terminate, or ignore for SIGCHLD
+#define SIG_IGN 1 // Drop the signal
+
+// How sigprocmask() changes the blocked mask.
+#define SIG_BLOCK   0
+#define SIG_UNBLOCK 1
+#define SIG_SETMASK 2
+
+// Exit status of a task that a signal terminated.
+#define SIGNAL_EXIT_STATUS(sig) (128 + (sig))
+
+// What a handler finds on its user stack. It is entered as if called with
+// 'sig' as its argument and 'restorer' as its return address; the restorer
+// makes the sigreturn syscall, which puts 'regs' back.
+typedef struct signal_frame {
+    uint32_t restorer;      // Return address of the handler
+    int sig;                // The handler's argument
+    registers_t regs;       // Where the task was when the signal came in
+    uint32_t blocked;       // Blocked mask to go back to
+    uint32_t prev;          // Frame of the handler this one interrupted, or 0
+} signal_frame_t;
+
+struct task_struct;
+
+// Marks 'sig' pending for a user task and wakes it if it sleeps in sleep()
+// or pause(), or, for SIGKILL, in any wait that gives up for a signal. Safe
+// to call from interrupt handlers. Returns 0, or -1 for a bad signal or a
+// task that cannot take signals (kernel tasks, zombies).
+int signal_send(struct task_struct* task, int sig);
+
+// Returns true if 'task' has a signal it would act on right now, for
+// kernel work that should stop early and let it be delivered.
+bool signal_pending(struct task_struct* task);
+
+// Called on every return to user mode with the frame that will be
+// restored. Runs the action of the first pending, unblocked signal: a
+// user handler gets a signal frame built on the user stack, and 'r' is
+// pointed at the handler. Does not return if the signal terminates the task.
+void signal_deliver(registers_t* r);
+
+// Returns from a handler: restores the frame the current task's last
+// handler was entered with into 'r'. Returns false if there is none.
+bool signal_return(registers_t* r);
+
+// Changes the handler of 'sig' for the current task, and the code its
+// handlers return to. Returns the old handler, or -1 for a bad signal.
+int signal_action(int sig, uint32_t handler, uint32_t restorer);
+
+// Changes the current task's blocked mask and returns the old one.
+// SIGKILL can never be blocked.
+uint32_t signal_mask(int how, uint32_t set);
+
+// Sends SIGALRM to the current task in 'ms' milliseconds, replacing any
+// alarm set before (0 only cancels it). Returns the milliseconds the old
+// alarm had left, or 0.
+uint32_t signal_alarm(uint32_t ms);
+
+// Sleeps until a signal is ready to be delivered.
+void signal_pause();
+
+#endif
@@ -0,0 +1,66 @@
+// myos/include/kernel/cpu/smp.h
+
+#ifndef SMP_H
+#define SMP_H
+
+#include <kernel/types.h>
+#include <kernel/exceptions.h> // registers_t
+#include <kernel/cpu/process.h>
+#include <kernel/cpu/tss.h>
+
+// Most CPUs we bring up. Any beyond this stay parked in the trampoline.
+#define SMP_MAX_CPUS 8
+
+// Physical address the application processors start at. It is below the
+// kernel image, in memory the PMM never hands out.
+#define AP_TRAMPOLINE_ADDR 0x8000
+
+// Everything that exists once per CPU. Each CPU's GDT has a data segment
+// that starts at its own cpu_t, and %gs holds it while in the kernel.
+typedef struct cpu {
+    struct cpu* self;              // Always first: this_cpu() reads it through %gs
+    int id;                        // Index into cpus[], 0 is the boot CPU
+    uint8_t apic_id;               // Local APIC ID
+    volatile bool online;          // Its idle task exists and it takes tasks
+    task_struct_t* current;        // The task running on this CPU
+    task_struct_t* idle;           // Runs when this CPU has nothing else to do
+    task_struct_t* fpu_owner;      // The task whose state is in this CPU's FPU registers
+    uint32_t lock_depth;           // Nesting of lock_kernel() on this CPU, 0 = not held
+    uint32_t preempt_count;        // Spinlocks held (see spinlock.h), 0 = preemptible
+    bool preempt_pending;          // A tick wanted to switch while preempt_count was set
+    uint32_t sysenter_stack[256];  // Where SYSENTER lands, until it moves to the task's stack.
+                                   // Must come right before tss (see sysenter_entry), and
+                                   // hold a debug trap taken there (see fault_handler).
+    struct tss_entry_struct tss;   // Kernel stack for interrupts from user mode
+} cpu_t;
+
+extern cpu_t cpus[SMP_MAX_CPUS];
+
+// Number of CPUs that are online.
+extern int smp_cpu_count;
+
+// The CPU we are running on.
+static inline cpu_t* this_cpu() {
+    cpu_t* cpu;
+    __asm__ __volatile__("movl %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+// Starts the other CPUs. Each one gets an idle task and its own run queue
+// (see sched.c). Needs the LAPIC mapped, so it runs after paging and the
+// process table are set up, with interrupts still disabled.
+void smp_init();
+
+// Interrupts one CPU so it looks at its ready queues again.
+void smp_send_resched(cpu_t* cpu);
+
+// Handles the LAPIC vectors (timer, reschedule and spurious).
+void smp_interrupt(registers_t* r);
+
+// The kernel lock. Only one CPU runs kernel code at a time; user code runs
+// everywhere in parallel. It nests, and a task that blocks or is preempted
+// keeps its nesting depth across the switch (see schedule()).
+void lock_kernel();
+void unlock_kernel();
+
+#endif
@@ -0,0 +1,87 @@
+// myos/include/kernel/cpu/spinlock.h
+
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <kernel/types.h>
+#include <kernel/io.h>        // For irq_save/irq_restore
+#include <kernel/cpu/smp.h>   // For this_cpu
+
+// A lock that other CPUs busy-wait on. Whoever holds one must not block, and
+// is not preempted until it lets go (see preempt_disable()).
+//
+// A lock that is also taken by an interrupt handler must be taken with
+// spin_lock_irqsave() everywhere, or the handler could spin forever on a
+// lock its own CPU holds. Locks are not recursive. When several are held,
+// they are taken in this order:
+//   fs_lock -> heap_lock -> proc_lock -> pmm_lock -> disk_lock -> console_lock
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+// The bare lock word, without touching preemption. Only for locks with
+// their own rules, like the kernel lock.
+static inline void spin_acquire(spinlock_t* lock) {
+    while (__sync_lock_test_and_set(&lock->locked, 1)) {
+        // Spin on a plain read, so the cache line is not bounced around.
+        while (lock->locked) {
+            __asm__ __volatile__("pause");
+        }
+    }
+}
+
+static inline void spin_release(spinlock_t* lock) {
+    __sync_lock_release(&lock->locked);
+}
+
+// Switches the task away if a reschedule was put off while preemption was
+// disabled. Does nothing with interrupts disabled. In smp.c.
+void preempt_resched();
+
+// While a CPU's count is above 0, the timer does not switch its running
+// task away. The tick is still charged; the switch happens at the
+// preempt_enable() that brings the count back to 0.
+static inline void preempt_disable() {
+    this_cpu()->preempt_count++;
+    __asm__ __volatile__("" : : : "memory");
+}
+
+static inline void preempt_enable() {
+    __asm__ __volatile__("" : : : "memory");
+    cpu_t* cpu = this_cpu();
+    if (--cpu->preempt_count == 0 && cpu->preempt_pending) {
+        preempt_resched();
+    }
+}
+
+// For locks that are only taken with interrupts enabled, outside of
+// interrupt handlers. Interrupts stay on while the lock is held.
+static inline void spin_lock(spinlock_t* lock) {
+    preempt_disable();
+    spin_acquire(lock);
+}
+
+static inline void spin_unlock(spinlock_t* lock) {
+    spin_release(lock);
+    preempt_enable();
+}
+
+// For locks that interrupt handlers take too. Returns the previous EFLAGS,
+// so it nests inside code that already has interrupts disabled.
+static inline uint32_t spin_lock_irqsave(spinlock_t* lock) {
+    uint32_t flags = irq_save();
+    preempt_disable();
+    spin_acquire(lock);
+    return flags;
+}
+
+// Interrupts are only turned back on if they were on before the lock was taken.
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags) {
+    spin_release(lock);
+    irq_restore(flags);
+    preempt_enable();
+}
+
+#endif
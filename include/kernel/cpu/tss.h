@@ -36,9 +36,7 @@ struct tss_entry_struct {
    uint16_t iomap_base; // The I/O map base address
 } __attribute__((packed));
 
-// Add this extern declaration to make the global TSS instance visible
-extern struct tss_entry_struct tss_entry;
-
+// Sets up the calling CPU's TSS (see cpu_t in smp.h) and loads it.
 void tss_install();
 
 #endif
\ No newline at end of file
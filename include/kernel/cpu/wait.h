@@ -0,0 +1,69 @@
+// myos/include/kernel/cpu/wait.h
+
+#ifndef WAIT_H
+#define WAIT_H
+
+#include <kernel/types.h>
+#include <kernel/cpu/process.h>
+#include <kernel/cpu/spinlock.h>
+#include <kernel/cpu/signal.h> // For signal_pending
+
+// Tasks blocked until some event happens, e.g. a key press or a child's
+// exit. A blocked task is on no ready queue, so it takes no CPU time until
+// the event's owner calls wake_up(). Tasks are linked through wait_next.
+typedef struct wait_queue {
+    spinlock_t lock;
+    task_struct_t* head;
+    task_struct_t* tail;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT { SPINLOCK_INIT, NULL, NULL }
+
+void wait_queue_init(wait_queue_t* wq);
+
+// Puts the current task on the queue and marks it as waiting. It keeps
+// running until it yields; a wake_up() in between only makes it runnable
+// again, so checking the condition after this call cannot miss an event.
+void prepare_to_wait(wait_queue_t* wq);
+
+// Takes the current task off the queue (if no wake_up() did already) and
+// marks it as running.
+void finish_wait(wait_queue_t* wq);
+
+// Wakes every task on the queue, or just the first one. Safe to call from
+// interrupt handlers.
+void wake_up(wait_queue_t* wq);
+void wake_up_one(wait_queue_t* wq);
+
+// Blocks the current task until 'condition' is true. The condition is
+// checked again after every wakeup. Must not be called while holding a
+// spinlock or from an interrupt handler.
+#define wait_event(wq, condition)                   \
+    do {                                            \
+        while (!(condition)) {                      \
+            prepare_to_wait(wq);                    \
+            if (condition) {                        \
+                break;                              \
+            }                                       \
+            __asm__ __volatile__("int $0x20");      \
+        }                                           \
+        finish_wait(wq);                            \
+    } while (0)
+
+// Like wait_event(), but also stops once a signal is pending for the task,
+// so that a killed task does not wait for ever. The caller tells the two
+// apart by checking 'condition' again. Only for waits that can be given up
+// without cleaning up after a device.
+#define wait_event_interruptible(wq, condition)     \
+    do {                                            \
+        while (!(condition)) {                      \
+            prepare_to_wait(wq);                    \
+            if ((condition) || signal_pending(current_task)) { \
+                break;                              \
+            }                                       \
+            __asm__ __volatile__("int $0x20");      \
+        }                                           \
+        finish_wait(wq);                            \
+    } while (0)
+
+#endif
@@ -0,0 +1,42 @@
+// myos/include/kernel/cpu/workqueue.h
+
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <kernel/types.h>
+#include <kernel/cpu/process.h>
+#include <kernel/cpu/wait.h>
+
+// A piece of deferred work. It is usually embedded in the object it works on.
+typedef struct work {
+    void (*fn)(void* data);   // Runs in the worker thread, with interrupts enabled
+    void* data;               // Passed to fn
+    bool pending;             // Queued and not started yet
+    struct work* next;        // Next item in the queue
+} work_t;
+
+// A FIFO of work items, run one after the other by its own kernel thread.
+typedef struct workqueue {
+    work_t* head;
+    work_t* tail;
+    task_struct_t* worker;    // The thread that runs the items
+    wait_queue_t wait;        // The worker sleeps here while the queue is empty
+} workqueue_t;
+
+// The shared queue for work that does not need a thread of its own.
+extern workqueue_t* system_wq;
+
+// Creates the system work queue. Needs the process table and the heap.
+void workqueue_init();
+
+// Creates a work queue with its own worker thread. Returns NULL on failure.
+workqueue_t* workqueue_create(const char* name);
+
+// Sets up a work item. It may be queued again once it has started running.
+void work_init(work_t* work, void (*fn)(void* data), void* data);
+
+// Queues a work item and wakes the worker. Safe to call from interrupt
+// handlers. Returns false if the item was already pending.
+bool queue_work(workqueue_t* wq, work_t* work);
+
+#endif
@@ -5,7 +5,6 @@
 
 #include <kernel/types.h>
 #include <kernel/exceptions.h> // for registers_t
-#include <kernel/cpu/process.h> // for cpu_state_t
 
 
 // Sends a null-terminated string to the debug console
@@ -16,8 +15,6 @@ void qemu_debug_hex(uint32_t n);
 void qemu_debug_memdump(const void* addr, size_t size);
 // Dumps the state of the CPU registers
 void qemu_debug_regs(registers_t *r);
-// Dumps the state of a saved cpu_state_t struct
-void qemu_debug_cpu_state(cpu_state_t *s);
 // Sends an unsigned decimal integer to the debug log
 void qemu_debug_dec(uint32_t n);
 
@@ -5,9 +5,23 @@
 
 #include <kernel/types.h>
 
+#define DISK_SECTOR_SIZE 512
+
 // Reads a 512-byte sector from the disk.
 // lba: The linear block address of the sector.
 // buffer: A pointer to a 512-byte buffer to store the data.
 void read_disk_sector(uint32_t lba, uint8_t* buffer_out);
 
-#endif
\ No newline at end of file
+// Reads 'count' (1-256) consecutive sectors with a single command.
+// Returns false if the drive reported an error.
+bool read_disk_sectors(uint32_t lba, uint32_t count, uint8_t* buffer_out);
+
+// Writes 'count' (1-256) consecutive sectors with a single command and
+// flushes the drive's write cache. Returns false if the drive reported an error.
+bool write_disk_sectors(uint32_t lba, uint32_t count, const uint8_t* buffer);
+
+// Returns the number of addressable sectors (LBA28) of the disk, or 0 if
+// the drive does not answer IDENTIFY.
+uint32_t disk_get_sector_count();
+
+#endif
@@ -132,6 +132,10 @@ struct virtq_used {
 // The signature is changed to accept the otification base address and multiplier.
 void virtio_sound_init(virtio_pci_common_cfg_t* cfg, void* notify_base, uint32_t notify_multiplier);
 
+// Switches command completion from polling to the device's interrupt. 'isr'
+// is the mapped ISR status register; reading it acknowledges the interrupt.
+void virtio_sound_enable_irq(uint8_t irq, volatile uint8_t* isr);
+
 // Plays a test beep using the virtio-sound device.
 void virtio_sound_beep();
 
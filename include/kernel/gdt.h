@@ -5,6 +5,10 @@
 
 #include <kernel/types.h>
 
+// Selector of the per-CPU data segment. Its base is the CPU's own cpu_t (see
+// smp.h), and the kernel keeps it in %gs.
+#define GDT_PERCPU_SELECTOR 0x30
+
 // GDT pointer structure
 struct gdt_ptr_struct {
     uint16_t limit;
@@ -17,7 +21,10 @@ extern void gdt_flush(struct gdt_ptr_struct* gdt_ptr);
 // This function initializes the kernel's GDT.
 void gdt_install();
 
-// our public helper function
+// Gives an application processor its own GDT and loads it, along with %gs.
+void gdt_install_ap(int cpu);
+
+// our public helper function. Sets an entry in the calling CPU's GDT.
 void gdt_set_gate(int32_t num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran);
 
 #endif
\ No newline at end of file
@@ -23,4 +23,7 @@ struct idt_ptr_struct {
 void idt_set_gate(uint8_t num, uint32_t base, uint16_t selector, uint8_t flags);
 void idt_install();
 
+// Loads the IDT that idt_install() built, on another CPU.
+void idt_load();
+
 #endif
\ No newline at end of file
@@ -6,6 +6,42 @@
 void port_byte_out(unsigned short port, unsigned char data);
 unsigned char port_byte_in(unsigned short port);
 void pic_remap(int offset1, int offset2); // remapping interrupt vectors func
+void pic_unmask_irq(unsigned char irq);
+void pic_mask_irq(unsigned char irq);
 unsigned short port_word_in(unsigned short port);
+void port_word_out(unsigned short port, unsigned short data);
+
+// Disables interrupts and returns the previous EFLAGS, for code that may be
+// called both with interrupts enabled and from inside an interrupt handler.
+static inline unsigned int irq_save() {
+    unsigned int eflags;
+    __asm__ __volatile__("pushfl\n\tpopl %0\n\tcli" : "=r"(eflags) : : "memory");
+    return eflags;
+}
+
+// Re-enables interrupts if they were enabled when irq_save was called.
+static inline void irq_restore(unsigned int eflags) {
+    if (eflags & 0x200) {
+        __asm__ __volatile__("sti" : : : "memory");
+    }
+}
+
+// Reads this CPU's time stamp counter.
+static inline unsigned long long rdtsc() {
+    unsigned int lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+// Reads and writes this CPU's model specific registers.
+static inline unsigned long long rdmsr(unsigned int msr) {
+    unsigned int lo, hi;
+    __asm__ __volatile__("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+static inline void wrmsr(unsigned int msr, unsigned long long value) {
+    __asm__ __volatile__("wrmsr" : : "c"(msr), "a"((unsigned int)value), "d"((unsigned int)(value >> 32)));
+}
 
 #endif
\ No newline at end of file
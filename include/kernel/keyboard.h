@@ -3,6 +3,8 @@
 #ifndef KEYBOARD_H
 #define KEYBOARD_H
 
+#include <kernel/types.h>
+
 // Define special character codes for arrow keys
 #define ARROW_UP    -1
 #define ARROW_DOWN  -2
@@ -13,8 +15,12 @@
 void keyboard_install();
 
 // Reads a single character from the keyboard buffer, blocking if empty.
+// Returns 0 if a signal for the task ends the wait.
 char keyboard_read_char();
 
+// Returns true if keyboard_read_char() would not block.
+bool keyboard_has_char();
+
 // Clear the keyboard before running new cmds etc
 void keyboard_flush();
 
@@ -0,0 +1,30 @@
+// myos/include/kernel/ksm.h
+
+#ifndef KSM_H
+#define KSM_H
+
+#include <kernel/types.h>
+
+// How often (in timer ticks) the idle task runs a merge pass. 100 ticks = 1s.
+#define KSM_SCAN_INTERVAL 100
+
+// Size of the hash table used to find identical pages during a pass.
+#define KSM_TABLE_SIZE 512
+
+// Statistics about kernel same-page merging.
+typedef struct {
+    uint32_t full_scans;     // Number of completed passes over all processes
+    uint32_t pages_scanned;  // User pages looked at in the last pass
+    uint32_t pages_shared;   // Distinct frames that are shared after the last pass
+    uint32_t pages_sharing;  // Extra mappings of shared frames (frames saved)
+    uint32_t pages_merged;   // Total merges since boot
+} ksm_stats_t;
+
+// Runs one merge pass over all user processes if the scan interval has passed.
+// Must be called with interrupts disabled (the idle task does this).
+void ksm_scan();
+
+// Returns the current merge statistics.
+const ksm_stats_t* ksm_get_stats();
+
+#endif
@@ -18,6 +18,33 @@ typedef uint32_t pde_t;
 #define PAGING_FLAG_USER          0x4 // Bit 2: User-mode access
 #define PAGING_FLAG_WRITE_THROUGH 0x8 // Bit 3: Page Write-Through (PWT)
 #define PAGING_FLAG_CACHE_DISABLE 0x10 // Bit 4: Page Cache Disable (PCD)
+#define PAGING_FLAG_ACCESSED      0x20 // Bit 5: Set by the CPU when the page is read or written
+#define PAGING_FLAG_DIRTY         0x40 // Bit 6: Set by the CPU when the page is written
+
+// Software-defined flags, stored in the "available" bits 9-11 of a PTE.
+#define PAGING_FLAG_COW           0x200 // Bit 9: Read-only shared page, copy it on write
+#define PAGING_FLAG_SWAPPED       0x400 // Bit 10: Not present, contents live in compressed swap
+#define PAGING_FLAG_SWAP_DISK     0x800 // Bit 11: With SWAPPED, the page is in the disk swap area
+
+// Page fault error code bits pushed by the CPU.
+#define PAGING_FAULT_PRESENT      0x1 // Fault on a present page (protection violation)
+#define PAGING_FAULT_WRITE        0x2 // Fault was caused by a write
+#define PAGING_FAULT_USER         0x4 // Fault happened in user mode
+
+// Kernel virtual memory layout. Everything from KERNEL_VIRT_BASE up belongs to
+// the kernel and its page tables are created once at boot, so every address
+// space shares them by reference. Everything below is left to user space.
+#define KERNEL_VIRT_BASE   0xC0000000 // All of physical memory is mapped here (the kernel image too)
+#define KERNEL_HEAP_START  0xD0000000 // The kernel heap grows up from here
+#define KERNEL_HEAP_SIZE   0x1000000  // 16MB
+#define KERNEL_MMIO_START  0xE0000000 // Device registers (see pci.c)
+#define KERNEL_MMIO_SIZE   0x400000   // 4MB
+
+// Converts between physical addresses and their direct-mapped kernel addresses.
+// VIRT_TO_PHYS only works for the direct map (the kernel image and its data),
+// not for heap or MMIO addresses.
+#define PHYS_TO_VIRT(addr) ((void*)((uint32_t)(addr) + KERNEL_VIRT_BASE))
+#define VIRT_TO_PHYS(addr) ((uint32_t)(addr) - KERNEL_VIRT_BASE)
 
 // A Page Table contains 1024 entries (4KB page size / 4-byte entry = 1024)
 #define PAGE_TABLE_ENTRIES 1024
@@ -43,6 +70,10 @@ page_directory_t* paging_clone_directory(page_directory_t* src);
 // Frees all memory associated with a page directory.
 void paging_free_directory(page_directory_t* dir);
 
+// Unmaps the user pages in [start, end) of a directory (the current one or
+// not) and frees their frames and swap slots.
+void paging_unmap_range(page_directory_t* dir, uint32_t start, uint32_t end);
+
 // Maps a virtual address to a physical address in the given page directory.
 void paging_map_page(page_directory_t* dir, uint32_t virt_addr, uint32_t phys_addr, uint32_t flags);
 
@@ -55,4 +86,18 @@ void paging_switch_directory(page_directory_t* dir);
 // Dumps debug info for a given virtual address's mapping.
 void paging_dump_entry_for_addr(uint32_t virt_addr);
 
+// Tries to resolve a page fault (e.g. a write to a copy-on-write page,
+// or an access to a page that was moved to swap).
+// Returns true if the faulting instruction can simply be retried.
+bool paging_handle_fault(uint32_t fault_addr, uint32_t err_code);
+
+// Makes sure the current task can read (or write) [start, start + size)
+// in user space, bringing swapped pages in and breaking copy-on-write
+// first, so the kernel can access it without faulting. Returns false if
+// some of it is not mapped for the task.
+bool paging_user_access(uint32_t start, uint32_t size, bool write);
+
+// Returns how many copy-on-write faults have been resolved.
+uint32_t paging_get_cow_fault_count();
+
 #endif
\ No newline at end of file
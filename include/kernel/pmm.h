@@ -8,23 +8,41 @@
 // Expose the bitmap size for heap calculation
 extern uint32_t pmm_bitmap_size;
 
+// Number of frames the PMM manages. Paging maps all of them into kernel space.
+extern uint32_t pmm_total_frames;
+
 #define PMM_FRAME_SIZE 4096 // We'll use 4KB frames
 
 // Initializes the physical memory manager.
 // mem_size_bytes: The total amount of physical memory available.
 void pmm_init(uint32_t mem_size_bytes);
 
+// A function that tries to free a frame when memory runs out.
+// It returns true if at least one frame was released.
+typedef bool (*pmm_reclaim_t)();
+
 // Allocates a single 4KB frame of physical memory.
 // Returns the physical address of the allocated frame, or 0 if no frames are free.
 void* pmm_alloc_frame();
 
 // Frees a previously allocated physical memory frame.
 // addr: The physical address of the frame to free.
+// If the frame is shared, this only drops one reference.
 void pmm_free_frame(void* addr);
 
-// Returns the first memory address available for use after the PMM bitmap.
+// Takes an extra reference on a frame that is mapped in more than one place.
+// Returns false if the frame cannot take any more references.
+bool pmm_ref_frame(void* addr);
+
+// Returns the number of references held on a frame (0 if it is free).
+uint32_t pmm_get_frame_refs(void* addr);
+
+// Returns the first memory address available for use after the PMM's own data.
 void* pmm_get_free_addr();
 
+// Registers a handler that pmm_alloc_frame calls before giving up.
+void pmm_set_reclaim_handler(pmm_reclaim_t handler);
+
 // count the number of free frames.
 uint32_t pmm_get_free_frame_count();
 
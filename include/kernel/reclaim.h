@@ -0,0 +1,31 @@
+// myos/include/kernel/reclaim.h
+
+#ifndef RECLAIM_H
+#define RECLAIM_H
+
+#include <kernel/types.h>
+#include <kernel/paging.h>
+
+// How many victim pages a single reclaim attempt may look at before giving up.
+#define RECLAIM_TRIES 64
+
+// What a swap backend did with a victim page.
+typedef enum {
+    RECLAIM_FREED,    // The page was swapped out and its frame freed
+    RECLAIM_POOLED,   // The page was swapped out but its frame is kept by the backend
+    RECLAIM_REJECTED, // The backend does not want this page, it stays in memory
+    RECLAIM_FULL      // The backend has no room left
+} reclaim_result_t;
+
+// Registers the reclaim path as the PMM's handler for running out of frames.
+void reclaim_init();
+
+// Swaps out cold user pages until one frame has been freed. Pages go to the
+// compressed RAM pool first and to the disk swap area once that is full.
+// Returns true on success. Called by the PMM when it runs out of frames.
+bool reclaim_frame();
+
+// Returns true if a PTE maps a private user page that swapping could free.
+bool reclaim_can_swap(pte_t pte);
+
+#endif
@@ -0,0 +1,51 @@
+// myos/include/kernel/swap.h
+
+#ifndef SWAP_H
+#define SWAP_H
+
+#include <kernel/types.h>
+#include <kernel/paging.h>
+#include <kernel/reclaim.h>
+#include <kernel/disk.h>
+
+// The swap area is a raw region of the disk image right after the 1.44MB
+// FAT12 volume. The Makefile appends it when it creates the image.
+#define SWAP_START_LBA 2880
+
+// Size of the swap area in pages (4MB).
+#define SWAP_PAGES 1024
+
+#define SWAP_SECTORS_PER_PAGE (PMM_FRAME_SIZE / DISK_SECTOR_SIZE)
+
+// Neighbouring cold pages are written (and read back) together, up to this many.
+#define SWAP_CLUSTER_PAGES 8
+
+// Statistics about the disk swap area.
+typedef struct {
+    uint32_t total_slots;     // Pages the swap area can hold (0 if there is none)
+    uint32_t used_slots;      // Pages currently in the swap area
+    uint32_t pages_out;       // Pages written since boot
+    uint32_t clusters_out;    // Write commands issued for those pages
+    uint32_t pages_in;        // Pages read back since boot, including read-ahead
+    uint32_t faults;          // Page faults served from the swap area
+    uint32_t readahead_pages; // Neighbouring pages read along with a faulting one
+} swap_stats_t;
+
+// Checks that the disk is big enough to hold the swap area.
+void swap_init();
+
+// Writes a cold page, and the cold pages right after it in the same page
+// table, to the swap area in one go. pte must be mapped writable.
+reclaim_result_t swap_store_pages(pte_t* pte, uint32_t virt_addr, bool is_current);
+
+// Reads a swapped-out page back after a fault on it, together with the
+// neighbours that were written in the same cluster.
+bool swap_load_page(pte_t* pte, uint32_t virt_addr);
+
+// Releases the swap slot referenced by a swapped-out PTE, e.g. on process exit.
+void swap_free_entry(pte_t pte);
+
+// Returns the current swap statistics.
+const swap_stats_t* swap_get_stats();
+
+#endif
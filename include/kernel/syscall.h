@@ -10,4 +10,8 @@ typedef void (*syscall_t)(registers_t *r);
 
 void syscall_install();
 
+// Points the calling CPU's SYSENTER MSRs at sysenter_entry, if it has
+// SYSENTER. syscall_install() does it for the boot CPU.
+void syscall_init_cpu();
+
 #endif
\ No newline at end of file
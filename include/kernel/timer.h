@@ -5,12 +5,71 @@
 
 #include <kernel/types.h>
 
+// Number of buckets in the timer wheel. Must be a power of two.
+#define TIMER_WHEEL_SIZE 256
+
+// The PIT runs at 100Hz, so 1 tick = 10ms.
+#define TIMER_HZ 100
+
+// The PIT's input clock, and the counter value for one tick.
+#define PIT_BASE_FREQUENCY 1193180
+#define PIT_TICK_COUNT (PIT_BASE_FREQUENCY / TIMER_HZ)
+
+// The longest one-shot the 16-bit PIT counter can do, in whole ticks (5 = 50ms).
+// Longer idle periods use the boot CPU's APIC timer, when there is one.
+#define TIMER_MAX_IDLE_TICKS (0xFFFF / PIT_TICK_COUNT)
+
+// Statistics about timer interrupts.
+typedef struct {
+    uint32_t interrupts;    // Timer interrupts taken
+    uint32_t idle_entries;  // Times the periodic tick was stopped for the idle task
+    uint32_t ticks_skipped; // Ticks that passed without an interrupt
+} timer_stats_t;
+
+// Called from the timer interrupt, with interrupts disabled, when a timer expires.
+typedef void (*timer_callback_t)(void* data);
+
+// A one-shot kernel timer. The owner embeds it (e.g. in the PCB), so arming
+// a timer never allocates.
+typedef struct kernel_timer {
+    uint32_t expires;                 // Tick at which the callback runs
+    timer_callback_t callback;
+    void* data;                       // Passed to the callback
+    struct kernel_timer* next;        // Next timer in the same wheel bucket
+    struct kernel_timer** pprev;      // The pointer that points at us, NULL when not armed
+} kernel_timer_t;
+
 // Initializes the PIT and registers its IRQ handler.
 void timer_install();
 uint32_t timer_get_ticks(); // getter func
 void sleep(uint32_t ms);
 void delay_ms(uint32_t ms);
 
+// Arms a timer to run callback(data) at tick 'expires'. A timer that is
+// already armed is moved. Expiry times in the past run on the next tick.
+void timer_add(kernel_timer_t* timer, uint32_t expires, timer_callback_t callback, void* data);
+
+// Disarms a timer. Returns true if it was armed.
+bool timer_cancel(kernel_timer_t* timer);
+
+// Called by the idle task, with interrupts disabled, right before it halts.
+// Stops the periodic tick and programs a one-shot interrupt for the next
+// timer that is due. The PIT covers up to TIMER_MAX_IDLE_TICKS; anything
+// further away stops the PIT and uses the APIC timer, which reaches about
+// a minute. Without an APIC, idle still wakes every TIMER_MAX_IDLE_TICKS.
+void timer_idle_enter();
+
+// Called for the boot CPU's APIC timer interrupt, which ends an idle
+// period that was too long for the PIT.
+void timer_idle_interrupt(bool user);
+
+// Called by the idle task, with interrupts disabled, after it wakes up.
+// Catches the tick count up with the time that passed while halted.
+void timer_idle_exit();
+
+// Returns the timer interrupt statistics.
+const timer_stats_t* timer_get_stats();
+
 // Speaker Functions
 void play_sound(uint32_t frequency);
 void nosound();
@@ -0,0 +1,45 @@
+// myos/include/kernel/zram.h
+
+#ifndef ZRAM_H
+#define ZRAM_H
+
+#include <kernel/types.h>
+#include <kernel/paging.h>
+#include <kernel/reclaim.h>
+
+// Maximum number of pages the compressed pool can hold at once.
+#define ZRAM_MAX_SLOTS 1024
+
+// Maximum number of frames the compressed pool may use for its data.
+#define ZRAM_MAX_POOL_PAGES 256
+
+// Pages that do not shrink below this size are not worth keeping in the pool.
+#define ZRAM_MAX_COMPRESSED 3072
+
+// Statistics about the compressed swap pool.
+typedef struct {
+    uint32_t pages_stored;     // Pages currently held in the pool
+    uint32_t same_pages;       // Of those, pages filled with one repeated value (no data stored)
+    uint32_t orig_bytes;       // Uncompressed size of the stored pages
+    uint32_t compressed_bytes; // Compressed size of the stored pages
+    uint32_t pool_pages;       // Frames currently used by the pool
+    uint32_t hits;             // Page faults served from the pool
+    uint32_t misses;           // Pages turned away because the pool was full
+    uint32_t rejected;         // Pages that did not compress well enough
+} zram_stats_t;
+
+// Compresses a cold page into the pool and turns its PTE into a swap entry.
+// pte must be mapped writable; is_current says whether its address space is active.
+reclaim_result_t zram_store_page(pte_t* pte, uint32_t virt_addr, bool is_current);
+
+// Brings a swapped-out page back into memory after a fault on it.
+// pte is the (not present) entry in the current address space.
+bool zram_load_page(pte_t* pte, uint32_t virt_addr);
+
+// Releases the pool slot referenced by a swapped-out PTE, e.g. on process exit.
+void zram_free_entry(pte_t pte);
+
+// Returns the current pool statistics.
+const zram_stats_t* zram_get_stats();
+
+#endif
@@ -2,6 +2,10 @@
 
 #include <kernel/exceptions.h>
 #include <kernel/vga.h>
+#include <kernel/paging.h> // paging_handle_fault()
+#include <kernel/cpu/fpu.h> // fpu_handle_nm()
+#include <kernel/cpu/smp.h> // lock_kernel()
+#include <kernel/cpu/signal.h> // signal_deliver()
 
 // Helper function to print the names of the set EFLAGS bits
 static void print_eflags(uint32_t eflags) {
@@ -34,6 +38,31 @@ void fault_handler(registers_t *r) {
     uint32_t faulting_address;
     __asm__ __volatile__("mov %%cr2, %0" : "=r" (faulting_address));
 
+    lock_kernel();
+
+    // Some page faults are expected (e.g. copy-on-write). If the paging code
+    // resolves one, we simply return and the instruction is retried.
+    if (r->int_no == 14 && paging_handle_fault(faulting_address, r->err_code)) {
+        signal_deliver(r);
+        unlock_kernel();
+        return;
+    }
+
+    // #NM: the task touched the FPU after a switch, give it its own state.
+    if (r->int_no == 7 && fpu_handle_nm()) {
+        signal_deliver(r);
+        unlock_kernel();
+        return;
+    }
+
+    // #DB in the kernel: a program that single-steps into SYSENTER takes
+    // the trap on the first instruction of sysenter_entry. Stop stepping.
+    if (r->int_no == 1 && (r->cs & 3) == 0) {
+        r->eflags &= ~0x100;
+        unlock_kernel();
+        return;
+    }
+
     // clear screen for fault handler
     clear_screen();
 
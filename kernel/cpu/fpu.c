@@ -0,0 +1,165 @@
+// myos/kernel/cpu/fpu.c
+
+#include <kernel/cpu/fpu.h>
+#include <kernel/pmm.h>
+#include <kernel/paging.h>  // For PHYS_TO_VIRT
+#include <kernel/string.h>  // For memcpy
+#include <kernel/debug.h>
+
+#define CR0_MP (1 << 1)  // WAIT/FWAIT honour TS as well
+#define CR0_EM (1 << 2)  // No FPU present, emulate (must be clear)
+#define CR0_TS (1 << 3)  // Task switched: the next FPU instruction raises #NM
+#define CR0_NE (1 << 5)  // Report FPU errors as #MF instead of through the PIC
+
+#define CR4_OSFXSR     (1 << 9)  // The OS uses FXSAVE/FXRSTOR, which enables SSE
+#define CR4_OSXMMEXCPT (1 << 10) // The OS handles SIMD exceptions (#XM)
+
+#define CPUID_FXSR (1 << 24)
+#define CPUID_SSE  (1 << 25)
+
+// Does the CPU have FXSAVE/FXRSTOR? Without it we fall back to FSAVE/FRSTOR.
+static bool fpu_has_fxsr = false;
+
+// State right after FNINIT (and a default MXCSR), copied into every new area.
+static uint8_t fpu_initial_state[FPU_STATE_SIZE] __attribute__((aligned(16)));
+
+// Free save areas, linked through their first word. They are carved out of
+// whole frames, which keeps them 16-byte aligned as FXSAVE requires.
+static void* fpu_free_list = NULL;
+
+static inline void fpu_set_ts() {
+    uint32_t cr0;
+    __asm__ __volatile__("mov %%cr0, %0" : "=r"(cr0));
+    __asm__ __volatile__("mov %0, %%cr0" : : "r"(cr0 | CR0_TS));
+}
+
+static inline void fpu_save(void* area) {
+    if (fpu_has_fxsr) {
+        __asm__ __volatile__("fxsave (%0)" : : "r"(area) : "memory");
+    } else {
+        __asm__ __volatile__("fnsave (%0)" : : "r"(area) : "memory");
+    }
+}
+
+static inline void fpu_restore(void* area) {
+    if (fpu_has_fxsr) {
+        __asm__ __volatile__("fxrstor (%0)" : : "r"(area) : "memory");
+    } else {
+        __asm__ __volatile__("frstor (%0)" : : "r"(area) : "memory");
+    }
+}
+
+// Takes a save area from the free list, refilling it from a new frame.
+static void* fpu_alloc_state() {
+    if (!fpu_free_list) {
+        void* frame = pmm_alloc_frame();
+        if (!frame) {
+            return NULL;
+        }
+        uint8_t* areas = (uint8_t*)PHYS_TO_VIRT(frame);
+        for (int i = 0; i < PMM_FRAME_SIZE / FPU_STATE_SIZE; i++) {
+            *(void**)(areas + i * FPU_STATE_SIZE) = fpu_free_list;
+            fpu_free_list = areas + i * FPU_STATE_SIZE;
+        }
+    }
+    void* area = fpu_free_list;
+    fpu_free_list = *(void**)area;
+    return area;
+}
+
+// Turns on the calling CPU's FPU (and SSE). Returns the CPUID feature bits.
+static uint32_t fpu_enable() {
+    uint32_t eax, ebx, ecx, edx;
+    __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    fpu_has_fxsr = (edx & CPUID_FXSR) != 0;
+
+    uint32_t cr0;
+    __asm__ __volatile__("mov %%cr0, %0" : "=r"(cr0));
+    cr0 = (cr0 & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE;
+    __asm__ __volatile__("mov %0, %%cr0" : : "r"(cr0));
+
+    if (fpu_has_fxsr) {
+        uint32_t cr4;
+        __asm__ __volatile__("mov %%cr4, %0" : "=r"(cr4));
+        cr4 |= CR4_OSFXSR;
+        if (edx & CPUID_SSE) {
+            cr4 |= CR4_OSXMMEXCPT;
+        }
+        __asm__ __volatile__("mov %0, %%cr4" : : "r"(cr4));
+    }
+    return edx;
+}
+
+// Sets up the FPU and captures the clean state new tasks start from.
+void fpu_init() {
+    uint32_t edx = fpu_enable();
+
+    __asm__ __volatile__("fninit");
+    if (fpu_has_fxsr && (edx & CPUID_SSE)) {
+        uint32_t mxcsr = 0x1F80; // All SIMD exceptions masked, round to nearest
+        __asm__ __volatile__("ldmxcsr %0" : : "m"(mxcsr));
+    }
+    fpu_save(fpu_initial_state);
+
+    // Nobody owns the FPU yet, so the first use by anyone traps.
+    fpu_set_ts();
+
+    qemu_debug_string(fpu_has_fxsr ? "FPU: Lazy switching with FXSAVE" : "FPU: Lazy switching with FSAVE");
+    qemu_debug_string((edx & CPUID_SSE) ? ", SSE enabled.\n" : ".\n");
+}
+
+// Every CPU has its own FPU. The clean state from the boot CPU does for all.
+void fpu_init_ap() {
+    fpu_enable();
+    fpu_set_ts();
+}
+
+// Only the owner may touch the FPU without trapping.
+void fpu_switch(task_struct_t* next) {
+    if (next == this_cpu()->fpu_owner) {
+        __asm__ __volatile__("clts");
+    } else {
+        fpu_set_ts();
+    }
+}
+
+// The current task used the FPU after a switch. Hand the registers over.
+bool fpu_handle_nm() {
+    cpu_t* cpu = this_cpu();
+    __asm__ __volatile__("clts");
+    if (cpu->fpu_owner == current_task) {
+        return true;
+    }
+
+    // First use: start from the clean state.
+    if (!current_task->fpu_state) {
+        current_task->fpu_state = fpu_alloc_state();
+        if (!current_task->fpu_state) {
+            qemu_debug_string("FPU: No memory for the FPU state of PID ");
+            qemu_debug_dec(current_task->pid);
+            qemu_debug_string("\n");
+            fpu_set_ts();
+            return false;
+        }
+        memcpy(current_task->fpu_state, fpu_initial_state, FPU_STATE_SIZE);
+    }
+
+    if (cpu->fpu_owner) {
+        fpu_save(cpu->fpu_owner->fpu_state);
+    }
+    fpu_restore(current_task->fpu_state);
+    cpu->fpu_owner = current_task;
+    return true;
+}
+
+// Gives a task's save area back. Its register contents are simply dropped.
+void fpu_release(task_struct_t* task) {
+    if (cpus[task->cpu].fpu_owner == task) {
+        cpus[task->cpu].fpu_owner = NULL;
+    }
+    if (task->fpu_state) {
+        *(void**)task->fpu_state = fpu_free_list;
+        fpu_free_list = task->fpu_state;
+        task->fpu_state = NULL;
+    }
+}
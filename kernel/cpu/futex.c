@@ -0,0 +1,183 @@
+// myos/kernel/cpu/futex.c
+
+#include <kernel/cpu/futex.h>
+#include <kernel/cpu/process.h>
+#include <kernel/cpu/sched.h>     // For sched_wake
+#include <kernel/cpu/spinlock.h>
+#include <kernel/cpu/signal.h>    // For signal_pending
+#include <kernel/paging.h>
+#include <kernel/pmm.h>
+#include <kernel/timer.h>
+
+// A task sleeping in futex_wait(). It lives on that task's kernel stack.
+typedef struct futex_waiter {
+    uint32_t key;                 // Physical address of the word
+    task_struct_t* task;
+    bool woken;                   // Taken off the bucket by futex_wake()
+    kernel_timer_t timer;         // Ends the wait early, if there is a timeout
+    struct futex_waiter* next;    // Next waiter in the same bucket
+} futex_waiter_t;
+
+// The waiters of all futexes whose keys hash to the same bucket, oldest first.
+typedef struct {
+    spinlock_t lock;
+    futex_waiter_t* head;
+    futex_waiter_t* tail;
+} futex_bucket_t;
+
+static futex_bucket_t futex_table[FUTEX_HASH_SIZE];
+
+static futex_bucket_t* futex_bucket(uint32_t key) {
+    // Words are aligned, the low two bits carry nothing.
+    return &futex_table[((key >> 2) ^ (key >> 12)) & (FUTEX_HASH_SIZE - 1)];
+}
+
+static bool futex_user_word(uint32_t uaddr) {
+    return (uaddr & 3) == 0 && uaddr < KERNEL_VIRT_BASE;
+}
+
+// Returns the physical address of the user word at 'uaddr', or 0 if its
+// page is not present.
+static uint32_t futex_key(uint32_t uaddr) {
+    pte_t* pte = paging_get_page(current_task->page_directory, uaddr, false, 0);
+    uint32_t wanted = PAGING_FLAG_PRESENT | PAGING_FLAG_USER;
+    if (!pte || (*pte & wanted) != wanted) {
+        return 0;
+    }
+    return (*pte & ~0xFFF) | (uaddr & 0xFFF);
+}
+
+// Like futex_key(), but brings a swapped page back in and gives a shared
+// copy-on-write page a private copy first. The extra reference on the frame
+// keeps reclaim and KSM away from it (see ksm.c) while we wait, so the key
+// stays valid. Called with preemption disabled, so no reclaim runs between
+// the lookup and the reference.
+static uint32_t futex_pin(uint32_t uaddr) {
+    pte_t* pte = paging_get_page(current_task->page_directory, uaddr, false, 0);
+    if (!pte) {
+        return 0;
+    }
+    if (!(*pte & PAGING_FLAG_PRESENT) && (*pte & PAGING_FLAG_SWAPPED)) {
+        paging_handle_fault(uaddr, PAGING_FAULT_USER);
+    }
+    if ((*pte & PAGING_FLAG_PRESENT) && (*pte & PAGING_FLAG_COW)) {
+        paging_handle_fault(uaddr, PAGING_FAULT_PRESENT | PAGING_FAULT_WRITE | PAGING_FAULT_USER);
+    }
+
+    uint32_t key = futex_key(uaddr);
+    if (key && !pmm_ref_frame((void*)(key & ~0xFFF))) {
+        return 0;
+    }
+    return key;
+}
+
+// Timer callback: the waiter's time is up. It takes itself off the bucket.
+static void futex_timeout(void* data) {
+    futex_waiter_t* waiter = (futex_waiter_t*)data;
+    if (waiter->task->state == TASK_STATE_WAITING) {
+        sched_wake(waiter->task);
+    }
+}
+
+// Takes a waiter off its bucket. Called with the bucket's lock held.
+static void futex_unlink(futex_bucket_t* bucket, futex_waiter_t* waiter) {
+    futex_waiter_t* prev = NULL;
+    for (futex_waiter_t* w = bucket->head; w != waiter; w = w->next) {
+        prev = w;
+    }
+    if (prev) {
+        prev->next = waiter->next;
+    } else {
+        bucket->head = waiter->next;
+    }
+    if (bucket->tail == waiter) {
+        bucket->tail = prev;
+    }
+}
+
+int futex_wait(uint32_t uaddr, uint32_t val, uint32_t timeout_ms) {
+    if (!futex_user_word(uaddr)) {
+        return FUTEX_FAULT;
+    }
+    preempt_disable();
+    uint32_t key = futex_pin(uaddr);
+    preempt_enable();
+    if (!key) {
+        return FUTEX_FAULT;
+    }
+
+    futex_bucket_t* bucket = futex_bucket(key);
+    futex_waiter_t waiter = { .key = key, .task = current_task };
+    int result = FUTEX_WOKEN;
+
+    // futex_wake() takes the same lock, so it either sees us on the bucket
+    // or ran before we read the word. The frame is pinned, so we read it
+    // through the direct map.
+    uint32_t flags = spin_lock_irqsave(&bucket->lock);
+    if (*(volatile uint32_t*)PHYS_TO_VIRT(key) != val) {
+        spin_unlock_irqrestore(&bucket->lock, flags);
+        pmm_free_frame((void*)(key & ~0xFFF));
+        return FUTEX_CHANGED;
+    }
+    if (bucket->tail) {
+        bucket->tail->next = &waiter;
+    } else {
+        bucket->head = &waiter;
+    }
+    bucket->tail = &waiter;
+    current_task->state = TASK_STATE_WAITING;
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    if (timeout_ms) {
+        uint32_t ticks = (timeout_ms + (1000 / TIMER_HZ) - 1) / (1000 / TIMER_HZ);
+        timer_add(&waiter.timer, timer_get_ticks() + ticks, futex_timeout, &waiter);
+    }
+
+    // A wakeup that came in already made us runnable, then this returns soon.
+    // A signal that is already pending would not wake us, so do not wait.
+    if (!signal_pending(current_task)) {
+        __asm__ __volatile__("int $0x20");
+    }
+
+    if (timeout_ms) {
+        timer_cancel(&waiter.timer);
+    }
+    flags = spin_lock_irqsave(&bucket->lock);
+    current_task->state = TASK_STATE_RUNNING;
+    if (!waiter.woken) {
+        futex_unlink(bucket, &waiter);
+        result = signal_pending(current_task) ? FUTEX_INTERRUPTED : FUTEX_TIMEDOUT;
+    }
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    pmm_free_frame((void*)(key & ~0xFFF)); // Unpins the frame
+    return result;
+}
+
+int futex_wake(uint32_t uaddr, int count) {
+    if (!futex_user_word(uaddr)) {
+        return FUTEX_FAULT;
+    }
+    // Waiters pin their page, so nobody waits on one that is not present.
+    uint32_t key = futex_key(uaddr);
+    if (!key) {
+        return 0;
+    }
+
+    futex_bucket_t* bucket = futex_bucket(key);
+    int woken = 0;
+    uint32_t flags = spin_lock_irqsave(&bucket->lock);
+    futex_waiter_t* waiter = bucket->head;
+    while (waiter && woken < count) {
+        futex_waiter_t* next = waiter->next;
+        if (waiter->key == key) {
+            futex_unlink(bucket, waiter);
+            waiter->woken = true;
+            sched_wake(waiter->task); // Just marks it running if it has not switched away yet
+            woken++;
+        }
+        waiter = next;
+    }
+    spin_unlock_irqrestore(&bucket->lock, flags);
+    return woken;
+}
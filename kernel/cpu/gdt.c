@@ -2,6 +2,7 @@
 
 #include <kernel/gdt.h>
 #include <kernel/types.h>
+#include <kernel/cpu/smp.h> // For cpus[]
 
 // GDT entry structure
 struct gdt_entry_struct {
@@ -13,37 +14,60 @@ struct gdt_entry_struct {
     uint8_t  base_high;
 } __attribute__((packed));
 
-// Our GDT will now have 6 entries
-static struct gdt_entry_struct gdt_entries[6];
-static struct gdt_ptr_struct   gdt_ptr;
+// Our GDT will now have 7 entries. Every CPU has its own copy, since the TSS
+// and the per-CPU data segment differ between them.
+#define GDT_ENTRIES 7
+static struct gdt_entry_struct gdt_entries[SMP_MAX_CPUS][GDT_ENTRIES];
+static struct gdt_ptr_struct   gdt_ptrs[SMP_MAX_CPUS];
 
-// Helper function to create a GDT entry
-void gdt_set_gate(int32_t num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
-    gdt_entries[num].base_low    = (base & 0xFFFF);
-    gdt_entries[num].base_middle = (base >> 16) & 0xFF;
-    gdt_entries[num].base_high   = (base >> 24) & 0xFF;
+// Helper function to create a GDT entry in a given CPU's table
+static void gdt_set_cpu_gate(int cpu, int32_t num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+    struct gdt_entry_struct* entry = &gdt_entries[cpu][num];
+    entry->base_low    = (base & 0xFFFF);
+    entry->base_middle = (base >> 16) & 0xFF;
+    entry->base_high   = (base >> 24) & 0xFF;
 
-    gdt_entries[num].limit_low   = (limit & 0xFFFF);
-    gdt_entries[num].granularity = ((limit >> 16) & 0x0F) | (gran & 0xF0);
-    gdt_entries[num].access      = access;
+    entry->limit_low   = (limit & 0xFFFF);
+    entry->granularity = ((limit >> 16) & 0x0F) | (gran & 0xF0);
+    entry->access      = access;
 }
 
-// Main function to install the GDT with 6 Entries
-void gdt_install() {
-    gdt_ptr.limit = (sizeof(struct gdt_entry_struct) * 6) - 1;
-    gdt_ptr.base  = (uint32_t)&gdt_entries;
-    
+void gdt_set_gate(int32_t num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+    gdt_set_cpu_gate(this_cpu()->id, num, base, limit, access, gran);
+}
+
+// Fills in and loads one CPU's GDT, then points %gs at its cpu_t.
+static void gdt_setup(int cpu) {
+    gdt_ptrs[cpu].limit = (sizeof(struct gdt_entry_struct) * GDT_ENTRIES) - 1;
+    gdt_ptrs[cpu].base  = (uint32_t)&gdt_entries[cpu];
+
     // Kernel Segments (Ring 0)
-    gdt_set_gate(0, 0, 0, 0, 0);                // Null segment
-    gdt_set_gate(1, 0, 0xFFFFFFFF, 0x9A, 0xCF); // Code segment (Ring 0)
-    gdt_set_gate(2, 0, 0xFFFFFFFF, 0x92, 0xCF); // Data segment (Ring 0)
+    gdt_set_cpu_gate(cpu, 0, 0, 0, 0, 0);                // Null segment
+    gdt_set_cpu_gate(cpu, 1, 0, 0xFFFFFFFF, 0x9A, 0xCF); // Code segment (Ring 0)
+    gdt_set_cpu_gate(cpu, 2, 0, 0xFFFFFFFF, 0x92, 0xCF); // Data segment (Ring 0)
 
     // User Segments (Ring 3)
-    gdt_set_gate(3, 0, 0xFFFFFFFF, 0xFA, 0xCF); // User Code
-    gdt_set_gate(4, 0, 0xFFFFFFFF, 0xF2, 0xCF); // User Data
+    gdt_set_cpu_gate(cpu, 3, 0, 0xFFFFFFFF, 0xFA, 0xCF); // User Code
+    gdt_set_cpu_gate(cpu, 4, 0, 0xFFFFFFFF, 0xF2, 0xCF); // User Data
+
+    // The TSS entry (5) will be set up by tss_install()
 
-    // The TSS entry will be set up by tss_install()
+    // Per-CPU data (Ring 0), byte granular and just big enough for a cpu_t.
+    cpus[cpu].self = &cpus[cpu];
+    cpus[cpu].id = cpu;
+    gdt_set_cpu_gate(cpu, 6, (uint32_t)&cpus[cpu], sizeof(cpu_t) - 1, 0x92, 0x40);
 
-    // Load our new GDT using the safe assembly function.
-    gdt_flush(&gdt_ptr);
-}
\ No newline at end of file
+    // Load our new GDT using the safe assembly function. It reloads every
+    // data segment register with the flat kernel segment, %gs included.
+    gdt_flush(&gdt_ptrs[cpu]);
+    __asm__ __volatile__("mov %0, %%gs" : : "r"((uint16_t)GDT_PERCPU_SELECTOR));
+}
+
+// Main function to install the boot CPU's GDT
+void gdt_install() {
+    gdt_setup(0);
+}
+
+void gdt_install_ap(int cpu) {
+    gdt_setup(cpu);
+}
@@ -19,6 +19,9 @@ extern void irq4(); extern void irq5(); extern void irq6(); extern void irq7();
 extern void irq8(); extern void irq9(); extern void irq10(); extern void irq11();
 extern void irq12(); extern void irq13(); extern void irq14(); extern void irq15();
 
+// The local APIC vectors (see lapic.h)
+extern void irq64(); extern void irq65(); extern void irq255();
+
 // Declare our IDT with 256 entries.
 struct idt_entry_struct idt_entries[256];
 struct idt_ptr_struct   idt_ptr;
@@ -107,6 +110,9 @@ void idt_install() {
     idt_set_gate(45, (uint32_t)irq13, 0x08, 0x8E);
     idt_set_gate(46, (uint32_t)irq14, 0x08, 0x8E);
     idt_set_gate(47, (uint32_t)irq15, 0x08, 0x8E);
+    idt_set_gate(64, (uint32_t)irq64, 0x08, 0x8E);
+    idt_set_gate(65, (uint32_t)irq65, 0x08, 0x8E);
+    idt_set_gate(255, (uint32_t)irq255, 0x08, 0x8E);
 
     // Set the gate for our system call interrupt 0x80
     // The flags 0xEE mean: Present, Ring 3, 32-bit Trap Gate
@@ -114,4 +120,9 @@ void idt_install() {
 
     // Load the IDT using our new inline assembly function
     idt_load_inline(&idt_ptr);
-}
\ No newline at end of file
+}
+
+// Loads the (shared) IDT on an application processor.
+void idt_load() {
+    idt_load_inline(&idt_ptr);
+}
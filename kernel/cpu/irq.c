@@ -3,6 +3,9 @@
 #include <kernel/irq.h>
 #include <kernel/io.h>
 #include <kernel/vga.h>
+#include <kernel/cpu/smp.h>   // For the kernel lock
+#include <kernel/cpu/lapic.h> // For the LAPIC vectors
+#include <kernel/cpu/signal.h> // For signal_deliver
 
 // Array of function pointers for handling custom IRQ handlers
 static void *irq_routines[16] = {0};
@@ -21,15 +24,33 @@ void irq_uninstall_handler(int irq) {
 void irq_handler(registers_t *r) {
     void (*handler)(registers_t *r);
 
+    lock_kernel();
+
+    // The local APIC's own vectors are acknowledged at the APIC.
+    if (r->int_no >= LAPIC_TIMER_VECTOR) {
+        smp_interrupt(r);
+        signal_deliver(r);
+        unlock_kernel();
+        return;
+    }
+
     // Find the handler for this IRQ number
     handler = irq_routines[r->int_no - 32];
     if (handler) {
         handler(r);
     }
 
-    // Send the EOI (End of Interrupt) signal to the PICs
-    if (r->int_no >= 40) {
-        port_byte_out(0xA0, 0x20); // Send EOI to slave PIC
+    // Send the EOI (End of Interrupt) signal to the PICs. They are only wired
+    // to the boot CPU; anywhere else vector 0x20 is a software yield.
+    if (this_cpu()->id == 0) {
+        if (r->int_no >= 40) {
+            port_byte_out(0xA0, 0x20); // Send EOI to slave PIC
+        }
+        port_byte_out(0x20, 0x20); // Send EOI to master PIC
     }
-    port_byte_out(0x20, 0x20); // Send EOI to master PIC
+
+    // An interrupt that came from user mode returns there, so a pending
+    // signal (e.g. from an alarm that just expired) is delivered now.
+    signal_deliver(r);
+    unlock_kernel();
 }
\ No newline at end of file
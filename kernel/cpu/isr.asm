@@ -81,6 +81,11 @@ IRQ 13, 45  ; FPU
 IRQ 14, 46  ; Primary ATA Hard Disk
 IRQ 15, 47  ; Secondary ATA Hard Disk
 
+; Vectors raised by the local APICs (see lapic.h). They share the IRQ path.
+IRQ 64, 64  ; LAPIC timer of an application processor
+IRQ 65, 65  ; Reschedule IPI
+IRQ 255, 255 ; Spurious
+
 ; --- Define our System Call Handler ---
 global isr128
 isr128:
@@ -118,6 +123,7 @@ isr_common_stub:
     mov ds, ax
     mov es, ax
     mov fs, ax
+    mov ax, 0x30  ; GS points at this CPU's cpu_t (GDT_PERCPU_SELECTOR)
     mov gs, ax
 
     ; 4. Push a pointer to the register block and call the C handler
@@ -172,6 +178,7 @@ irq_common_stub:
     mov ds, ax
     mov es, ax
     mov fs, ax
+    mov ax, 0x30  ; GS points at this CPU's cpu_t (GDT_PERCPU_SELECTOR)
     mov gs, ax
 
     ; Push a pointer to the registers and call the C handler
@@ -223,6 +230,7 @@ syscall_common_stub:
     mov ds, ax
     mov es, ax
     mov fs, ax
+    mov ax, 0x30  ; GS points at this CPU's cpu_t (GDT_PERCPU_SELECTOR)
     mov gs, ax
 
     ; Push a pointer to the registers and call the C handler
@@ -230,6 +238,8 @@ syscall_common_stub:
     call syscall_handler
     add esp, 4 ; Clean up the pushed pointer
 
+; SYSENTER calls return this way too when SYSEXIT cannot restore their state.
+syscall_return:
     ; Restore original segment registers
     pop eax
     mov gs, ax
@@ -243,4 +253,100 @@ syscall_common_stub:
     ; Restore general purpose registers
     popa
     add esp, 8 ; Clean up the error code and interrupt number
-    iret       ; Atomically restores EFLAGS and returns.
\ No newline at end of file
+    iret       ; Atomically restores EFLAGS and returns.
+
+; --- SYSENTER Entry ---
+; The fast way in (see syscall_init_cpu). The wrapper in the user library
+; passes the syscall number and arguments like for int 0x80, plus its stack
+; pointer in EBP and where to return to in EDI. SYSENTER disables
+; interrupts and starts us on this CPU's sysenter_stack, right below its
+; TSS, with the user's data segments still loaded.
+global sysenter_entry
+sysenter_entry:
+    mov esp, [esp + 4] ; The task's kernel stack, from the TSS's esp0
+
+    ; Build the frame int 0x80 would have, so the C side cannot tell the
+    ; difference and signals work the same.
+    push dword 0x23       ; SS: user data
+    push ebp              ; User ESP
+    pushfd
+    or dword [esp], 0x200 ; User code always runs with interrupts enabled
+    push dword 0x1B       ; CS: user code
+    push edi              ; EIP
+    push dword 0          ; Dummy error code
+    push dword 128        ; Interrupt number, as for int 0x80
+    pusha
+
+    xor eax, eax
+    mov ax, ds
+    push eax
+
+    xor eax, eax
+    mov ax, es
+    push eax
+
+    xor eax, eax
+    mov ax, fs
+    push eax
+
+    xor eax, eax
+    mov ax, gs
+    push eax
+
+    cld ; SYSENTER leaves the direction flag as the program set it
+
+    ; The flat user data segment does for C code as well, so DS and ES are
+    ; only loaded if the program changed them. Only GS must be ours.
+    mov ax, 0x23
+    mov cx, ds
+    cmp cx, ax
+    je .ds_ok
+    mov ds, ax
+.ds_ok:
+    mov cx, es
+    cmp cx, ax
+    je .es_ok
+    mov es, ax
+.es_ok:
+    mov ax, 0x30  ; GS points at this CPU's cpu_t (GDT_PERCPU_SELECTOR)
+    mov gs, ax
+
+    push esp
+    call syscall_handler
+    add esp, 4
+
+    ; SYSEXIT can only go back to where we came from, with the user
+    ; segments. If the syscall changed that (sigreturn, or a signal handler
+    ; to run), or DS and ES need restoring, iret does it. EDI and EBP
+    ; still hold the return address and stack, the C code saved them.
+    cmp [esp + 56], edi            ; EIP
+    jne syscall_return
+    cmp [esp + 68], ebp            ; User ESP
+    jne syscall_return
+    cmp dword [esp + 60], 0x1B     ; CS
+    jne syscall_return
+    cmp dword [esp + 72], 0x23     ; SS
+    jne syscall_return
+    cmp dword [esp + 12], 0x23     ; DS
+    jne syscall_return
+    cmp dword [esp + 8], 0x23      ; ES
+    jne syscall_return
+
+    pop eax
+    mov gs, ax
+    pop eax
+    mov fs, ax
+    add esp, 8 ; ES and DS are loaded already
+    popa
+    add esp, 8 ; Clean up the error code and interrupt number
+
+    ; SYSEXIT takes EIP from EDX and ESP from ECX, which the wrapper lets
+    ; us clobber. The flags are the program's, but with interrupts kept off
+    ; until STI takes effect, after the SYSEXIT.
+    mov edx, [esp]
+    mov ecx, [esp + 12]
+    and dword [esp + 8], ~0x200
+    add esp, 8
+    popfd
+    sti
+    sysexit
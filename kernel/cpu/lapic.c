@@ -0,0 +1,165 @@
+// myos/kernel/cpu/lapic.c
+
+#include <kernel/cpu/lapic.h>
+#include <kernel/io.h>    // For the PIT ports and rdmsr/wrmsr
+#include <kernel/timer.h> // For TIMER_HZ and PIT_BASE_FREQUENCY
+#include <kernel/debug.h>
+
+// Register offsets from the APIC base.
+#define LAPIC_REG_ID        0x020
+#define LAPIC_REG_TPR       0x080 // Task priority: 0 accepts every vector
+#define LAPIC_REG_EOI       0x0B0
+#define LAPIC_REG_SVR       0x0F0 // Spurious vector, and the software enable bit
+#define LAPIC_REG_ICR_LOW   0x300 // Writing this sends the IPI
+#define LAPIC_REG_ICR_HIGH  0x310 // Destination APIC ID in bits 24-31
+#define LAPIC_REG_LVT_TIMER 0x320
+#define LAPIC_REG_TIMER_INIT 0x380
+#define LAPIC_REG_TIMER_CUR 0x390
+#define LAPIC_REG_TIMER_DIV 0x3E0
+
+#define LAPIC_SVR_ENABLE     0x100
+#define LAPIC_TIMER_PERIODIC (1 << 17)
+#define LAPIC_TIMER_MASKED   (1 << 16)
+#define LAPIC_TIMER_DIV_16   0x3
+
+#define LAPIC_ICR_INIT         0x500
+#define LAPIC_ICR_STARTUP      0x600
+#define LAPIC_ICR_ASSERT       (1 << 14)
+#define LAPIC_ICR_PENDING      (1 << 12) // Delivery status: still being sent
+#define LAPIC_ICR_ALL_BUT_SELF (3 << 18)
+
+#define MSR_APIC_BASE        0x1B
+#define MSR_APIC_BASE_ENABLE (1 << 11)
+
+#define CPUID_APIC (1 << 9)
+
+extern page_directory_t* kernel_directory;
+
+// APIC timer counts (at divide-by-16) per kernel tick, measured by lapic_init().
+static uint32_t lapic_ticks_per_tick = 0;
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return *(volatile uint32_t*)(LAPIC_VIRT_ADDR + reg);
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(LAPIC_VIRT_ADDR + reg) = value;
+}
+
+// Counts 'count' PIT clocks down on channel 2, with the speaker kept off.
+// OUT2 goes high at the end, which we can see in bit 5 of port 0x61.
+static void pit_wait(uint16_t count) {
+    uint8_t saved = port_byte_in(0x61);
+    port_byte_out(0x61, saved & ~0x03);     // Gate low, speaker off
+    port_byte_out(0x43, 0xB0);              // Channel 2, lo/hi byte, mode 0
+    port_byte_out(0x42, (uint8_t)(count & 0xFF));
+    port_byte_out(0x42, (uint8_t)((count >> 8) & 0xFF));
+    port_byte_out(0x61, (saved & ~0x02) | 0x01); // Gate high: start counting
+    while (!(port_byte_in(0x61) & 0x20));
+    port_byte_out(0x61, saved);
+}
+
+void lapic_delay_us(uint32_t us) {
+    while (us) {
+        uint32_t chunk = us > 50000 ? 50000 : us; // 16 bits of PIT clocks are ~54ms
+        pit_wait((uint16_t)(chunk * (PIT_BASE_FREQUENCY / 1000) / 1000));
+        us -= chunk;
+    }
+}
+
+bool lapic_present() {
+    uint32_t eax, ebx, ecx, edx;
+    __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    return (edx & CPUID_APIC) != 0;
+}
+
+void lapic_enable() {
+    lapic_write(LAPIC_REG_TPR, 0);
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+bool lapic_init() {
+    if (!lapic_present()) {
+        qemu_debug_string("LAPIC: Not present, staying on one CPU.\n");
+        return false;
+    }
+
+    uint64_t base = rdmsr(MSR_APIC_BASE);
+    if (!(base & MSR_APIC_BASE_ENABLE)) {
+        wrmsr(MSR_APIC_BASE, base | MSR_APIC_BASE_ENABLE);
+    }
+    paging_map_page(kernel_directory, LAPIC_VIRT_ADDR, (uint32_t)base & 0xFFFFF000,
+                    PAGING_FLAG_PRESENT | PAGING_FLAG_RW | PAGING_FLAG_CACHE_DISABLE);
+    lapic_enable();
+
+    // Let the timer run down from the top for one PIT tick. Every CPU's
+    // timer runs at the same bus clock, so one measurement does for all.
+    lapic_write(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_MASKED);
+    lapic_write(LAPIC_REG_TIMER_INIT, 0xFFFFFFFF);
+    lapic_delay_us(1000000 / TIMER_HZ);
+    lapic_ticks_per_tick = 0xFFFFFFFF - lapic_read(LAPIC_REG_TIMER_CUR);
+    lapic_write(LAPIC_REG_TIMER_INIT, 0);
+
+    qemu_debug_string("LAPIC: ID ");
+    qemu_debug_dec(lapic_id());
+    qemu_debug_string(", timer counts per tick: ");
+    qemu_debug_dec(lapic_ticks_per_tick);
+    qemu_debug_string("\n");
+    return true;
+}
+
+void lapic_timer_start() {
+    lapic_write(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_REG_TIMER_INIT, lapic_ticks_per_tick);
+}
+
+uint32_t lapic_timer_counts_per_tick() {
+    return lapic_ticks_per_tick;
+}
+
+void lapic_timer_oneshot(uint32_t counts) {
+    lapic_write(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_VECTOR); // Neither periodic nor masked
+    lapic_write(LAPIC_REG_TIMER_INIT, counts);
+}
+
+uint32_t lapic_timer_remaining() {
+    return lapic_read(LAPIC_REG_TIMER_CUR);
+}
+
+uint8_t lapic_id() {
+    return (uint8_t)(lapic_read(LAPIC_REG_ID) >> 24);
+}
+
+void lapic_eoi() {
+    lapic_write(LAPIC_REG_EOI, 0);
+}
+
+// Waits until the previous IPI has left this CPU.
+static void lapic_wait_icr() {
+    while (lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING);
+}
+
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector) {
+    lapic_wait_icr();
+    lapic_write(LAPIC_REG_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LOW, vector);
+}
+
+// The classic INIT-SIPI-SIPI sequence. The second STARTUP is only for CPUs
+// that missed the first; one that is already running ignores it.
+void lapic_start_aps(uint8_t vector) {
+    lapic_wait_icr();
+    lapic_write(LAPIC_REG_ICR_HIGH, 0);
+    lapic_write(LAPIC_REG_ICR_LOW, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_ASSERT | LAPIC_ICR_INIT);
+    lapic_wait_icr();
+    lapic_delay_us(10000);
+
+    for (int i = 0; i < 2; i++) {
+        lapic_write(LAPIC_REG_ICR_LOW, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_ASSERT | LAPIC_ICR_STARTUP | vector);
+        lapic_wait_icr();
+        lapic_delay_us(200);
+    }
+}
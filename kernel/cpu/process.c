@@ -9,12 +9,46 @@
 #include <kernel/string.h> // For memcpy and strlen
 #include <kernel/debug.h>   // debug print
 #include <kernel/timer.h>
+#include <kernel/cpu/sched.h>
+#include <kernel/io.h>      // For irq_save/irq_restore
+#include <kernel/cpu/spinlock.h>
+#include <kernel/cpu/wait.h>
+#include <kernel/cpu/fpu.h> // For lazy FPU switching
+#include <kernel/cpu/workqueue.h> // For deferred reaping
+#include <kernel/gdt.h>     // For GDT_PERCPU_SELECTOR
 
-// The process table - now global
-task_struct_t process_table[MAX_PROCESSES];
+// The process table lock. It covers the task list, the PID hash and
+// bitmap, the task struct cache and the zombie list. Task state and the
+// ready queues belong to the scheduler.
+static spinlock_t proc_lock = SPINLOCK_INIT;
 
-// Pointer to the currently running process
-task_struct_t* current_task = NULL;
+// Every live task, oldest first. New tasks go at the tail.
+task_struct_t* task_list = NULL;
+static task_struct_t* task_list_tail = NULL;
+
+// Tasks by PID, chained through pid_next.
+static task_struct_t* pid_hash[PID_HASH_SIZE];
+
+// One bit per PID, set while it is in use.
+static uint32_t pid_bitmap[PID_MAX / 32];
+
+// The PID handed out last. The search for a free one starts after it, so a
+// PID is not reused right after its task went away.
+static int last_pid = 0;
+
+// Free task structs, linked through run_next.
+static task_struct_t* task_free_list = NULL;
+
+// Zombies waiting to be reaped, linked through run_next. They are never on a
+// ready queue, so the link is free.
+static task_struct_t* zombie_list = NULL;
+
+// Parents waiting for a child to exit. process_exit() wakes them all, and
+// each one checks whether it was one of its own children.
+static wait_queue_t exit_wait = WAIT_QUEUE_INIT;
+
+// Reaps the zombies that process_reap_later() marked.
+static work_t reap_work;
 
 // global flag, initialized to 0 (false)
 volatile int multitasking_enabled = 0;
@@ -23,12 +57,392 @@ volatile int multitasking_enabled = 0;
 extern void idle_task();
 extern void shell_task();
 
-// We need to access our TSS entry defined in tss.c
-extern struct tss_entry_struct tss_entry;
-
 // Let this file know about the kernel's page directory
 extern page_directory_t* kernel_directory;
 
+// Context switch helpers from switch.asm
+extern void switch_context(uint32_t* prev_esp, uint32_t next_esp);
+extern void task_start();
+
+// Task structs are carved out of whole frames. Freed ones are kept for the
+// next task, so creating a process never goes through the heap.
+// The helpers down to process_unlink() are called with proc_lock held.
+static task_struct_t* task_cache_alloc() {
+    if (!task_free_list) {
+        void* frame = pmm_alloc_frame();
+        if (!frame) {
+            return NULL;
+        }
+        task_struct_t* tasks = (task_struct_t*)PHYS_TO_VIRT(frame);
+        for (uint32_t i = 0; i < PMM_FRAME_SIZE / sizeof(task_struct_t); i++) {
+            tasks[i].run_next = task_free_list;
+            task_free_list = &tasks[i];
+        }
+    }
+
+    task_struct_t* task = task_free_list;
+    task_free_list = task->run_next;
+    memset(task, 0, sizeof(task_struct_t));
+    return task;
+}
+
+// Gives a task struct back to the cache.
+static void task_cache_free(task_struct_t* task) {
+    task->state = TASK_STATE_UNUSED;
+    task->run_next = task_free_list;
+    task_free_list = task;
+}
+
+// Finds a free PID, marks it used and returns it, or -1 if all are taken.
+static int pid_alloc() {
+    int pid = last_pid;
+    for (int n = 0; n < PID_MAX; n++) {
+        pid = (pid + 1) % PID_MAX;
+        // Skip whole words that are full.
+        if ((pid & 31) == 0 && pid_bitmap[pid / 32] == 0xFFFFFFFF) {
+            pid += 31;
+            n += 31;
+            continue;
+        }
+        if (!(pid_bitmap[pid / 32] & (1u << (pid & 31)))) {
+            pid_bitmap[pid / 32] |= 1u << (pid & 31);
+            last_pid = pid;
+            return pid;
+        }
+    }
+    return -1;
+}
+
+// Marks a PID as free again.
+static void pid_free(int pid) {
+    pid_bitmap[pid / 32] &= ~(1u << (pid & 31));
+}
+
+// Makes a task visible to process_find() and to walks over task_list.
+static void process_link(task_struct_t* task) {
+    task_struct_t** bucket = &pid_hash[task->pid & (PID_HASH_SIZE - 1)];
+    task->pid_next = *bucket;
+    *bucket = task;
+
+    task->task_next = NULL;
+    task->task_prev = task_list_tail;
+    if (task_list_tail) {
+        task_list_tail->task_next = task;
+    } else {
+        task_list = task;
+    }
+    task_list_tail = task;
+}
+
+// Undoes process_link().
+static void process_unlink(task_struct_t* task) {
+    task_struct_t** link = &pid_hash[task->pid & (PID_HASH_SIZE - 1)];
+    while (*link != task) {
+        link = &(*link)->pid_next;
+    }
+    *link = task->pid_next;
+
+    if (task->task_prev) {
+        task->task_prev->task_next = task->task_next;
+    } else {
+        task_list = task->task_next;
+    }
+    if (task->task_next) {
+        task->task_next->task_prev = task->task_prev;
+    } else {
+        task_list_tail = task->task_prev;
+    }
+}
+
+// Takes a task struct and a PID for a new task. A 'pid' of -1 means the
+// next free one. Returns NULL if either has run out.
+static task_struct_t* task_alloc(int pid) {
+    uint32_t flags = spin_lock_irqsave(&proc_lock);
+    task_struct_t* task = task_cache_alloc();
+    if (task && pid < 0) {
+        pid = pid_alloc();
+        if (pid < 0) {
+            task_cache_free(task);
+            task = NULL;
+        }
+    }
+    if (task) {
+        task->pid = pid;
+    }
+    spin_unlock_irqrestore(&proc_lock, flags);
+    return task;
+}
+
+// Undoes task_alloc() for a task that was never linked.
+static void task_free(task_struct_t* task) {
+    uint32_t flags = spin_lock_irqsave(&proc_lock);
+    pid_free(task->pid);
+    task_cache_free(task);
+    spin_unlock_irqrestore(&proc_lock, flags);
+}
+
+// Makes a finished task visible; process_link() under the lock.
+static void task_publish(task_struct_t* task) {
+    uint32_t flags = spin_lock_irqsave(&proc_lock);
+    process_link(task);
+    spin_unlock_irqrestore(&proc_lock, flags);
+}
+
+// Builds the first kernel stack of a task: an interrupt frame that enters the
+// task at 'eip' (in user mode if 'user_esp' is not 0), under what
+// switch_context() pops, with task_start as the return address.
+static void task_init_stack(task_struct_t* task, uint32_t eip, uint32_t user_esp) {
+    uint32_t* sp = (uint32_t*)((uint32_t)task->kernel_stack + KERNEL_STACK_SIZE);
+    uint32_t data_segment = user_esp ? 0x23 : 0x10;
+    uint32_t gs = user_esp ? 0x23 : GDT_PERCPU_SELECTOR; // The kernel finds its cpu_t through GS
+
+    // The IRET frame. Only a switch to ring 3 pops SS and ESP.
+    if (user_esp) {
+        *--sp = 0x23;     // SS: User Data Segment
+        *--sp = user_esp; // ESP
+    }
+    *--sp = 0x202;                     // EFLAGS: Interrupts enabled
+    *--sp = user_esp ? 0x1B : 0x08;    // CS: User or Kernel Code Segment
+    *--sp = eip;
+
+    *--sp = 0; // Error code
+    *--sp = 0; // Interrupt number
+    for (int i = 0; i < 8; i++) {
+        *--sp = 0; // The 'pusha' registers, every task starts with them cleared
+    }
+    for (int i = 0; i < 3; i++) {
+        *--sp = data_segment; // DS, ES, FS
+    }
+    *--sp = gs;
+
+    *--sp = (uint32_t)task_start;
+    for (int i = 0; i < 4; i++) {
+        *--sp = 0; // EBP, EBX, ESI, EDI for switch_context()
+    }
+    task->kernel_esp = (uint32_t)sp;
+}
+
+// Looks a task up by PID.
+task_struct_t* process_find(int pid) {
+    if (pid < 0 || pid >= PID_MAX) {
+        return NULL;
+    }
+    uint32_t flags = spin_lock_irqsave(&proc_lock);
+    task_struct_t* task = pid_hash[pid & (PID_HASH_SIZE - 1)];
+    while (task && task->pid != pid) {
+        task = task->pid_next;
+    }
+    spin_unlock_irqrestore(&proc_lock, flags);
+    return task;
+}
+
+bool process_dir_running_elsewhere(page_directory_t* dir) {
+    bool running = false;
+    uint32_t flags = spin_lock_irqsave(&proc_lock);
+    for (task_struct_t* task = task_list; task && !running; task = task->task_next) {
+        running = task->page_directory == dir && task->on_cpu && task != current_task;
+    }
+    spin_unlock_irqrestore(&proc_lock, flags);
+    return running;
+}
+
+// Marks a task as a zombie and remembers it for reaping. Its parent
+// collects it with process_waitpid(); one without a parent (a kernel
+// thread, or an orphan) is freed by the reaper right away.
+void process_exit(task_struct_t* task, int status) {
+    task->state = TASK_STATE_ZOMBIE;
+    task->exit_status = status;
+    fpu_release(task); // Its FPU registers will never be needed again.
+    timer_cancel(&task->alarm_timer);
+    timer_cancel(&task->sleep_timer);
+    timer_cancel(&task->rt_timer);
+
+    bool reap = false;
+    uint32_t flags = spin_lock_irqsave(&proc_lock);
+    task->run_next = zombie_list;
+    zombie_list = task;
+    if (task->ppid == 0) {
+        task->reap_requested = true;
+        reap = true;
+    }
+
+    // Nobody is going to wait for our children any more. Those that have
+    // exited already go to the reaper, the others when they exit.
+    for (task_struct_t* child = task_list; child; child = child->task_next) {
+        if (child->ppid != task->pid || child == task) {
+            continue;
+        }
+        child->ppid = 0;
+        if (child->state == TASK_STATE_ZOMBIE && !child->reap_requested) {
+            child->reap_requested = true;
+            reap = true;
+        }
+    }
+
+    // The program is over once its main thread is. Threads left behind
+    // would keep its address space alive with nobody to wait for them, so
+    // they go too. SIGKILL also gets them out of futex_wait() and other
+    // waits that give up for a signal.
+    if (!task->is_thread && task->page_directory != kernel_directory) {
+        for (task_struct_t* thread = task_list; thread; thread = thread->task_next) {
+            if (thread->is_thread && thread->page_directory == task->page_directory) {
+                signal_send(thread, SIGKILL);
+            }
+        }
+    }
+    spin_unlock_irqrestore(&proc_lock, flags);
+
+    // The reaper only gets to us once we have switched away for good. Until
+    // system_wq exists, such zombies wait for 'kill'.
+    if (reap && system_wq) {
+        queue_work(system_wq, &reap_work);
+    }
+    wake_up(&exit_wait);
+
+    // A user parent may want to hear about it without blocking in waitpid.
+    // Kernel parents cannot take signals, signal_send() ignores them.
+    if (task->ppid && !task->is_thread) {
+        signal_send(process_find(task->ppid), SIGCHLD);
+    }
+}
+
+// Looks for children of 'parent' that 'pid' matches (-1 for any). Returns
+// an exited one, taken off the zombie list so that nobody else reaps it, or
+// NULL. Sets *has_child if there is any matching child at all.
+static task_struct_t* process_claim_zombie(int parent, int pid, bool* has_child) {
+    task_struct_t* zombie = NULL;
+    *has_child = false;
+
+    uint32_t flags = spin_lock_irqsave(&proc_lock);
+    for (task_struct_t* task = task_list; task && !zombie; task = task->task_next) {
+        if (task->ppid != parent || (pid != -1 && task->pid != pid)) {
+            continue;
+        }
+        *has_child = true;
+        if (task->state == TASK_STATE_ZOMBIE && !task->reap_requested) {
+            zombie = task;
+        }
+    }
+    if (zombie) {
+        zombie->reap_requested = true;
+        task_struct_t** link = &zombie_list;
+        while (*link != zombie) {
+            link = &(*link)->run_next;
+        }
+        *link = zombie->run_next;
+    }
+    spin_unlock_irqrestore(&proc_lock, flags);
+    return zombie;
+}
+
+// Adds one task's CPU usage to another's.
+static void usage_add(task_usage_t* to, const task_usage_t* from) {
+    to->utime += from->utime;
+    to->stime += from->stime;
+    to->user_cycles += from->user_cycles;
+    to->system_cycles += from->system_cycles;
+    to->nvcsw += from->nvcsw;
+    to->nivcsw += from->nivcsw;
+}
+
+int process_waitpid(int pid, int* status) {
+    int parent = current_task->pid;
+    task_struct_t* zombie;
+    bool has_child;
+    wait_event_interruptible(&exit_wait, (zombie = process_claim_zombie(parent, pid, &has_child)) || !has_child);
+    if (!zombie) {
+        return -1; // No such child, or a signal came first
+    }
+
+    int child_pid = zombie->pid;
+    if (status) {
+        *status = zombie->exit_status;
+    }
+    usage_add(&current_task->child_usage, &zombie->usage);
+    usage_add(&current_task->child_usage, &zombie->child_usage);
+    process_reap(zombie);
+    return child_pid;
+}
+
+// Drops a task's hold on its address space. The PMM count of the directory
+// frame is the number of tasks in it (see thread_create()). Returns true if
+// this was the last one, and the whole directory is to be freed.
+static bool address_space_put(task_struct_t* task) {
+    page_directory_t* dir = task->page_directory;
+
+    // The other threads still run in there, so give back our stack now.
+    // Unless one of them runs on another CPU: switching between threads of
+    // a program does not flush the TLB, so that CPU may still reach our
+    // stack's frames. Then the stack stays mapped for thread_stack_alloc()
+    // to hand on, and is freed with the directory at the latest.
+    if (task->is_thread && !process_dir_running_elsewhere(dir)) {
+        uint32_t top = (uint32_t)task->user_stack;
+        paging_unmap_range(dir, top - USER_STACK_SIZE, top);
+    }
+
+    uint32_t flags = spin_lock_irqsave(&proc_lock);
+    bool last = pmm_get_frame_refs(dir) == 1;
+    if (!last) {
+        pmm_free_frame(dir); // Drops only our reference.
+    }
+    spin_unlock_irqrestore(&proc_lock, flags);
+    return last;
+}
+
+// Frees a zombie's address space, kernel stack, PID and task struct.
+void process_reap(task_struct_t* task) {
+    uint32_t flags = spin_lock_irqsave(&proc_lock);
+    task_struct_t** link = &zombie_list;
+    while (*link && *link != task) {
+        link = &(*link)->run_next;
+    }
+    if (*link) {
+        *link = task->run_next;
+    }
+    process_unlink(task);
+    spin_unlock_irqrestore(&proc_lock, flags);
+
+    // Nobody can find it any more, so the slow part runs without the lock.
+    // Kernel threads run in the kernel's own address space, which stays.
+    if (task->page_directory != kernel_directory && address_space_put(task)) {
+        paging_free_directory(task->page_directory);
+    }
+    pmm_free_frame((void*)VIRT_TO_PHYS(task->kernel_stack));
+    task_free(task);
+}
+
+// Work item: frees every zombie that was marked for reaping.
+static void reap_marked_zombies(void* data) {
+    (void)data;
+    while (1) {
+        uint32_t flags = spin_lock_irqsave(&proc_lock);
+        task_struct_t* task = zombie_list;
+        while (task && !task->reap_requested) {
+            task = task->run_next;
+        }
+        spin_unlock_irqrestore(&proc_lock, flags);
+        if (!task) {
+            break;
+        }
+        process_reap(task);
+    }
+
+    // We log the frame count AFTER freeing to confirm it was restored.
+    qemu_debug_string("PROCESS: Reaped zombies. Free frames: ");
+    qemu_debug_dec(pmm_get_free_frame_count());
+    qemu_debug_string("\n");
+}
+
+// Marks a zombie and lets the system work queue free it.
+void process_reap_later(task_struct_t* task) {
+    task->reap_requested = true;
+    if (!system_wq) {
+        process_reap(task);
+        return;
+    }
+    queue_work(system_wq, &reap_work);
+}
+
 // This is the function that performs the context switch to user mode.
 // It sets up the stack for the IRET instruction and jumps.
 void switch_to_user_mode(void* entry_point, void* stack_ptr) {
@@ -111,13 +525,10 @@ int exec_program(int argc, char* argv[]) {
     qemu_debug_dec(pmm_get_free_frame_count());
     qemu_debug_string("\n");
 
-    // --- START CRITICAL SECTION ---
-    // This is the definitive fix. We disable interrupts because the entire process
-    // of loading a file, allocating memory, and setting up new page tables is
-    // not "re-entrant". If a timer interrupt fires in the middle of this,
-    // the scheduler will corrupt the state of our shell task, leading to a
-    // triple fault when the shell resumes.
-    __asm__ __volatile__("cli");
+    // Loading the file and building the address space run with interrupts
+    // enabled. The filesystem, heap, PMM and process table have their own
+    // locks; only the time spent in the new address space is kept from
+    // being preempted (see below).
 
     //qemu_debug_string("PROCESS: Entering exec_program.\n");
 
@@ -127,7 +538,6 @@ int exec_program(int argc, char* argv[]) {
     // error handling
     if (argc == 0) {
         print_string("run: Missing filename.\n");
-        __asm__ __volatile__("sti"); // Re-enable interrupts before returning
         return -1;
     }
 
@@ -146,7 +556,6 @@ int exec_program(int argc, char* argv[]) {
         //qemu_debug_string("PROCESS: file_entry is NULL.\n");
         print_string("run: File not found: ");
         print_string(filename);
-        __asm__ __volatile__("sti"); // Re-enable interrupts before returning
         return -1;
     }
     //qemu_debug_string("PROCESS: file_entry is VALID.\n");
@@ -159,13 +568,9 @@ int exec_program(int argc, char* argv[]) {
     // error handling
     if (!file_buffer) {
         print_string("run: Not enough memory to load program.\n");
-        __asm__ __volatile__("sti"); // Re-enable interrupts before returning
         return -1;
     }
 
-    // From here on, we are manipulating page tables and process state.
-    // It is critical that we are not interrupted.
-
     // Cast the beginning of the buffer to an ELF header
     Elf32_Ehdr* header = (Elf32_Ehdr*)file_buffer;
 
@@ -173,11 +578,21 @@ int exec_program(int argc, char* argv[]) {
     if (header->magic != ELF_MAGIC) {
         print_string("run: Not an ELF executable.\n");
         free(file_buffer);
-        __asm__ __volatile__("sti"); // Re-enable interrupts before returning
         return -1;
     }
     //qemu_debug_string("PROCESS: ELF loaded successfully.\n");
 
+    // Everything from KERNEL_VIRT_BASE up is shared kernel space, a program must not load there.
+    Elf32_Phdr* check_phdrs = (Elf32_Phdr*)(file_buffer + header->phoff);
+    for (int i = 0; i < header->phnum; i++) {
+        if (check_phdrs[i].type == PT_LOAD &&
+            (check_phdrs[i].vaddr >= KERNEL_VIRT_BASE || check_phdrs[i].memsz > KERNEL_VIRT_BASE - check_phdrs[i].vaddr)) {
+            print_string("run: Program overlaps kernel space.\n");
+            free(file_buffer);
+            return -1;
+        }
+    }
+
     // --- Address Space Creation ---
     // Create a new, separate address space for the process.
     //qemu_debug_string("PROCESS: Cloning kernel page directory...\n");
@@ -187,12 +602,15 @@ int exec_program(int argc, char* argv[]) {
     if (!new_dir) {
         print_string("run: Could not create address space.\n");
         free(file_buffer);
-        __asm__ __volatile__("sti"); // Re-enable interrupts before returning
         return -1;
     }
     //qemu_debug_string("PROCESS: Page directory cloned.\n");
 
     // --- TEMPORARILY SWITCH TO THE NEW ADDRESS SPACE ---
+    // A task switch would load our own directory again when we come back,
+    // so we must not be preempted until we switch back. Interrupts still
+    // come in; their handlers only use the shared kernel half.
+    preempt_disable();
     page_directory_t* old_dir;
     __asm__ __volatile__("mov %%cr3, %0" : "=r"(old_dir)); // Save old CR3
     paging_switch_directory(new_dir);                     // Load new CR3
@@ -223,13 +641,11 @@ int exec_program(int argc, char* argv[]) {
                 // error handling
                 if (!phys_frame) {
                     // Proper cleanup would be needed here in a production OS
-
-                    // part of temporary argv disabling
-                    //paging_switch_directory(old_dir);
+                    paging_switch_directory(old_dir);
+                    preempt_enable();
                     paging_free_directory(new_dir);
                     free(file_buffer);
                     print_string("run: Out of physical memory.\n");
-                    __asm__ __volatile__("sti"); // Re-enable interrupts before returning
                     return -1;
                 }
                 paging_map_page(new_dir, virt_addr, phys_frame, PAGING_FLAG_PRESENT | PAGING_FLAG_RW | PAGING_FLAG_USER);
@@ -263,12 +679,15 @@ int exec_program(int argc, char* argv[]) {
             // Proper cleanup would be needed here in a production OS.
             // For now, we'll just fail gracefully.
             paging_switch_directory(old_dir);
+            preempt_enable();
             paging_free_directory(new_dir);
             free(file_buffer);
-            __asm__ __volatile__("sti"); // Re-enable interrupts before returning
-            return -1; 
+            return -1;
         }
         paging_map_page(new_dir, virt_addr, phys_frame, PAGING_FLAG_PRESENT | PAGING_FLAG_RW | PAGING_FLAG_USER);
+
+        // Frames are recycled, so clear out whatever the previous owner left behind.
+        memset((void*)virt_addr, 0, PMM_FRAME_SIZE);
     }
 
     // --- Setup argc/argv on the new user stack ---
@@ -313,216 +732,323 @@ int exec_program(int argc, char* argv[]) {
     // --- SWITCH BACK TO THE ORIGINAL ADDRESS SPACE ---
     //qemu_debug_string("PROCESS: Page mapping complete. Switching back to original address space.\n");
     paging_switch_directory(old_dir);
+    preempt_enable();
 
-    // Find a free process slot in the process table
-    task_struct_t* new_task = NULL;
-
-    // find new task
-    int new_pid = -1;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].state == TASK_STATE_UNUSED) {
-            new_task = &process_table[i];
-            new_pid = i;
-            break;
-        }
-    }
+    // Get a task struct and a PID for the new process.
+    task_struct_t* new_task = task_alloc(-1);
 
     // error handling
     if (!new_task) {
         print_string("run: No free processes left.\n");
         paging_free_directory(new_dir); // Clean up the created directory
         free(file_buffer);
-        __asm__ __volatile__("sti"); // Re-enable interrupts before returning
         return -1; // Return -1 on failure
     }
 
+    // Each process needs its own kernel stack.
+    void* kernel_stack = pmm_alloc_frame();
+    if (!kernel_stack) {
+        print_string("run: Not enough memory for a kernel stack.\n");
+        task_free(new_task);
+        paging_free_directory(new_dir);
+        free(file_buffer);
+        return -1;
+    }
+
     // Configure the new process's PCB
-    new_task->pid = new_pid;
-    new_task->state = TASK_STATE_RUNNING;
+    new_task->ppid = current_task->pid; // Whoever ran it waits for it
+    new_task->priority = 0; // New programs start at the top until they show they are CPU-bound.
+    new_task->policy = SCHED_NORMAL; // Real-time has to be asked for with sched_setscheduler.
+    new_task->rt_throttled = false;
+    new_task->group = sched_get_group(0); // The shell may move it to a limited group.
     strncpy(new_task->name, filename, PROCESS_NAME_LEN); // Use our new strncpy
     new_task->user_stack = (void*)USER_STACK_TOP;
-    new_task->kernel_stack = pmm_alloc_frame(); // Each process needs its own kernel stack.
+    new_task->kernel_stack = PHYS_TO_VIRT(kernel_stack);
     new_task->page_directory = new_dir; // Set the new address space
 
-    // Set up the initial CPU state for the new process.
-    memset(&new_task->cpu_state, 0, sizeof(cpu_state_t));
-    new_task->cpu_state.eip = (uint32_t)header->entry;
-    new_task->cpu_state.esp = user_stack_ptr; // Use the final calculated stack pointer
-    new_task->cpu_state.cs = 0x1B;  // User Code Segment
-    new_task->cpu_state.ss = 0x23;  // User Data Segment
-    new_task->cpu_state.eflags = 0x202; // Interrupts enabled
-    new_task->cpu_state.cr3 = (uint32_t)new_task->page_directory; // Set physical address for CR3
+    // The first switch to the task drops into its entry point in user mode.
+    task_init_stack(new_task, (uint32_t)header->entry, user_stack_ptr);
 
     // The program is now in memory, so we can free the temporary file buffer
     //qemu_debug_string("PROCESS: New task configured. Ready for scheduler.\n");
     //qemu_debug_string("  PID: "); qemu_debug_hex(new_task->pid);
-    //qemu_debug_string("\n  EIP: "); qemu_debug_hex(new_task->cpu_state.eip);
-    //qemu_debug_string("\n  ESP: "); qemu_debug_hex(new_task->cpu_state.esp);
-    //qemu_debug_string("\n  CR3: "); qemu_debug_hex(new_task->cpu_state.cr3);
+    //qemu_debug_string("\n  EIP: "); qemu_debug_hex(header->entry);
+    //qemu_debug_string("\n  ESP: "); qemu_debug_hex(user_stack_ptr);
     //qemu_debug_string("\n");
     free(file_buffer);
 
-    // --- END CRITICAL SECTION ---
-    // Do NOT re-enable interrupts here.
-    // The caller (the shell) is now responsible for this.
+    // Make it visible by PID, then put it on the ready queue. Once it is
+    // queued it may run, and even exit, before we get to return.
+    int new_pid = new_task->pid;
+    task_publish(new_task);
+    uint32_t flags = irq_save();
+    sched_wake(new_task);
+    irq_restore(flags);
 
     return new_pid; // Return the new PID to the caller (the shell)
 }
 
-// Initializes the process table and creates the first kernel task.
-void process_init() {
-    // Clear the entire process table
-    memset(process_table, 0, sizeof(process_table));
+// Is a task in 'dir' using the thread stack below 'top'? Threads that
+// exited count until they are reaped.
+static bool thread_stack_in_use(page_directory_t* dir, uint32_t top) {
+    bool used = false;
+    uint32_t flags = spin_lock_irqsave(&proc_lock);
+    for (task_struct_t* task = task_list; task && !used; task = task->task_next) {
+        used = task->page_directory == dir && (uint32_t)task->user_stack == top;
+    }
+    spin_unlock_irqrestore(&proc_lock, flags);
+    return used;
+}
 
-    // --- Task 0: The Idle Task ---
-    // This task must always be present and runnable.
-    void* stack_a = malloc(4096);
-    process_table[0].pid = 0;
-    process_table[0].state = TASK_STATE_RUNNING;
-    strncpy(process_table[0].name, "idle", PROCESS_NAME_LEN);
+// Maps a free thread stack in the current address space and returns its
+// top, or 0 if every slot is taken or there is no memory. A slot is free
+// when the top page of its stack is not mapped (or swapped out), or when
+// a reaped thread left its stack mapped (see address_space_put()).
+static uint32_t thread_stack_alloc(page_directory_t* dir) {
+    for (int slot = 0; slot < THREAD_STACKS_MAX; slot++) {
+        uint32_t top = THREAD_STACK_TOP(slot);
+        pte_t* pte = paging_get_page(dir, top - PMM_FRAME_SIZE, false, 0);
+        if (pte && *pte) {
+            if (!thread_stack_in_use(dir, top)) {
+                return top; // Taken over as it is
+            }
+            continue;
+        }
 
-    process_table[0].page_directory = kernel_directory; // All kernel tasks use the kernel's map
+        for (uint32_t i = 0; i < USER_STACK_PAGES; i++) {
+            uint32_t virt_addr = top - (i + 1) * PMM_FRAME_SIZE;
+            uint32_t phys_frame = (uint32_t)pmm_alloc_frame();
+            if (!phys_frame) {
+                paging_unmap_range(dir, virt_addr + PMM_FRAME_SIZE, top);
+                return 0;
+            }
+            paging_map_page(dir, virt_addr, phys_frame, PAGING_FLAG_PRESENT | PAGING_FLAG_RW | PAGING_FLAG_USER);
+            memset((void*)virt_addr, 0, PMM_FRAME_SIZE);
+        }
+        return top;
+    }
+    return 0;
+}
 
-    // sure that every task starts with a clean slate
-    memset(&process_table[0].cpu_state, 0, sizeof(cpu_state_t));
-    
-    // Set up initial CPU state for IRET
-    process_table[0].cpu_state.eip = (uint32_t)idle_task;
-    process_table[0].cpu_state.cs = 0x08; // Kernel Code Segment
-    process_table[0].cpu_state.ss = 0x10; // Kernel Data Segment
-    process_table[0].cpu_state.eflags = 0x202; // Interrupts enabled
-    // Set BOTH stack pointers for this kernel task
-    process_table[0].cpu_state.esp = (uint32_t)stack_a + 4096;
+int thread_create(uint32_t entry, uint32_t arg1, uint32_t arg2) {
+    task_struct_t* parent = current_task;
+    page_directory_t* dir = parent->page_directory;
 
-    process_table[0].cpu_state.cr3 = (uint32_t)kernel_directory; // Set the physical address for CR3
+    // Every task in the address space holds a reference on its directory.
+    if (!pmm_ref_frame(dir)) {
+        return -1;
+    }
 
-    // --- Task 1: The Shell Task ---
-    void* stack_b = malloc(4096);
-    process_table[1].pid = 1;
-    process_table[1].state = TASK_STATE_RUNNING;
-    strncpy(process_table[1].name, "shell", PROCESS_NAME_LEN);
+    // The other threads of the program may be creating threads too. The
+    // kernel lock keeps other CPUs out, and this keeps them off our CPU
+    // until the slot we found is mapped.
+    preempt_disable();
+    uint32_t stack_top = thread_stack_alloc(dir);
+    preempt_enable();
+
+    void* kernel_stack = stack_top ? pmm_alloc_frame() : NULL;
+    task_struct_t* task = kernel_stack ? task_alloc(-1) : NULL;
+    if (!task) {
+        if (kernel_stack) {
+            pmm_free_frame(kernel_stack);
+        }
+        if (stack_top) {
+            paging_unmap_range(dir, stack_top - USER_STACK_SIZE, stack_top);
+        }
+        pmm_free_frame(dir);
+        return -1;
+    }
 
-    process_table[1].page_directory = kernel_directory; // All kernel tasks use the kernel's map
+    task->ppid = parent->pid; // The creator joins it
+    task->is_thread = true;
+    task->priority = 0;
+    task->policy = SCHED_NORMAL;
+    task->group = parent->group;
+    strncpy(task->name, parent->name, PROCESS_NAME_LEN);
+    memcpy(task->sig_handlers, parent->sig_handlers, sizeof(task->sig_handlers)); // Same code, same handlers
+    task->sig_restorer = parent->sig_restorer;
+    task->sig_blocked = parent->sig_blocked;
+    task->user_stack = (void*)stack_top;
+    task->kernel_stack = PHYS_TO_VIRT(kernel_stack);
+    task->page_directory = dir;
+
+    // entry(arg1, arg2) as if it had been called, with a return address of
+    // 0. The 8 bytes on top keep the arguments 16-byte aligned.
+    uint32_t* sp = (uint32_t*)(stack_top - 8);
+    *--sp = arg2;
+    *--sp = arg1;
+    *--sp = 0;
+    task_init_stack(task, entry, (uint32_t)sp);
+
+    int tid = task->pid;
+    task_publish(task);
+    uint32_t flags = irq_save();
+    sched_wake(task);
+    irq_restore(flags);
+    return tid;
+}
 
-    // sure that every task starts with a clean slate
-    memset(&process_table[1].cpu_state, 0, sizeof(cpu_state_t));
-    
-    // Set up initial CPU state for IRET
-    process_table[1].cpu_state.eip = (uint32_t)shell_task;
-    process_table[1].cpu_state.cs = 0x08;
-    process_table[1].cpu_state.ss = 0x10;
-    process_table[1].cpu_state.eflags = 0x202;
-    
-    // Set BOTH stack pointers for this kernel task
-    process_table[1].cpu_state.esp = (uint32_t)stack_b + 4096;
+// Creates a kernel task that runs 'entry' on its own kernel stack, with the
+// given PID (-1 for the next free one). Returns NULL if there is no memory
+// or PID for it.
+static task_struct_t* kernel_task_create(int pid, const char* name, void (*entry)()) {
+    void* stack = pmm_alloc_frame();
+    if (!stack) {
+        return NULL;
+    }
+    task_struct_t* task = task_alloc(pid);
+    if (!task) {
+        pmm_free_frame(stack);
+        return NULL;
+    }
 
-    process_table[1].cpu_state.cr3 = (uint32_t)kernel_directory; // Set the physical address for CR3
+    strncpy(task->name, name, PROCESS_NAME_LEN);
+    task->page_directory = kernel_directory; // All kernel tasks use the kernel's map
+    task->group = sched_get_group(0);
 
-    // Set the first task as the currently running one
-    current_task = &process_table[0];
-}
-
-// This is our new, more intelligent round-robin scheduler.
-cpu_state_t* schedule(registers_t *r) {
-    // qemu_debug_string("schedule: entered.\n");
-
-    // This check is a safeguard against catastrophic failure.
-    if (!current_task) {
-        // qemu_debug_string("schedule: FATAL - current_task is NULL. Halting.\n");
-        for (;;) __asm__("cli; hlt");
-    }
-
-    // Only save the CPU state if the task is not a zombie.
-    if (current_task->state != TASK_STATE_ZOMBIE) {
-        // qemu_debug_string("schedule: Saving state for PID ");
-        // qemu_debug_hex(current_task->pid);
-        // qemu_debug_string("...\n");
-
-        // Save the CPU state of the current task
-        // We only copy the registers that are part of cpu_state_t
-        current_task->cpu_state.eax = r->eax;
-        current_task->cpu_state.ecx = r->ecx;
-        current_task->cpu_state.edx = r->edx;
-        current_task->cpu_state.ebx = r->ebx;
-        current_task->cpu_state.ebp = r->ebp;
-        current_task->cpu_state.esi = r->esi;
-        current_task->cpu_state.edi = r->edi;
-        current_task->cpu_state.eip = r->eip;
-        current_task->cpu_state.cs = r->cs;
-        current_task->cpu_state.eflags = r->eflags;
-        current_task->cpu_state.cr3 = (uint32_t)current_task->page_directory; // Save the physical address of the page directory
-
-        // Check if the interrupt came from user mode (ring 3).
-        // The user code segment selector is 0x1B (index 3, RPL 3).
-        if (r->cs == 0x1B) { // The kernel code segment selector is 0x08.
-            // This was a user task. The CPU pushed useresp and ss.
-            current_task->cpu_state.esp = r->useresp;
-            current_task->cpu_state.ss = r->ss;
-        } else {
-            // This was a kernel task. The CPU did not change stacks.
-            // The task's stack pointer is the one saved by PUSHA, which is in r->esp.
-            current_task->cpu_state.esp = r->esp;
-            current_task->cpu_state.ss = 0x10; // Kernel Data Segment
-        }
-    } else { // is a zombie, don't save sate
-        // qemu_debug_string("schedule: Current task is a zombie, not saving state.\n");
+    // A kernel task runs on its kernel stack all the time, interrupts included.
+    task->kernel_stack = PHYS_TO_VIRT(stack);
+    task_init_stack(task, (uint32_t)entry, 0);
+
+    task_publish(task);
+    return task;
+}
+
+// Every kernel thread starts here, then runs its function until it returns.
+static void kthread_main() {
+    current_task->kthread_fn(current_task->kthread_arg);
+
+    // Done: become a zombie until someone reaps it, and never come back.
+    // The flags are never restored, the yield does not return.
+    irq_save();
+    process_exit(current_task, 0);
+    __asm__ __volatile__("int $0x20");
+}
+
+// Starts a kernel thread. It is scheduled like any other normal task.
+task_struct_t* kthread_create(const char* name, void (*fn)(void* arg), void* arg) {
+    task_struct_t* task = kernel_task_create(-1, name, kthread_main);
+    if (!task) {
+        return NULL;
     }
 
-    // not a zombie, save state
-    // qemu_debug_string("schedule: State saved. Finding next task...\n");
+    // It is not queued yet, so nothing runs it before it knows what to do.
+    task->kthread_fn = fn;
+    task->kthread_arg = arg;
+    uint32_t flags = irq_save();
+    sched_wake(task);
+    irq_restore(flags);
+    return task;
+}
 
+// Sets up the task lists and creates the first kernel tasks.
+void process_init() {
+    memset(pid_hash, 0, sizeof(pid_hash));
+    memset(pid_bitmap, 0, sizeof(pid_bitmap));
+    work_init(&reap_work, reap_marked_zombies, NULL);
 
-    // The wake-up logic has been moved to timer_handler, where it belongs.
-    // We no longer check for sleeping tasks here.
+    // --- Task 0: The Idle Task ---
+    // This task must always be present and runnable.
+    task_struct_t* idle = kernel_task_create(0, "idle", idle_task);
 
-    /*
-    // Wake up sleeping tasks 
-    uint32_t now = timer_get_ticks();
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].state == TASK_STATE_SLEEPING && now >= process_table[i].wakeup_time) {
-            process_table[i].state = TASK_STATE_RUNNING;
-            // qemu_debug_string("schedule: Woke up PID ");
-            // qemu_debug_hex(i);
-            // qemu_debug_string(".\n");
-        }
-    }*/
-
-    // Find the next runnable task
-    int next_pid = current_task->pid;
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        next_pid = (next_pid + 1) % MAX_PROCESSES;
-        // We add "next_pid != 0" to temporarily skip the idle task
-        // unless it's the only option left.
-        if (process_table[next_pid].state == TASK_STATE_RUNNING) { // Simpler logic, idle task is just another task
-            // Found a runnable task, switch to it.
-            current_task = &process_table[next_pid];
-            // qemu_debug_string("schedule: Switching to PID ");
-            // qemu_debug_hex(current_task->pid);
-            // qemu_debug_string(".\n");
-            // qemu_debug_string("schedule: switched to new task\n");
-
-            // CRITICAL: Update the TSS to point to this new task's kernel stack.
-            uint32_t kernel_stack_top = (uint32_t)current_task->kernel_stack + PMM_FRAME_SIZE;
-            tss_entry.esp0 = kernel_stack_top;
-
-            // qemu_debug_string("schedule: before return to new task\n");
-            return &current_task->cpu_state;
+    // --- Task 1: The Shell Task ---
+    task_struct_t* shell = kernel_task_create(1, "shell", shell_task);
+
+    // Without them there is nothing to run, so there is no point going on.
+    if (!idle || !shell) {
+        print_string("PROCESS: No memory for the first tasks. System Halted.\n");
+        for (;;) {
+            __asm__ __volatile__("cli\n\thlt");
         }
     }
+    idle->state = TASK_STATE_RUNNING;
+
+    // Their PIDs are fixed, the next one comes from the allocator.
+    pid_bitmap[0] |= 0x3;
+    last_pid = 1;
+
+    // Set the first task as the currently running one
+    current_task = idle;
+    idle->on_cpu = true;
+
+    // The idle task only runs when no other task is ready. The shell is the first one.
+    sched_init(idle);
+    sched_wake(shell);
+}
+
+// Creates the idle task of an application processor. It starts out as the
+// CPU's current task, so it is never queued.
+task_struct_t* process_create_idle(int cpu) {
+    char name[PROCESS_NAME_LEN] = "idle";
+    name[4] = '0' + cpu;
+    task_struct_t* idle = kernel_task_create(-1, name, idle_task);
+    if (!idle) {
+        return NULL;
+    }
+    idle->state = TASK_STATE_RUNNING;
+    idle->cpu = cpu;
+    idle->on_cpu = true;
+    return idle;
+}
+
+// Loads next's address space and kernel stack, and continues it.
+void switch_to(task_struct_t* prev, task_struct_t* next) {
+    // Interrupts from user mode land on the top of the task's kernel stack.
+    this_cpu()->tss.esp0 = (uint32_t)next->kernel_stack + KERNEL_STACK_SIZE;
+
+    // The FPU state is only moved if 'next' actually uses the FPU.
+    fpu_switch(next);
+
+    // Kernel tasks share one directory, skip the TLB flush between them.
+    if (next->page_directory != prev->page_directory) {
+        paging_switch_directory(next->page_directory);
+    }
 
-    // Idle Case
-    // If no runnable task is found (should only happen if all are waiting/sleeping),
-    // If no other task was found, default to the idle task.
-    current_task = &process_table[0];
-    // qemu_debug_string("schedule: No other task to switch to. Continuing with PID ");
-    // qemu_debug_hex(current_task->pid);
-    // qemu_debug_string(".\n");
+    // Returns once some other task switches back to 'prev'.
+    switch_context(&prev->kernel_esp, next->kernel_esp);
+}
 
-    // CRITICAL: Update the TSS for the idle task as well.
-    uint32_t kernel_stack_top = (uint32_t)current_task->kernel_stack + PMM_FRAME_SIZE;
-    tss_entry.esp0 = kernel_stack_top;
+// Picks the next task from the ready queues (see sched.c) and switches to it.
+// A task that blocked, yielded or was preempted comes back out of here.
+void schedule() {
+    task_struct_t* prev = current_task;
+
+    // A task holding a spinlock is not preempted, or other CPUs would spin
+    // until it runs again. preempt_enable() comes back here. One that blocks
+    // has to go anyway.
+    cpu_t* cpu = this_cpu();
+    if (cpu->preempt_count && prev->state == TASK_STATE_RUNNING) {
+        cpu->preempt_pending = true;
+        return;
+    }
+    cpu->preempt_pending = false;
 
-    // Return a pointer to the NEW task's saved state
-    // The assembly code will use this to load the new context.
-    return &current_task->cpu_state;
-}
\ No newline at end of file
+    // Pick the next task from the priority queues. This may be the current
+    // task again if it still has time left on its slice.
+    task_struct_t* next = sched_next(prev);
+    if (next == prev) {
+        return;
+    }
+
+    // The kernel lock stays with this CPU across the switch, and next takes
+    // over its own nesting depth. Once prev runs again (maybe on another
+    // CPU) it gets its depth back.
+    sched_account_switch(prev, next);
+    prev->lock_depth = cpu->lock_depth;
+    prev->on_cpu = false;
+    next->on_cpu = true;
+    next->cpu = cpu->id;
+    cpu->current = next;
+    switch_to(prev, next);
+    this_cpu()->lock_depth = prev->lock_depth;
+}
+
+// The first thing a new task runs, called from task_start. A kernel task
+// holds the kernel lock like any kernel code; a user task drops it before
+// it enters ring 3.
+void schedule_tail() {
+    this_cpu()->lock_depth = 1;
+    if (current_task->page_directory != kernel_directory) {
+        unlock_kernel();
+    }
+}
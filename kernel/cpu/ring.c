@@ -0,0 +1,170 @@
+// myos/kernel/cpu/ring.c
+
+#include <kernel/cpu/ring.h>
+#include <kernel/cpu/process.h>
+#include <kernel/cpu/signal.h>  // For signal_pending
+#include <kernel/paging.h>      // For paging_user_access
+#include <kernel/timer.h>       // For sleep and play_sound
+#include <kernel/vga.h>
+#include <kernel/fs.h>
+#include <kernel/memory.h>      // For free
+#include <kernel/string.h>      // For memcpy
+
+// Makes sure a NUL-terminated user string can be read up to its end.
+static bool ring_user_string(uint32_t addr) {
+    while (1) {
+        uint32_t page_end = (addr & ~0xFFF) + PMM_FRAME_SIZE;
+        if (!paging_user_access(addr, page_end - addr, false)) {
+            return false;
+        }
+        for (; addr < page_end; addr++) {
+            if (*(const char*)addr == '\0') {
+                return true;
+            }
+        }
+    }
+}
+
+// Copies up to 'len' bytes of a file, from 'offset' on, into a user buffer.
+// Returns how many were copied.
+static int ring_read(uint32_t name, uint32_t buf, uint32_t len, uint32_t offset) {
+    if (!ring_user_string(name) || !paging_user_access(buf, len, true)) {
+        return RING_ERROR;
+    }
+    fat_dir_entry_t* entry = fs_find_file((const char*)name);
+    if (!entry) {
+        return RING_ERROR;
+    }
+    uint32_t size = entry->file_size;
+    if (offset >= size) {
+        return 0;
+    }
+    if (len > size - offset) {
+        len = size - offset;
+    }
+
+    // The filesystem only loads whole files.
+    uint8_t* data = (uint8_t*)fs_read_file(entry);
+    if (!data) {
+        return RING_ERROR;
+    }
+    // Loading may have slept long enough for the buffer to be swapped out.
+    int result = RING_ERROR;
+    if (paging_user_access(buf, len, true)) {
+        memcpy((void*)buf, data + offset, len);
+        result = (int)len;
+    }
+    free(data);
+    return result;
+}
+
+// Runs one submission and returns its result.
+static int ring_run(const ring_sqe_t* sqe) {
+    switch (sqe->op) {
+        case RING_OP_NOP:
+            return 0;
+        case RING_OP_PRINT:
+            if (!ring_user_string(sqe->args[0])) {
+                return RING_ERROR;
+            }
+            print_string((const char*)sqe->args[0]);
+            print_char('\n');
+            return 0;
+        case RING_OP_READ:
+            return ring_read(sqe->args[0], sqe->args[1], sqe->args[2], sqe->args[3]);
+        case RING_OP_WRITE:
+            if (!paging_user_access(sqe->args[0], sqe->args[1], false)) {
+                return RING_ERROR;
+            }
+            for (uint32_t i = 0; i < sqe->args[1]; i++) {
+                print_char(((const char*)sqe->args[0])[i]);
+            }
+            return (int)sqe->args[1];
+        case RING_OP_SLEEP:
+            sleep(sqe->args[0]);
+            return 0;
+        case RING_OP_PLAY_SOUND:
+            play_sound(sqe->args[0]);
+            return 0;
+        default:
+            return RING_ERROR;
+    }
+}
+
+int ring_setup(uint32_t uaddr, uint32_t entries) {
+    task_struct_t* task = current_task;
+    if (uaddr == 0) {
+        task->ring_addr = 0; // Unregisters the ring
+        return 0;
+    }
+    if (entries == 0 || entries > RING_MAX_ENTRIES || (entries & (entries - 1)) ||
+        (uaddr & 3) || !paging_user_access(uaddr, RING_SIZE(entries), true)) {
+        return RING_ERROR;
+    }
+
+    ring_header_t* ring = (ring_header_t*)uaddr;
+    ring->sq_head = 0;
+    ring->sq_tail = 0;
+    ring->cq_head = 0;
+    ring->cq_tail = 0;
+    ring->entries = entries;
+
+    task->ring_addr = uaddr;
+    task->ring_entries = entries;
+    task->ring_sq_head = 0;
+    task->ring_cq_tail = 0;
+    return 0;
+}
+
+int ring_enter(uint32_t to_submit) {
+    task_struct_t* task = current_task;
+    uint32_t entries = task->ring_entries;
+    uint32_t mask = entries - 1;
+    if (!task->ring_addr) {
+        return RING_ERROR;
+    }
+    ring_header_t* ring = (ring_header_t*)task->ring_addr;
+    ring_sqe_t* sq = (ring_sqe_t*)(ring + 1);
+    ring_cqe_t* cq = (ring_cqe_t*)(sq + entries);
+
+    int done = 0;
+    while (to_submit == 0 || (uint32_t)done < to_submit) {
+        // Checked again every time, since an operation may sleep and the
+        // ring's pages be swapped out meanwhile.
+        if (!paging_user_access(task->ring_addr, RING_SIZE(entries), true)) {
+            return done ? done : RING_ERROR;
+        }
+
+        // Nothing queued, or counters the program broke. Either way, stop.
+        uint32_t queued = ring->sq_tail - task->ring_sq_head;
+        if (queued == 0 || queued > entries) {
+            break;
+        }
+        // Every submission gets a completion, so none is taken without room for it.
+        if (task->ring_cq_tail - ring->cq_head >= entries) {
+            break;
+        }
+
+        // Taken as a copy: once sq_head moves on, the program may reuse the slot.
+        ring_sqe_t sqe = sq[task->ring_sq_head & mask];
+        ring->sq_head = ++task->ring_sq_head;
+
+        int result = ring_run(&sqe);
+        if (!paging_user_access(task->ring_addr, RING_SIZE(entries), true)) {
+            return done ? done : RING_ERROR;
+        }
+        ring_cqe_t* cqe = &cq[task->ring_cq_tail & mask];
+        cqe->user_data = sqe.user_data;
+        cqe->result = result;
+
+        // The completion must be filled in before the program can see it.
+        __asm__ __volatile__("" : : : "memory");
+        ring->cq_tail = ++task->ring_cq_tail;
+        done++;
+
+        if (signal_pending(task)) {
+            break;
+        }
+    }
+    return done;
+}
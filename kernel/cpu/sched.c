@@ -0,0 +1,804 @@
+// myos/kernel/cpu/sched.c
+
+#include <kernel/cpu/sched.h>
+#include <kernel/timer.h>  // For timer_get_ticks and the throttle timer
+#include <kernel/io.h>     // For irq_save/irq_restore and rdtsc
+#include <kernel/cpu/lapic.h> // For lapic_delay_us, to measure the TSC
+#include <kernel/string.h> // For memset
+#include <kernel/debug.h>
+
+// One FIFO of runnable tasks per level, linked through task->run_next.
+// The task that is currently running is never on a queue.
+typedef struct {
+    task_struct_t* head;
+    task_struct_t* tail;
+} run_queue_t;
+
+// Every CPU schedules from its own queues. A queued task's 'cpu' field says
+// whose queues it is on.
+typedef struct {
+    run_queue_t queues[SCHED_LEVELS];
+
+    // Bit l is set while queues[l] is not empty. The lowest set bit is the
+    // most important level.
+    uint32_t ready_bitmap;
+
+    // Tasks on the queues, for placing and stealing work.
+    uint32_t nr_ready;
+
+    // nr_ready sampled every tick.
+    sched_rq_stats_t stats;
+
+    // Runs when nothing else is ready. It is never put on a queue.
+    task_struct_t* idle;
+
+    // Tick of the last priority boost.
+    uint32_t last_boost;
+
+    // Set by sched_tick() when the running task has to give up the CPU.
+    bool need_resched;
+
+    // Set by sched_yield_to(): the task that gets the CPU at the next switch.
+    task_struct_t* yield_target;
+} sched_rq_t;
+
+static sched_rq_t sched_rqs[SMP_MAX_CPUS];
+
+// Bits of the normal (non real-time) levels in ready_bitmap.
+#define NORMAL_LEVELS_MASK (((1u << SCHED_PRIORITIES) - 1) << SCHED_RT_PRIORITIES)
+
+// CPU bandwidth groups. Group 0 is the default and has no limit.
+static sched_group_t sched_groups[SCHED_MAX_GROUPS];
+
+// The 1, 5 and 15 minute load averages, and the tick they were last updated.
+static uint32_t load_avg[3];
+static uint32_t load_last_update = 0;
+
+// FIXED_1 * e^(-5s / 1min), e^(-5s / 5min) and e^(-5s / 15min).
+static const uint32_t load_exp[3] = { 1884, 2014, 2037 };
+
+// TSC cycles per tick and per microsecond, measured by sched_init().
+static uint32_t tsc_per_tick = 0;
+static uint32_t tsc_per_us = 1;
+
+// TSC at boot, where the times in the switch trace start.
+static uint64_t boot_tsc = 0;
+
+// Wake-up latencies of all tasks, the ones that are gone too.
+static sched_latency_t latency_all;
+
+// The switch trace, a ring of the last SCHED_TRACE_SIZE switches. 'head'
+// and 'tail' count the records written and read. Switches are recorded
+// under the kernel lock with interrupts disabled, and read the same way,
+// so the ring needs no lock of its own.
+static sched_switch_t trace_ring[SCHED_TRACE_SIZE];
+static uint32_t trace_head = 0;
+static uint32_t trace_tail = 0;
+static uint32_t trace_dropped = 0;
+static bool trace_on = false;
+
+extern page_directory_t* kernel_directory;
+
+// The calling CPU's queues.
+static inline sched_rq_t* this_rq() {
+    return &sched_rqs[this_cpu()->id];
+}
+
+// Is this some CPU's idle task?
+static inline bool sched_is_idle(task_struct_t* task) {
+    return task == sched_rqs[task->cpu].idle;
+}
+
+// A task whose FPU registers were not saved yet can only run on the CPU that
+// holds them. It moves again once another task there uses the FPU.
+static inline bool sched_can_run_on(task_struct_t* task, int cpu) {
+    return task->cpu == cpu || cpus[task->cpu].fpu_owner != task;
+}
+
+// Returns the queue a task belongs on.
+static int sched_level(task_struct_t* task) {
+    if (task->policy == SCHED_FIFO) {
+        return SCHED_RT_PRIORITIES - task->rt_priority;
+    }
+    return SCHED_RT_PRIORITIES + task->priority;
+}
+
+// Appends a task to the end of its level's queue on its CPU.
+static void sched_enqueue(task_struct_t* task) {
+    sched_rq_t* rq = &sched_rqs[task->cpu];
+    int level = sched_level(task);
+    run_queue_t* q = &rq->queues[level];
+    task->run_next = NULL;
+    if (q->tail) {
+        q->tail->run_next = task;
+    } else {
+        q->head = task;
+    }
+    q->tail = task;
+    rq->ready_bitmap |= (1u << level);
+    rq->nr_ready++;
+}
+
+// Puts a task back at the front of its queue, e.g. after a higher level
+// preempted it. It keeps the rest of its slice.
+static void sched_push_front(task_struct_t* task) {
+    sched_rq_t* rq = &sched_rqs[task->cpu];
+    int level = sched_level(task);
+    run_queue_t* q = &rq->queues[level];
+    task->run_next = q->head;
+    q->head = task;
+    if (!q->tail) {
+        q->tail = task;
+    }
+    rq->ready_bitmap |= (1u << level);
+    rq->nr_ready++;
+}
+
+// Holds a runnable task back until its group's next period.
+static void sched_park(task_struct_t* task) {
+    task->run_next = task->group->parked;
+    task->group->parked = task;
+}
+
+// Picks the CPU a task that becomes runnable is queued on. It stays where it
+// ran last (its cache is warm there) unless that CPU is busy and another
+// one is idle.
+static int sched_select_cpu(task_struct_t* task) {
+    if (!cpus[task->cpu].online) {
+        task->cpu = 0;
+    }
+    if (cpus[task->cpu].current == sched_rqs[task->cpu].idle) {
+        return task->cpu;
+    }
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (cpus[cpu].online && cpus[cpu].current == sched_rqs[cpu].idle &&
+            sched_rqs[cpu].nr_ready == 0 && sched_can_run_on(task, cpu)) {
+            return cpu;
+        }
+    }
+    return task->cpu;
+}
+
+// Queues a runnable task, or parks it if its group is out of quota. An idle
+// CPU that got work is woken up.
+static void sched_make_ready(task_struct_t* task) {
+    if (task->group->throttled) {
+        sched_park(task);
+        return;
+    }
+    task->cpu = sched_select_cpu(task);
+    sched_enqueue(task);
+
+    cpu_t* cpu = &cpus[task->cpu];
+    if (cpu != this_cpu() && cpu->current == sched_rqs[cpu->id].idle) {
+        smp_send_resched(cpu);
+    }
+}
+
+// Takes the first task off the highest non-empty level, or returns NULL.
+// Tasks whose group ran out of quota after they were queued are parked
+// on the way, so throttling a group never has to search the queues.
+static task_struct_t* sched_dequeue(sched_rq_t* rq) {
+    while (rq->ready_bitmap) {
+        int level = __builtin_ctz(rq->ready_bitmap);
+        run_queue_t* q = &rq->queues[level];
+        task_struct_t* task = q->head;
+        q->head = task->run_next;
+        if (!q->head) {
+            q->tail = NULL;
+            rq->ready_bitmap &= ~(1u << level);
+        }
+        task->run_next = NULL;
+        rq->nr_ready--;
+
+        if (!task->group->throttled) {
+            return task;
+        }
+        sched_park(task);
+    }
+    return NULL;
+}
+
+// Unlinks a task from the list starting at *link. Returns true if it was there.
+static bool sched_unlink(task_struct_t** link, task_struct_t* task) {
+    for (; *link; link = &(*link)->run_next) {
+        if (*link == task) {
+            *link = task->run_next;
+            task->run_next = NULL;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Takes a task off its ready queue. Returns false if it was not on it.
+// The walk is over one level only, and there are few tasks per level.
+static bool sched_remove(task_struct_t* task) {
+    sched_rq_t* rq = &sched_rqs[task->cpu];
+    int level = sched_level(task);
+    run_queue_t* q = &rq->queues[level];
+    if (!sched_unlink(&q->head, task)) {
+        return false;
+    }
+    q->tail = NULL;
+    for (task_struct_t* t = q->head; t; t = t->run_next) {
+        q->tail = t;
+    }
+    if (!q->head) {
+        rq->ready_bitmap &= ~(1u << level);
+    }
+    rq->nr_ready--;
+    return true;
+}
+
+// Finds a task on another CPU's queues that 'cpu' could run: the most
+// important one on the busiest CPU. Takes it over if 'take' is set.
+static task_struct_t* sched_steal(int cpu, bool take) {
+    sched_rq_t* busiest = NULL;
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        if (i != cpu && cpus[i].online && sched_rqs[i].nr_ready &&
+            (!busiest || sched_rqs[i].nr_ready > busiest->nr_ready)) {
+            busiest = &sched_rqs[i];
+        }
+    }
+    if (!busiest) {
+        return NULL;
+    }
+
+    for (uint32_t bits = busiest->ready_bitmap; bits; bits &= bits - 1) {
+        for (task_struct_t* task = busiest->queues[__builtin_ctz(bits)].head; task; task = task->run_next) {
+            if (task->group->throttled || !sched_can_run_on(task, cpu)) {
+                continue;
+            }
+            if (take) {
+                sched_remove(task);
+                task->cpu = cpu;
+            }
+            return task;
+        }
+    }
+    return NULL;
+}
+
+// Moves every ready normal task to level 0 with a fresh slice.
+static void sched_boost_all(sched_rq_t* rq, task_struct_t* current) {
+    run_queue_t* top = &rq->queues[SCHED_RT_PRIORITIES];
+    for (int level = SCHED_RT_PRIORITIES + 1; level < SCHED_LEVELS; level++) {
+        run_queue_t* q = &rq->queues[level];
+        for (task_struct_t* task = q->head; task; task = task->run_next) {
+            task->priority = 0;
+            task->time_slice = SCHED_SLICE(0);
+        }
+        if (q->head) {
+            if (top->tail) {
+                top->tail->run_next = q->head;
+            } else {
+                top->head = q->head;
+            }
+            top->tail = q->tail;
+            q->head = q->tail = NULL;
+        }
+    }
+    rq->ready_bitmap &= ~NORMAL_LEVELS_MASK;
+    if (top->head) {
+        rq->ready_bitmap |= (1u << SCHED_RT_PRIORITIES);
+    }
+
+    if (current != rq->idle && current->policy == SCHED_NORMAL) {
+        current->priority = 0;
+        current->time_slice = SCHED_SLICE(0);
+    }
+}
+
+// Timer callback: a throttled real-time task may run again.
+static void sched_rt_unthrottle(void* data) {
+    task_struct_t* task = (task_struct_t*)data;
+    task->rt_throttled = false;
+    task->rt_used = 0;
+    task->rt_period_start = timer_get_ticks();
+    if (task->state == TASK_STATE_RUNNING && !task->on_cpu) {
+        sched_make_ready(task);
+    }
+}
+
+// Timer callback: a throttled group starts a new period with a full quota.
+static void sched_group_unthrottle(void* data) {
+    sched_group_t* group = (sched_group_t*)data;
+    group->throttled = false;
+    group->used = 0;
+    group->period_start = timer_get_ticks();
+
+    while (group->parked) {
+        task_struct_t* task = group->parked;
+        group->parked = task->run_next;
+        sched_make_ready(task);
+    }
+}
+
+// Sets up the calling CPU's queues.
+void sched_init_cpu(task_struct_t* idle) {
+    sched_rq_t* rq = this_rq();
+    for (int i = 0; i < SCHED_LEVELS; i++) {
+        rq->queues[i].head = NULL;
+        rq->queues[i].tail = NULL;
+    }
+    rq->ready_bitmap = 0;
+    rq->nr_ready = 0;
+    rq->stats.samples = 0;
+    rq->stats.total = 0;
+    rq->stats.max = 0;
+    rq->idle = idle;
+    rq->last_boost = timer_get_ticks();
+    rq->need_resched = false;
+    rq->yield_target = NULL;
+    idle->group = &sched_groups[0];
+    idle->tsc_mark = rdtsc(); // It is running from now on
+}
+
+// Sets up the scheduler. Must be called before any task is woken.
+void sched_init(task_struct_t* idle) {
+    for (int i = 0; i < SCHED_MAX_GROUPS; i++) {
+        sched_groups[i].quota = 0;
+        sched_groups[i].throttled = false;
+        sched_groups[i].parked = NULL;
+    }
+
+    // Every CPU's TSC runs at the same rate, so one measurement does.
+    uint64_t start = rdtsc();
+    lapic_delay_us(1000000 / TIMER_HZ);
+    tsc_per_tick = (uint32_t)(rdtsc() - start);
+    tsc_per_us = tsc_per_tick / (1000000 / TIMER_HZ);
+    if (tsc_per_us == 0) {
+        tsc_per_us = 1;
+    }
+    boot_tsc = start;
+
+    sched_init_cpu(idle);
+}
+
+// Makes a task runnable. Must be called with interrupts disabled.
+void sched_wake(task_struct_t* task) {
+    // Already on a queue, or still on a CPU (e.g. woken before it got to
+    // switch away). A running task is not on a queue and must not be added.
+    if (task->state == TASK_STATE_RUNNING || task->on_cpu || sched_is_idle(task)) {
+        task->state = TASK_STATE_RUNNING;
+        return;
+    }
+
+    // It blocked before using up its slice, so it looks interactive.
+    if (task->policy == SCHED_NORMAL) {
+        if (task->priority > 0) {
+            task->priority--;
+        }
+        task->time_slice = SCHED_SLICE(task->priority);
+    }
+    task->state = TASK_STATE_RUNNING;
+
+    // Its wake-up latency runs until sched_account_switch() puts it on a CPU.
+    task->wake_tsc = rdtsc();
+
+    // A throttled real-time task is queued when its next period starts.
+    if (!task->rt_throttled) {
+        sched_make_ready(task);
+    }
+}
+
+// Is anything waiting on this CPU's queues, or on another CPU's that we
+// could take over?
+bool sched_has_ready() {
+    return this_rq()->ready_bitmap != 0 || sched_steal(this_cpu()->id, false);
+}
+
+// Folds the number of tasks that are running or ready on any CPU into the
+// load averages. Only the boot CPU calls it.
+static void sched_calc_load() {
+    uint32_t active = 0;
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        if (!cpus[i].online) {
+            continue;
+        }
+        active += sched_rqs[i].nr_ready;
+        if (cpus[i].current != sched_rqs[i].idle) {
+            active++;
+        }
+    }
+    active *= FIXED_1;
+    for (int i = 0; i < 3; i++) {
+        load_avg[i] = (load_avg[i] * load_exp[i] + active * (FIXED_1 - load_exp[i])) >> FSHIFT;
+    }
+}
+
+void sched_get_loadavg(uint32_t loads[3]) {
+    for (int i = 0; i < 3; i++) {
+        loads[i] = load_avg[i];
+    }
+}
+
+uint32_t sched_tsc_per_tick() {
+    return tsc_per_tick;
+}
+
+// Charges the TSC cycles since the task's mark to its user or kernel time.
+static void sched_charge(task_struct_t* task, uint64_t now, bool user) {
+    uint64_t cycles = now - task->tsc_mark;
+    if (user) {
+        task->usage.user_cycles += cycles;
+    } else {
+        task->usage.system_cycles += cycles;
+    }
+    task->tsc_mark = now;
+}
+
+uint32_t sched_cycles_to_us(uint64_t cycles) {
+    // Long division in two 32-bit steps: the high half leaves a remainder
+    // that divl takes in EDX together with the low half. The high half of
+    // the quotient is dropped.
+    uint32_t rem = (uint32_t)(cycles >> 32) % tsc_per_us;
+    uint32_t us;
+    __asm__("divl %2" : "=a"(us), "+d"(rem) : "rm"(tsc_per_us), "a"((uint32_t)cycles));
+    return us;
+}
+
+// Adds one wake-up latency to a histogram.
+static void sched_latency_add(sched_latency_t* lat, uint32_t us) {
+    int bucket = us ? 31 - __builtin_clz(us) : 0;
+    if (bucket >= SCHED_LAT_BUCKETS) {
+        bucket = SCHED_LAT_BUCKETS - 1;
+    }
+    lat->hist[bucket]++;
+    lat->count++;
+    if (lat->total_us + us >= lat->total_us) {
+        lat->total_us += us;
+    } else {
+        lat->total_us = 0xFFFFFFFF; // Stays there instead of wrapping around
+    }
+    if (us > lat->max_us) {
+        lat->max_us = us;
+    }
+}
+
+// Appends a switch to the trace, dropping the oldest record if it is full.
+static void sched_trace_record(task_struct_t* prev, task_struct_t* next, uint64_t now, uint32_t wait_us) {
+    if (trace_head - trace_tail == SCHED_TRACE_SIZE) {
+        trace_tail++;
+        trace_dropped++;
+    }
+    sched_switch_t* rec = &trace_ring[trace_head % SCHED_TRACE_SIZE];
+    rec->time_us = sched_cycles_to_us(now - boot_tsc);
+    rec->cpu = this_cpu()->id;
+    rec->prev_pid = prev->pid;
+    rec->prev_state = prev->state;
+    rec->next_pid = next->pid;
+    rec->wait_us = wait_us;
+    trace_head++;
+}
+
+void sched_account_switch(task_struct_t* prev, task_struct_t* next) {
+    uint64_t now = rdtsc();
+
+    // Outside a syscall, a user task was preempted out of user mode. The
+    // interrupt that did it is charged along with it.
+    sched_charge(prev, now, !prev->in_syscall && prev->page_directory != kernel_directory);
+    if (prev->state == TASK_STATE_RUNNING) {
+        prev->usage.nivcsw++;
+    } else {
+        prev->usage.nvcsw++;
+    }
+    next->tsc_mark = now;
+
+    // A woken task's wait for the CPU ends here. One that was preempted
+    // or yielded was not woken, so it is not measured.
+    uint32_t wait_us = 0;
+    if (next->wake_tsc) {
+        wait_us = sched_cycles_to_us(now - next->wake_tsc);
+        next->wake_tsc = 0;
+        sched_latency_add(&next->latency, wait_us);
+        sched_latency_add(&latency_all, wait_us);
+    }
+    if (trace_on) {
+        sched_trace_record(prev, next, now, wait_us);
+    }
+}
+
+void sched_syscall_enter(task_struct_t* task) {
+    sched_charge(task, rdtsc(), true);
+    task->in_syscall = true;
+}
+
+void sched_syscall_exit(task_struct_t* task) {
+    sched_charge(task, rdtsc(), false);
+    task->in_syscall = false;
+}
+
+void sched_get_latency(sched_latency_t* out) {
+    uint32_t flags = irq_save();
+    *out = latency_all;
+    irq_restore(flags);
+}
+
+void sched_get_rq_stats(int cpu, sched_rq_stats_t* out) {
+    uint32_t flags = irq_save();
+    *out = sched_rqs[cpu].stats;
+    irq_restore(flags);
+}
+
+void sched_reset_stats() {
+    uint32_t flags = irq_save();
+    memset(&latency_all, 0, sizeof(latency_all));
+    for (task_struct_t* task = task_list; task; task = task->task_next) {
+        memset(&task->latency, 0, sizeof(task->latency));
+    }
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        memset(&sched_rqs[i].stats, 0, sizeof(sched_rq_stats_t));
+    }
+    irq_restore(flags);
+}
+
+void sched_trace_enable(bool on) {
+    uint32_t flags = irq_save();
+    if (on && !trace_on) {
+        trace_tail = trace_head;
+        trace_dropped = 0;
+    }
+    trace_on = on;
+    irq_restore(flags);
+}
+
+bool sched_trace_enabled() {
+    return trace_on;
+}
+
+int sched_trace_read(sched_switch_t* out, int max) {
+    uint32_t flags = irq_save();
+    int n = 0;
+    while (n < max && trace_tail != trace_head) {
+        out[n++] = trace_ring[trace_tail % SCHED_TRACE_SIZE];
+        trace_tail++;
+    }
+    irq_restore(flags);
+    return n;
+}
+
+uint32_t sched_trace_lost() {
+    return trace_dropped;
+}
+
+void sched_getrusage(task_struct_t* task, int who, rusage_t* out) {
+    const task_usage_t* usage = who == RUSAGE_CHILDREN ? &task->child_usage : &task->usage;
+    out->utime_ms = usage->utime * (1000 / TIMER_HZ);
+    out->stime_ms = usage->stime * (1000 / TIMER_HZ);
+    out->user_cycles = usage->user_cycles;
+    out->system_cycles = usage->system_cycles;
+    out->nvcsw = usage->nvcsw;
+    out->nivcsw = usage->nivcsw;
+}
+
+// Charges the tick that just ended to the running task.
+void sched_tick(task_struct_t* current, bool user_mode) {
+    sched_rq_t* rq = this_rq();
+
+    // Every task is charged, the idle one too, so its share shows how idle
+    // the CPU is.
+    if (user_mode) {
+        current->usage.utime++;
+    } else {
+        current->usage.stime++;
+    }
+    rq->stats.samples++;
+    rq->stats.total += rq->nr_ready;
+    if (rq->nr_ready > rq->stats.max) {
+        rq->stats.max = rq->nr_ready;
+    }
+    if (this_cpu()->id == 0 && timer_get_ticks() - load_last_update >= LOAD_FREQ) {
+        load_last_update = timer_get_ticks();
+        sched_calc_load();
+    }
+
+    if (current == rq->idle || current->state != TASK_STATE_RUNNING) {
+        return;
+    }
+
+    // Charge the group first. Once its quota for the period is gone, none
+    // of its tasks run until the next period starts.
+    sched_group_t* group = current->group;
+    group->total_ticks++;
+    if (group->quota) {
+        uint32_t now = timer_get_ticks();
+        if (now - group->period_start >= group->period) {
+            group->period_start = now;
+            group->used = 0;
+        }
+        if (++group->used >= group->quota && !group->throttled) {
+            group->throttled = true;
+            group->throttle_count++;
+            timer_add(&group->timer, group->period_start + group->period, sched_group_unthrottle, group);
+            rq->need_resched = true;
+        }
+    }
+
+    if (current->policy == SCHED_FIFO) {
+        uint32_t now = timer_get_ticks();
+        if (now - current->rt_period_start >= current->rt_period) {
+            current->rt_period_start = now;
+            current->rt_used = 0;
+        }
+
+        // Out of budget for this period: keep it off the CPU until the next
+        // one, so a runaway real-time task cannot lock up the system.
+        if (++current->rt_used >= current->rt_runtime) {
+            current->rt_throttled = true;
+            timer_add(&current->rt_timer, current->rt_period_start + current->rt_period, sched_rt_unthrottle, current);
+            rq->need_resched = true;
+        }
+        return;
+    }
+
+    if (current->time_slice > 0) {
+        current->time_slice--;
+    }
+
+    if (current->time_slice == 0) {
+        // Used its whole slice: a CPU hog. Demote it and let others run.
+        if (current->priority < SCHED_PRIORITIES - 1) {
+            current->priority++;
+        }
+        current->time_slice = SCHED_SLICE(current->priority);
+        rq->need_resched = true;
+    }
+}
+
+// Decides which task runs next on this CPU. Called from schedule() with
+// interrupts disabled.
+task_struct_t* sched_next(task_struct_t* current) {
+    sched_rq_t* rq = this_rq();
+    int cpu = this_cpu()->id;
+
+    uint32_t now = timer_get_ticks();
+    if (now - rq->last_boost >= SCHED_BOOST_TICKS) {
+        rq->last_boost = now;
+        sched_boost_all(rq, current);
+    }
+
+    bool resched = rq->need_resched;
+    rq->need_resched = false;
+
+    if (current != rq->idle && current->state == TASK_STATE_RUNNING) {
+        if (current->rt_throttled) {
+            // Queued again by sched_rt_unthrottle().
+        } else if (current->group->throttled) {
+            sched_park(current);
+        } else if (resched) {
+            sched_enqueue(current);
+        } else if (rq->ready_bitmap & ((1u << sched_level(current)) - 1)) {
+            // Something more important became ready, e.g. a real-time task
+            // woken by its timer. Same-level tasks do not preempt each other.
+            sched_push_front(current);
+        } else {
+            return current;
+        }
+    }
+    // A task that is not RUNNING blocked (or exited) and stays off the queues
+    // until sched_wake() puts it back.
+
+    // A directed yield skips the queue order, but not a more important level
+    // than the one the yielding task was running at. The target may be
+    // queued on another CPU; it moves here.
+    task_struct_t* target = rq->yield_target;
+    rq->yield_target = NULL;
+    if (target && target->state == TASK_STATE_RUNNING && !target->on_cpu && !target->group->throttled &&
+        sched_can_run_on(target, cpu) && !(rq->ready_bitmap & ((1u << sched_level(current)) - 1)) &&
+        sched_remove(target)) {
+        target->cpu = cpu;
+        return target;
+    }
+
+    task_struct_t* next = sched_dequeue(rq);
+    if (!next) {
+        // Nothing of our own: help out a busier CPU.
+        next = sched_steal(cpu, true);
+    }
+    return next ? next : rq->idle;
+}
+
+// Switches a task between the normal and real-time classes. The task must
+// not be on a ready queue, which holds for the caller's own task.
+int sched_setscheduler(task_struct_t* task, int policy, int rt_priority, uint32_t runtime, uint32_t period) {
+    if (policy != SCHED_NORMAL && (policy != SCHED_FIFO || rt_priority < 1 || rt_priority > SCHED_RT_PRIORITIES ||
+                                   period == 0 || runtime == 0 || runtime > period)) {
+        return -1;
+    }
+
+    uint32_t flags = irq_save();
+    if (policy == SCHED_NORMAL) {
+        task->policy = SCHED_NORMAL;
+        task->priority = 0;
+        task->time_slice = SCHED_SLICE(0);
+    } else {
+        task->policy = SCHED_FIFO;
+        task->rt_priority = rt_priority;
+        task->rt_runtime = runtime;
+        task->rt_period = period;
+        task->rt_used = 0;
+        task->rt_period_start = timer_get_ticks();
+    }
+    task->rt_throttled = false;
+    irq_restore(flags);
+    return 0;
+}
+
+// Looks up a bandwidth group by number.
+sched_group_t* sched_get_group(int id) {
+    if (id < 0 || id >= SCHED_MAX_GROUPS) {
+        return NULL;
+    }
+    return &sched_groups[id];
+}
+
+// Sets a group's CPU quota. The new limit starts with a fresh period.
+int sched_group_set_limit(sched_group_t* group, uint32_t quota, uint32_t period) {
+    if (group == &sched_groups[0] || (quota && (period == 0 || quota > period))) {
+        return -1; // The default group is never limited.
+    }
+
+    uint32_t flags = irq_save();
+    group->quota = quota;
+    group->period = period;
+    group->used = 0;
+    group->period_start = timer_get_ticks();
+    if (group->throttled) {
+        timer_cancel(&group->timer);
+        sched_group_unthrottle(group);
+    }
+    irq_restore(flags);
+    return 0;
+}
+
+// Moves a task to another group. A runnable task is taken off its queue (or
+// its old group's parked list) and put back under the new group's rules.
+void sched_set_group(task_struct_t* task, sched_group_t* group) {
+    uint32_t flags = irq_save();
+    bool queued = task->state == TASK_STATE_RUNNING && !task->on_cpu && !sched_is_idle(task) && !task->rt_throttled;
+    if (queued && !sched_unlink(&task->group->parked, task)) {
+        sched_remove(task);
+    }
+    task->group = group;
+    if (queued) {
+        sched_make_ready(task);
+    }
+    irq_restore(flags);
+}
+
+// Gives up the CPU. The task goes to the back of its level without losing
+// its place in the feedback queues, so yielding is never punished.
+void sched_yield() {
+    uint32_t flags = irq_save();
+    this_rq()->need_resched = true;
+    __asm__ __volatile__("int $0x20");
+    irq_restore(flags);
+}
+
+// Gives the CPU, and what is left of the current slice, to 'target'.
+int sched_yield_to(task_struct_t* target) {
+    uint32_t flags = irq_save();
+    task_struct_t* current = current_task;
+    // One already running on another CPU, or one that may not run here,
+    // cannot take our place, so it would not get our slice either.
+    if (target == current || sched_is_idle(target) || target->state != TASK_STATE_RUNNING ||
+        target->on_cpu || !sched_can_run_on(target, this_cpu()->id) ||
+        target->rt_throttled || target->group->throttled) {
+        irq_restore(flags);
+        return -1;
+    }
+
+    // The target runs on our slice first. We start the next one afresh,
+    // like a task that blocked, since we did not spin the time away.
+    if (current->policy == SCHED_NORMAL && target->policy == SCHED_NORMAL) {
+        target->time_slice += current->time_slice;
+        current->time_slice = SCHED_SLICE(current->priority);
+    }
+    this_rq()->yield_target = target;
+    this_rq()->need_resched = true;
+    __asm__ __volatile__("int $0x20");
+    irq_restore(flags);
+    return 0;
+}
@@ -0,0 +1,218 @@
+// myos/kernel/cpu/signal.c
+
+#include <kernel/cpu/signal.h>
+#include <kernel/cpu/process.h>
+#include <kernel/cpu/sched.h>  // For sched_wake
+#include <kernel/paging.h>
+#include <kernel/timer.h>
+#include <kernel/io.h>         // For irq_save/irq_restore
+
+// User-mode selectors, and the EFLAGS bits a handler may leave changed
+// (the arithmetic flags, TF and DF). Interrupts always stay on.
+#define USER_CS 0x1B
+#define USER_DS 0x23
+#define USER_EFLAGS_MASK 0xDD5
+#define EFLAGS_IF 0x200
+
+extern page_directory_t* kernel_directory;
+
+// Signals that do nothing unless the task has a handler for them.
+static const uint32_t default_ignored = 1u << SIGCHLD;
+
+static bool signal_valid(int sig) {
+    return sig > 0 && sig < NSIG;
+}
+
+// Pending signals the task would act on right now. SIGKILL cannot be blocked.
+static uint32_t signal_ready(task_struct_t* task) {
+    return task->sig_pending & ~(task->sig_blocked & ~(1u << SIGKILL));
+}
+
+bool signal_pending(task_struct_t* task) {
+    return signal_ready(task) != 0;
+}
+
+// Would delivering 'sig' do anything? An ignored one is not worth a wakeup.
+static bool signal_wanted(task_struct_t* task, int sig) {
+    uint32_t handler = task->sig_handlers[sig];
+    if (handler == SIG_IGN) {
+        return false;
+    }
+    return handler != SIG_DFL || !(default_ignored & (1u << sig));
+}
+
+// Is there a signal ready that a handler or the default action acts on?
+static bool signal_acts(task_struct_t* task) {
+    uint32_t ready = signal_ready(task);
+    for (int sig = 1; sig < NSIG; sig++) {
+        if ((ready & (1u << sig)) && signal_wanted(task, sig)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int signal_send(task_struct_t* task, int sig) {
+    if (!task || task->page_directory == kernel_directory ||
+        task->state == TASK_STATE_UNUSED || task->state == TASK_STATE_ZOMBIE) {
+        return -1;
+    }
+    if (sig == 0) {
+        return 0;
+    }
+    if (!signal_valid(sig)) {
+        return -1;
+    }
+    __sync_fetch_and_or(&task->sig_pending, 1u << sig);
+
+    if (!signal_wanted(task, sig) || !(signal_ready(task) & (1u << sig))) {
+        return 0;
+    }
+    // Only sleep() and pause() are cut short. Everything else finishes its
+    // wait first and takes the signal on its way back to user mode, except
+    // for SIGKILL: it also ends the waits that give up for a signal
+    // (wait_event_interruptible(), futex_wait()). Other waits just go back
+    // to sleep.
+    uint32_t flags = irq_save();
+    if (task->state == TASK_STATE_SLEEPING ||
+        (task->state == TASK_STATE_WAITING && sig == SIGKILL)) {
+        sched_wake(task);
+    } else if (task->on_cpu && task->cpu != this_cpu()->id) {
+        smp_send_resched(&cpus[task->cpu]); // Enter the kernel, and take it on the way out
+    }
+    irq_restore(flags);
+    return 0;
+}
+
+// Ends the current task the way its exit syscall would. Never returns.
+static void signal_terminate(int sig) {
+    irq_save(); // The yield does not return, the flags are never restored.
+    process_exit(current_task, SIGNAL_EXIT_STATUS(sig));
+    __asm__ __volatile__("int $0x20");
+}
+
+void signal_deliver(registers_t* r) {
+    if ((r->cs & 3) != 3) {
+        return; // Back to kernel code, signals wait for user mode.
+    }
+    task_struct_t* task = current_task;
+
+    uint32_t ready;
+    while ((ready = signal_ready(task)) != 0) {
+        int sig = __builtin_ctz(ready);
+        __sync_fetch_and_and(&task->sig_pending, ~(1u << sig));
+
+        uint32_t handler = sig == SIGKILL ? SIG_DFL : task->sig_handlers[sig];
+        if (handler == SIG_IGN || (handler == SIG_DFL && (default_ignored & (1u << sig)))) {
+            continue;
+        }
+        if (handler == SIG_DFL) {
+            signal_terminate(sig);
+        }
+
+        // The frame goes below the interrupted stack pointer, placed so the
+        // handler starts with the stack aligned like after a call.
+        uint32_t frame_addr = ((r->useresp - sizeof(signal_frame_t)) & ~0xF) - 4;
+        if (!paging_user_access(frame_addr, sizeof(signal_frame_t), true)) {
+            signal_terminate(SIGSEGV); // Nowhere to run the handler
+        }
+        signal_frame_t* frame = (signal_frame_t*)frame_addr;
+        frame->restorer = task->sig_restorer;
+        frame->sig = sig;
+        frame->regs = *r;
+        frame->blocked = task->sig_blocked;
+        frame->prev = task->sig_frame;
+        task->sig_frame = frame_addr;
+
+        // The signal is blocked while its handler runs.
+        task->sig_blocked |= 1u << sig;
+        r->eip = handler;
+        r->useresp = frame_addr;
+        return;
+    }
+}
+
+bool signal_return(registers_t* r) {
+    task_struct_t* task = current_task;
+    uint32_t frame_addr = task->sig_frame;
+    if (!frame_addr || !paging_user_access(frame_addr, sizeof(signal_frame_t), true)) {
+        return false;
+    }
+    signal_frame_t* frame = (signal_frame_t*)frame_addr;
+    registers_t saved = frame->regs;
+
+    // The frame is in user memory, so only take what user code may set.
+    saved.cs = USER_CS;
+    saved.ss = USER_DS;
+    saved.ds = saved.es = saved.fs = saved.gs = USER_DS;
+    saved.eflags = (saved.eflags & USER_EFLAGS_MASK) | EFLAGS_IF;
+    saved.int_no = r->int_no;
+    saved.err_code = r->err_code;
+    *r = saved;
+
+    task->sig_blocked = frame->blocked & ~(1u << SIGKILL);
+    task->sig_frame = frame->prev;
+    return true;
+}
+
+int signal_action(int sig, uint32_t handler, uint32_t restorer) {
+    task_struct_t* task = current_task;
+    if (!signal_valid(sig) || sig == SIGKILL || handler >= KERNEL_VIRT_BASE || restorer >= KERNEL_VIRT_BASE) {
+        return -1;
+    }
+    // A handler needs somewhere to return to.
+    if (handler > SIG_IGN && !restorer && !task->sig_restorer) {
+        return -1;
+    }
+    int old = (int)task->sig_handlers[sig];
+    task->sig_handlers[sig] = handler;
+    if (restorer) {
+        task->sig_restorer = restorer;
+    }
+    return old;
+}
+
+uint32_t signal_mask(int how, uint32_t set) {
+    task_struct_t* task = current_task;
+    uint32_t old = task->sig_blocked;
+    switch (how) {
+        case SIG_BLOCK:   task->sig_blocked |= set; break;
+        case SIG_UNBLOCK: task->sig_blocked &= ~set; break;
+        case SIG_SETMASK: task->sig_blocked = set; break;
+    }
+    task->sig_blocked &= ~(1u << SIGKILL);
+    return old;
+}
+
+// Timer callback: the task's alarm went off.
+static void alarm_expired(void* data) {
+    signal_send((task_struct_t*)data, SIGALRM);
+}
+
+uint32_t signal_alarm(uint32_t ms) {
+    task_struct_t* task = current_task;
+    uint32_t flags = irq_save();
+    uint32_t now = timer_get_ticks();
+    uint32_t left = 0;
+    uint32_t expires = task->alarm_timer.expires;
+    if (timer_cancel(&task->alarm_timer)) {
+        left = expires > now ? (expires - now) * (1000 / TIMER_HZ) : 1000 / TIMER_HZ;
+    }
+    if (ms) {
+        uint32_t ticks = (ms + (1000 / TIMER_HZ) - 1) / (1000 / TIMER_HZ);
+        timer_add(&task->alarm_timer, now + ticks, alarm_expired, task);
+    }
+    irq_restore(flags);
+    return left;
+}
+
+void signal_pause() {
+    task_struct_t* task = current_task;
+    uint32_t flags = irq_save();
+    // Other wakeups bring us back here too, so check again every time.
+    while (!signal_acts(task)) {
+        task->state = TASK_STATE_SLEEPING;
+        __asm__ __volatile__("int $0x20");
+    }
+    irq_restore(flags);
+}
@@ -0,0 +1,170 @@
+// myos/kernel/cpu/smp.c
+
+#include <kernel/cpu/smp.h>
+#include <kernel/cpu/spinlock.h>
+#include <kernel/cpu/lapic.h>
+#include <kernel/cpu/sched.h>  // For sched_init_cpu, sched_tick
+#include <kernel/cpu/fpu.h>    // For fpu_init_ap
+#include <kernel/syscall.h>    // For syscall_init_cpu
+#include <kernel/gdt.h>        // For gdt_install_ap
+#include <kernel/idt.h>        // For idt_load
+#include <kernel/pmm.h>
+#include <kernel/paging.h>     // For PHYS_TO_VIRT
+#include <kernel/string.h>     // For memcpy
+#include <kernel/io.h>         // For irq_save/irq_restore
+#include <kernel/timer.h>      // For timer_idle_interrupt
+#include <kernel/debug.h>
+
+// The boot CPU is filled in up front, so that current_task works as soon as
+// gdt_install() loads %gs. It holds the kernel lock from the start, and first
+// lets go of it when its idle task halts.
+cpu_t cpus[SMP_MAX_CPUS] = {
+    [0] = { .self = &cpus[0], .online = true, .lock_depth = 1 },
+};
+
+int smp_cpu_count = 1;
+
+// Held by some CPU from the start. Its nesting depth is in that CPU's cpu_t.
+static spinlock_t kernel_lock = { 1 };
+
+// The top of each AP's boot stack, and the index of the next one to take.
+// Both are used by smp_boot.asm.
+uint32_t ap_boot_stacks[SMP_MAX_CPUS - 1];
+volatile uint32_t ap_next_index = 0;
+
+// APs that made it into ap_main().
+static volatile int ap_started = 0;
+
+// The trampoline, from smp_boot.asm
+extern void ap_trampoline();
+extern void ap_trampoline_end();
+
+extern void start_multitasking(uint32_t esp);
+extern volatile int multitasking_enabled;
+
+void lock_kernel() {
+    uint32_t flags = irq_save();
+    cpu_t* cpu = this_cpu();
+    if (cpu->lock_depth++ == 0) {
+        spin_acquire(&kernel_lock);
+    }
+    irq_restore(flags);
+}
+
+void unlock_kernel() {
+    uint32_t flags = irq_save();
+    cpu_t* cpu = this_cpu();
+    if (--cpu->lock_depth == 0) {
+        spin_release(&kernel_lock);
+    }
+    irq_restore(flags);
+}
+
+void preempt_resched() {
+    uint32_t eflags;
+    __asm__ __volatile__("pushfl\n\tpopl %0" : "=r"(eflags));
+    if (eflags & 0x200) {
+        __asm__ __volatile__("int $0x20"); // schedule() clears preempt_pending
+    }
+}
+
+void smp_send_resched(cpu_t* cpu) {
+    lapic_send_ipi(cpu->apic_id, LAPIC_RESCHED_VECTOR);
+}
+
+// The AP timer charges the tick like IRQ 0 does on the boot CPU. A
+// reschedule IPI means there is new work on our queues.
+void smp_interrupt(registers_t* r) {
+    if (r->int_no == LAPIC_SPURIOUS_VECTOR) {
+        return; // Not a real interrupt, and must not be acknowledged.
+    }
+    lapic_eoi();
+
+    if (!this_cpu()->online || !multitasking_enabled) {
+        return;
+    }
+    if (r->int_no == LAPIC_TIMER_VECTOR) {
+        // The boot CPU ticks from the PIT, its APIC timer only ends long idle periods.
+        if (this_cpu()->id == 0) {
+            timer_idle_interrupt((r->cs & 3) == 3);
+        } else {
+            sched_tick(current_task, (r->cs & 3) == 3);
+        }
+    }
+    schedule();
+}
+
+// Where every AP ends up after the trampoline, on its boot stack.
+void ap_main(int id) {
+    gdt_install_ap(id);
+    idt_load();
+    fpu_init_ap();
+    lapic_enable();
+
+    cpu_t* cpu = this_cpu();
+    cpu->apic_id = lapic_id();
+    __sync_fetch_and_add(&ap_started, 1);
+
+    // Everything from here on touches shared kernel state. We wait here until
+    // the boot CPU is done booting and goes idle.
+    lock_kernel();
+    tss_install();
+    syscall_init_cpu();
+
+    task_struct_t* idle = process_create_idle(id);
+    if (!idle) {
+        qemu_debug_string("SMP: No memory for an idle task, CPU stays offline.\n");
+        unlock_kernel();
+        for (;;) {
+            __asm__ __volatile__("cli\n\thlt");
+        }
+    }
+    cpu->idle = idle;
+    cpu->current = idle;
+    sched_init_cpu(idle);
+    cpu->online = true;
+    smp_cpu_count++;
+
+    qemu_debug_string("SMP: CPU ");
+    qemu_debug_dec(id);
+    qemu_debug_string(" (APIC ID ");
+    qemu_debug_dec(cpu->apic_id);
+    qemu_debug_string(") online.\n");
+
+    lapic_timer_start();
+    start_multitasking(idle->kernel_esp);
+}
+
+void smp_init() {
+    if (!lapic_init()) {
+        return;
+    }
+    cpus[0].apic_id = lapic_id();
+
+    // The APs start in real mode, so their first instructions must be below 1MB.
+    memcpy(PHYS_TO_VIRT(AP_TRAMPOLINE_ADDR), (void*)ap_trampoline,
+           (uint32_t)ap_trampoline_end - (uint32_t)ap_trampoline);
+    for (int i = 0; i < SMP_MAX_CPUS - 1; i++) {
+        void* frame = pmm_alloc_frame();
+        ap_boot_stacks[i] = frame ? (uint32_t)PHYS_TO_VIRT(frame) + PMM_FRAME_SIZE : 0;
+    }
+
+    // We do not parse the ACPI tables, so we do not know how many CPUs there
+    // are. Wake them all and give them time to check in.
+    lapic_start_aps(AP_TRAMPOLINE_ADDR / PMM_FRAME_SIZE);
+    lapic_delay_us(100000);
+
+    // Give back the stacks nobody took.
+    uint32_t taken = ap_next_index;
+    for (uint32_t i = taken; i < SMP_MAX_CPUS - 1; i++) {
+        uint32_t top = ap_boot_stacks[i];
+        ap_boot_stacks[i] = 0;
+        if (top) {
+            pmm_free_frame((void*)VIRT_TO_PHYS(top - PMM_FRAME_SIZE));
+        }
+    }
+
+    qemu_debug_string("SMP: ");
+    qemu_debug_dec(ap_started);
+    qemu_debug_string(" application processor(s) started.\n");
+}
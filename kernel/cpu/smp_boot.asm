@@ -0,0 +1,93 @@
+; myos/kernel/cpu/smp_boot.asm
+
+; Startup code of the application processors. smp_init() copies everything
+; from ap_trampoline to ap_trampoline_end to AP_TRAMPOLINE_ADDR, and the
+; STARTUP IPI starts each AP there, in real mode.
+
+global ap_trampoline
+global ap_trampoline_end
+
+extern ap_main
+extern ap_boot_stacks
+extern ap_next_index
+extern kernel_directory
+extern boot_page_directory
+
+KERNEL_VIRT_BASE   equ 0xC0000000
+AP_TRAMPOLINE_ADDR equ 0x8000 ; Must match smp.h
+SMP_MAX_CPUS       equ 8      ; Must match smp.h
+
+; Where a label of the trampoline ends up once it is copied.
+%define TRAMPOLINE(label) (AP_TRAMPOLINE_ADDR + (label) - ap_trampoline)
+
+section .text
+bits 16
+ap_trampoline:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+
+    ; A flat GDT of our own, until ap_main() loads the CPU's real one.
+    lgdt [TRAMPOLINE(ap_gdt_ptr)]
+    mov eax, cr0
+    or eax, 1               ; Protected mode
+    mov cr0, eax
+    jmp dword 0x08:TRAMPOLINE(ap_protected)
+
+bits 32
+ap_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; The same steps as _start: 4MB pages, the boot page directory (which
+    ; still maps this page and the kernel), then paging with Write Protect.
+    mov eax, cr4
+    or eax, 0x10
+    mov cr4, eax
+    mov eax, boot_page_directory - KERNEL_VIRT_BASE
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80010000
+    mov cr0, eax
+
+    mov eax, ap_higher_half
+    jmp eax
+
+align 8
+ap_gdt:
+    dq 0                    ; Null segment
+    dq 0x00CF9A000000FFFF   ; Code segment (Ring 0)
+    dq 0x00CF92000000FFFF   ; Data segment (Ring 0)
+ap_gdt_ptr:
+    dw ap_gdt_ptr - ap_gdt - 1
+    dd TRAMPOLINE(ap_gdt)
+ap_trampoline_end:
+
+; From here on we run at the kernel's own addresses.
+ap_higher_half:
+    mov eax, [kernel_directory] ; It holds a physical address
+    mov cr3, eax
+
+    ; All APs start at once, so each takes the next boot stack atomically.
+    ; One that finds none left stays parked.
+    mov eax, 1
+    lock xadd [ap_next_index], eax
+    cmp eax, SMP_MAX_CPUS - 1
+    jae .park
+    mov esp, [ap_boot_stacks + eax * 4]
+    test esp, esp
+    jz .park
+
+    inc eax                 ; CPU 0 is the boot CPU
+    push eax
+    call ap_main            ; Never returns
+
+.park:
+    cli
+    hlt
+    jmp .park
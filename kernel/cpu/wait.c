@@ -0,0 +1,78 @@
+// myos/kernel/cpu/wait.c
+
+#include <kernel/cpu/wait.h>
+#include <kernel/cpu/sched.h> // For sched_wake
+
+void wait_queue_init(wait_queue_t* wq) {
+    wq->lock.locked = 0;
+    wq->head = NULL;
+    wq->tail = NULL;
+}
+
+void prepare_to_wait(wait_queue_t* wq) {
+    task_struct_t* task = current_task;
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    if (task->wait_queue != wq) {
+        task->wait_next = NULL;
+        if (wq->tail) {
+            wq->tail->wait_next = task;
+        } else {
+            wq->head = task;
+        }
+        wq->tail = task;
+        task->wait_queue = wq;
+    }
+    task->state = TASK_STATE_WAITING;
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void finish_wait(wait_queue_t* wq) {
+    task_struct_t* task = current_task;
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    task->state = TASK_STATE_RUNNING;
+    if (task->wait_queue == wq) {
+        task_struct_t* prev = NULL;
+        for (task_struct_t* t = wq->head; t != task; t = t->wait_next) {
+            prev = t;
+        }
+        if (prev) {
+            prev->wait_next = task->wait_next;
+        } else {
+            wq->head = task->wait_next;
+        }
+        if (wq->tail == task) {
+            wq->tail = prev;
+        }
+        task->wait_queue = NULL;
+        task->wait_next = NULL;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// Takes up to 'nr' tasks off the front of the queue and makes them runnable.
+static void wake_up_nr(wait_queue_t* wq, int nr) {
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    while (wq->head && nr-- > 0) {
+        task_struct_t* task = wq->head;
+        wq->head = task->wait_next;
+        if (!wq->head) {
+            wq->tail = NULL;
+        }
+        task->wait_queue = NULL;
+        task->wait_next = NULL;
+
+        // It may not have gone to sleep yet; then it just keeps running.
+        if (task->state == TASK_STATE_WAITING) {
+            sched_wake(task);
+        }
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void wake_up(wait_queue_t* wq) {
+    wake_up_nr(wq, PID_MAX);
+}
+
+void wake_up_one(wait_queue_t* wq) {
+    wake_up_nr(wq, 1);
+}
@@ -0,0 +1,87 @@
+// myos/kernel/cpu/workqueue.c
+
+#include <kernel/cpu/workqueue.h>
+#include <kernel/memory.h>     // For malloc
+#include <kernel/io.h>         // For irq_save/irq_restore
+#include <kernel/debug.h>
+
+workqueue_t* system_wq = NULL;
+
+// The body of every worker thread: run queued items in order, and block
+// while there are none.
+static void worker_thread(void* arg) {
+    workqueue_t* wq = (workqueue_t*)arg;
+    while (1) {
+        // queue_work() wakes us up.
+        wait_event(&wq->wait, wq->head != NULL);
+
+        uint32_t flags = irq_save();
+        work_t* work = wq->head;
+        wq->head = work->next;
+        if (!wq->head) {
+            wq->tail = NULL;
+        }
+        work->next = NULL;
+        work->pending = false;
+        irq_restore(flags);
+
+        // Long work is preempted like any other task, so it never holds up
+        // interrupts or more important tasks.
+        work->fn(work->data);
+    }
+}
+
+// Allocates a queue and starts its worker.
+workqueue_t* workqueue_create(const char* name) {
+    workqueue_t* wq = (workqueue_t*)malloc(sizeof(workqueue_t));
+    if (!wq) {
+        return NULL;
+    }
+    wq->head = NULL;
+    wq->tail = NULL;
+    wait_queue_init(&wq->wait);
+    wq->worker = kthread_create(name, worker_thread, wq);
+    if (!wq->worker) {
+        free(wq);
+        return NULL;
+    }
+    return wq;
+}
+
+// Creates the shared queue.
+void workqueue_init() {
+    system_wq = workqueue_create("events");
+    if (!system_wq) {
+        qemu_debug_string("WORKQUEUE: Could not create the system work queue.\n");
+    }
+}
+
+// Fills in a work item.
+void work_init(work_t* work, void (*fn)(void* data), void* data) {
+    work->fn = fn;
+    work->data = data;
+    work->pending = false;
+    work->next = NULL;
+}
+
+// Appends a work item to a queue.
+bool queue_work(workqueue_t* wq, work_t* work) {
+    uint32_t flags = irq_save();
+    if (work->pending) {
+        irq_restore(flags);
+        return false;
+    }
+
+    work->pending = true;
+    work->next = NULL;
+    if (wq->tail) {
+        wq->tail->next = work;
+    } else {
+        wq->head = work;
+    }
+    wq->tail = work;
+
+    irq_restore(flags);
+    wake_up(&wq->wait);
+    return true;
+}
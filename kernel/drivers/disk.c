@@ -3,11 +3,27 @@
 #include <kernel/disk.h>
 #include <kernel/io.h> // for port_word_in
 #include <kernel/string.h> // memcpy
+#include <kernel/cpu/spinlock.h>
+
+// ATA status register bits.
+#define ATA_STATUS_ERR 0x01
+#define ATA_STATUS_DRQ 0x08
+#define ATA_STATUS_BSY 0x80
+
+// ATA commands.
+#define ATA_CMD_READ        0x20
+#define ATA_CMD_WRITE       0x30
+#define ATA_CMD_CACHE_FLUSH 0xE7
+#define ATA_CMD_IDENTIFY    0xEC
 
 // This label is defined in our new dma_buffer.asm file.
 // The linker will guarantee it's at a valid, DMA-safe physical address.
 extern uint8_t dma_buffer[];
 
+// One command at a time on the channel. The page fault handler may use the
+// disk for swap, so it is taken with interrupts disabled.
+static spinlock_t disk_lock = SPINLOCK_INIT;
+
 // A more robust helper function to wait for the disk to be ready.
 static void wait_disk_ready() {
     // Wait until the controller is ready for a new command.
@@ -17,15 +33,39 @@ static void wait_disk_ready() {
     }
 }
 
-// This function is now updated to use the shared I/O buffer
-void read_disk_sector(uint32_t lba, uint8_t* buffer_out) {
+// Waits until the drive has a sector ready to transfer (or failed).
+static bool wait_disk_drq() {
+    while (1) {
+        uint8_t status = port_byte_in(0x1F7);
+        if (status & ATA_STATUS_BSY) {
+            continue;
+        }
+        if (status & ATA_STATUS_ERR) {
+            return false;
+        }
+        if (status & ATA_STATUS_DRQ) {
+            return true;
+        }
+    }
+}
+
+// Selects the drive and programs the LBA and sector count registers.
+// A count of 256 is sent as 0, which the drive reads as 256.
+static void disk_setup_transfer(uint32_t lba, uint32_t count, uint8_t command) {
     wait_disk_ready();
     port_byte_out(0x1F6, 0xE0 | ((lba >> 24) & 0x0F));
-    port_byte_out(0x1F2, 1);
+    port_byte_out(0x1F2, (uint8_t)count);
     port_byte_out(0x1F3, (uint8_t)lba);
     port_byte_out(0x1F4, (uint8_t)(lba >> 8));
     port_byte_out(0x1F5, (uint8_t)(lba >> 16));
-    port_byte_out(0x1F7, 0x20);
+    port_byte_out(0x1F7, command);
+}
+
+// This function is now updated to use the shared I/O buffer
+void read_disk_sector(uint32_t lba, uint8_t* buffer_out) {
+    unsigned int flags = spin_lock_irqsave(&disk_lock);
+
+    disk_setup_transfer(lba, 1, ATA_CMD_READ);
 
     wait_disk_ready();
 
@@ -36,4 +76,76 @@ void read_disk_sector(uint32_t lba, uint8_t* buffer_out) {
     
     // Now, copy the data from the safe buffer to the caller's virtual memory buffer.
     memcpy(buffer_out, dma_buffer, 512);
-}
\ No newline at end of file
+
+    spin_unlock_irqrestore(&disk_lock, flags);
+}
+
+// Reads several consecutive sectors straight into the caller's buffer (PIO).
+bool read_disk_sectors(uint32_t lba, uint32_t count, uint8_t* buffer_out) {
+    unsigned int flags = spin_lock_irqsave(&disk_lock);
+    bool ok = true;
+
+    disk_setup_transfer(lba, count, ATA_CMD_READ);
+    for (uint32_t s = 0; s < count && ok; s++) {
+        ok = wait_disk_drq();
+        uint16_t* words = (uint16_t*)(buffer_out + s * DISK_SECTOR_SIZE);
+        for (int i = 0; ok && i < 256; i++) {
+            words[i] = port_word_in(0x1F0);
+        }
+    }
+
+    spin_unlock_irqrestore(&disk_lock, flags);
+    return ok;
+}
+
+// Writes several consecutive sectors from the caller's buffer (PIO).
+bool write_disk_sectors(uint32_t lba, uint32_t count, const uint8_t* buffer) {
+    unsigned int flags = spin_lock_irqsave(&disk_lock);
+    bool ok = true;
+
+    disk_setup_transfer(lba, count, ATA_CMD_WRITE);
+    for (uint32_t s = 0; s < count && ok; s++) {
+        ok = wait_disk_drq();
+        const uint16_t* words = (const uint16_t*)(buffer + s * DISK_SECTOR_SIZE);
+        for (int i = 0; ok && i < 256; i++) {
+            port_word_out(0x1F0, words[i]);
+        }
+    }
+
+    // Make sure the data has reached the disk before we drop our copy.
+    if (ok) {
+        wait_disk_ready();
+        port_byte_out(0x1F7, ATA_CMD_CACHE_FLUSH);
+        wait_disk_ready();
+    }
+
+    spin_unlock_irqrestore(&disk_lock, flags);
+    return ok;
+}
+
+// Asks the drive for its size. Words 60-61 of the IDENTIFY data hold the
+// number of sectors addressable with 28-bit LBA.
+uint32_t disk_get_sector_count() {
+    unsigned int flags = spin_lock_irqsave(&disk_lock);
+    uint32_t sectors = 0;
+
+    wait_disk_ready();
+    port_byte_out(0x1F6, 0xA0);
+    port_byte_out(0x1F2, 0);
+    port_byte_out(0x1F3, 0);
+    port_byte_out(0x1F4, 0);
+    port_byte_out(0x1F5, 0);
+    port_byte_out(0x1F7, ATA_CMD_IDENTIFY);
+
+    // A status of 0 means there is no drive at all.
+    if (port_byte_in(0x1F7) != 0 && wait_disk_drq()) {
+        uint16_t* id = (uint16_t*)dma_buffer;
+        for (int i = 0; i < 256; i++) {
+            id[i] = port_word_in(0x1F0);
+        }
+        sectors = id[60] | ((uint32_t)id[61] << 16);
+    }
+
+    spin_unlock_irqrestore(&disk_lock, flags);
+    return sectors;
+}
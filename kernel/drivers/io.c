@@ -25,6 +25,11 @@ unsigned short port_word_in(unsigned short port) {
     return result;
 }
 
+// Writes a word to the specified I/O port.
+void port_word_out(unsigned short port, unsigned short data) {
+    __asm__ __volatile__("outw %0, %1" : : "a"(data), "Nd"(port));
+}
+
 /**
  * Remaps the PIC to use non-conflicting interrupt vectors.
  * @param offset1 Vector offset for master PIC (e.g., 0x20)
@@ -54,4 +59,22 @@ void pic_remap(int offset1, int offset2) {
     // Restore saved masks
     port_byte_out(PIC1_DATA, a1);
     port_byte_out(PIC2_DATA, a2);
+}
+
+// Lets an IRQ line through the PIC. Lines on the slave also need the cascade (IRQ 2).
+void pic_unmask_irq(unsigned char irq) {
+    if (irq >= 8) {
+        port_byte_out(PIC2_DATA, port_byte_in(PIC2_DATA) & ~(1 << (irq - 8)));
+        irq = 2;
+    }
+    port_byte_out(PIC1_DATA, port_byte_in(PIC1_DATA) & ~(1 << irq));
+}
+
+// Holds an IRQ line back at the PIC. The cascade is left alone.
+void pic_mask_irq(unsigned char irq) {
+    if (irq >= 8) {
+        port_byte_out(PIC2_DATA, port_byte_in(PIC2_DATA) | (1 << (irq - 8)));
+    } else {
+        port_byte_out(PIC1_DATA, port_byte_in(PIC1_DATA) | (1 << irq));
+    }
 }
\ No newline at end of file
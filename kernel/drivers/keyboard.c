@@ -5,6 +5,9 @@
 #include <kernel/io.h>
 #include <kernel/shell.h>
 #include <kernel/vga.h>
+#include <kernel/cpu/wait.h>
+
+extern volatile int multitasking_enabled;
 
 // New keyboard buffer
 #define KBD_BUFFER_SIZE 256
@@ -12,6 +15,9 @@ static char kbd_buffer[KBD_BUFFER_SIZE];
 static volatile uint32_t kbd_buffer_read_idx = 0;
 static volatile uint32_t kbd_buffer_write_idx = 0;
 
+// Tasks blocked in keyboard_read_char() until a key arrives.
+static wait_queue_t kbd_wait = WAIT_QUEUE_INIT;
+
 // --- State and Character Maps ---
 static volatile int shift_pressed = 0;
 
@@ -89,6 +95,9 @@ static void keyboard_handler(registers_t *r) {
             kbd_buffer[kbd_buffer_write_idx] = character;
             kbd_buffer_write_idx = (kbd_buffer_write_idx + 1) % KBD_BUFFER_SIZE;
         }
+
+        // Wake up whoever is waiting for a key.
+        wake_up(&kbd_wait);
     }
 }
 
@@ -102,9 +111,19 @@ void keyboard_install() {
 char keyboard_read_char() {
     // Wait for a character to be available
     while (kbd_buffer_read_idx == kbd_buffer_write_idx) {
-        // Atomically enable interrupts and then halt.
-        // The CPU will wait here until the next interrupt (e.g., a keypress).
-        __asm__ __volatile__("sti\n\thlt");
+        if (!multitasking_enabled) {
+            // Atomically enable interrupts and then halt.
+            // The CPU will wait here until the next interrupt (e.g., a keypress).
+            __asm__ __volatile__("sti\n\thlt");
+            continue;
+        }
+
+        // Block until the keyboard handler wakes us, so the scheduler sees
+        // the task as interactive instead of charging it for the wait.
+        wait_event_interruptible(&kbd_wait, kbd_buffer_read_idx != kbd_buffer_write_idx);
+        if (kbd_buffer_read_idx == kbd_buffer_write_idx) {
+            return 0; // A signal came first
+        }
     }
 
     // Read the character from the buffer
@@ -113,6 +132,10 @@ char keyboard_read_char() {
     return c;
 }
 
+bool keyboard_has_char() {
+    return kbd_buffer_read_idx != kbd_buffer_write_idx;
+}
+
 // Clears the keyboard buffer by resetting the read/write pointers.
 void keyboard_flush() {
     // This is an atomic operation on x86, so it's safe.
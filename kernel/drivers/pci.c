@@ -13,6 +13,9 @@
 // Define for the notification area's virtual address.
 #define VIRTIO_SND_NOTIFY_VIRT_ADDR 0xE0001000
 
+// And for the ISR status register.
+#define VIRTIO_SND_ISR_VIRT_ADDR 0xE0002000
+
 // Define a safe virtual address for temporary mappings.
 #define TEMP_VIRTIO_MAP_ADDR 0xFFBFC000
 
@@ -111,6 +114,18 @@ void pci_scan() {
 
                         // Pass the config pointer, the notification base VIRTUAL address, and the multiplier.
                         virtio_sound_init(cfg, (void*)VIRTIO_SND_NOTIFY_VIRT_ADDR, multiplier);
+
+                        // With the ISR register and the legacy interrupt line, commands
+                        // wait for the device's interrupt instead of polling.
+                        virtio_pci_cap_t isr_cap;
+                        uint8_t irq = pci_config_read_byte(bus, slot, 0, 0x3C); // Interrupt Line
+                        if (irq < 16 && pci_find_capability(bus, slot, 0, VIRTIO_PCI_CAP_ISR_CFG, &isr_cap)) {
+                            uint32_t isr_bar_val = pci_config_read_word(bus, slot, 0, 0x10 + (isr_cap.bar * 4));
+                            uint32_t isr_phys_addr = (isr_bar_val & ~0xF) + isr_cap.offset;
+                            paging_map_page(kernel_directory, VIRTIO_SND_ISR_VIRT_ADDR, isr_phys_addr & ~0xFFF, PAGING_FLAG_PRESENT | PAGING_FLAG_RW | PAGING_FLAG_CACHE_DISABLE);
+                            virtio_sound_enable_irq(irq, (volatile uint8_t*)(VIRTIO_SND_ISR_VIRT_ADDR + (isr_phys_addr & 0xFFF)));
+                            print_string("    Using IRQ "); print_dec(irq); print_string(".\n");
+                        }
                     } else {
                         print_string("    ERROR: Could not find Notification capability!\n");
                     }
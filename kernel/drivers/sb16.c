@@ -4,10 +4,12 @@
 #include <kernel/io.h>
 #include <kernel/vga.h> // For printing status messages
 #include <kernel/pmm.h>           // For pmm_alloc_frame()
+#include <kernel/paging.h>        // For PHYS_TO_VIRT
 #include <kernel/drivers/dma.h>   // For our new DMA functions
 #include <kernel/timer.h> // For sleep()
 
 static uint8_t* dma_buffer = NULL; // A place to store our DMA buffer address
+static uint32_t dma_buffer_phys;   // The same buffer as the DMA controller sees it
 
 // Helper function to write a command/data to the DSP
 static void sb16_dsp_write(uint8_t value) {
@@ -63,14 +65,15 @@ void sb16_init() {
         print_string("  Mixer volume set to maximum.\n");
 
         // Allocate a 4KB page-aligned buffer from low memory for DMA
-        dma_buffer = (uint8_t*)pmm_alloc_frame();
+        dma_buffer_phys = (uint32_t)pmm_alloc_frame();
+        dma_buffer = (uint8_t*)PHYS_TO_VIRT(dma_buffer_phys);
         print_string("  DMA buffer allocated at physical address: ");
-        print_hex((uint32_t)dma_buffer);
+        print_hex(dma_buffer_phys);
         print_string("\n");
 
         // Prepare DMA Channel 1 for an 8-bit, single-cycle transfer
         // 0x48 = Single Cycle, Auto-initialize, Write transfer (to device)
-        dma_prepare_transfer(1, 0x48, (uint32_t)dma_buffer, PMM_FRAME_SIZE);
+        dma_prepare_transfer(1, 0x48, dma_buffer_phys, PMM_FRAME_SIZE);
         print_string("  DMA channel 1 programmed for transfer.\n");
 
     } else {
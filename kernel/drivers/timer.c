@@ -5,62 +5,331 @@
 #include <kernel/io.h>
 #include <kernel/vga.h>         // For printing output
 #include <kernel/cpu/process.h> // schedule()
+#include <kernel/cpu/sched.h>   // sched_wake(), sched_tick()
+#include <kernel/cpu/lapic.h>   // The APIC timer, for long idle periods
 #include <kernel/debug.h>       // For debug printing
 
 // Make the global flag visible to this file
 extern volatile int multitasking_enabled;
 
-// Make the globally defined current_task pointer visible to this file.
-extern task_struct_t* current_task;
-
-// Make the process table visible
-extern task_struct_t process_table[MAX_PROCESSES];
-
 static volatile uint32_t tick = 0;
 
 // We will keep track of the currently playing frequency.
 static uint32_t current_frequency = 0;
 
-// This new assembly function will perform the actual context switch.
-// It is defined in the new switch.asm file.
-extern void task_switch(registers_t* r);
+// Number of ticks the pending one-shot interrupt stands for, 0 while the
+// PIT is in its normal periodic mode.
+static uint32_t oneshot_ticks = 0;
 
-// The handler that is called on every timer interrupt (IRQ 0).
-static void timer_handler(registers_t *r) {
-    tick++;
-
-    // Check for any tasks that need to be woken up.
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].state == TASK_STATE_SLEEPING && tick >= process_table[i].wakeup_time) {
-            // DEBUG: Print status of sleeping tasks once per second
-            if (tick % 100 == 0) {
-                qemu_debug_string("TIMER: Checking sleeping PID ");
-                qemu_debug_dec(i);
-                qemu_debug_string(". Tick=");
-                qemu_debug_dec(tick);
-                qemu_debug_string(", WakeupAt=");
-                qemu_debug_dec(process_table[i].wakeup_time);
-                qemu_debug_string("\n");
-            }
+// Set while the one-shot is the APIC timer's, with the PIT stopped.
+static bool oneshot_lapic = false;
+
+// Set when the stopped PIT left an interrupt waiting in the PIC. It comes
+// in once IRQ 0 is let through again, and is not a tick.
+static bool pit_stale_irq = false;
+static timer_stats_t timer_stats;
+
+// Hashed timer wheel: a timer lives in bucket (expires % TIMER_WHEEL_SIZE).
+// Each tick only looks at one bucket, so its cost does not depend on how
+// many tasks exist or sleep.
+static kernel_timer_t* timer_wheel[TIMER_WHEEL_SIZE];
+
+// Links a timer into the bucket for its expiry tick.
+static void timer_wheel_insert(kernel_timer_t* timer) {
+    // A timer that is already due goes into the next tick's bucket.
+    uint32_t slot = ((int32_t)(timer->expires - tick) > 0) ? timer->expires : tick + 1;
+    kernel_timer_t** bucket = &timer_wheel[slot & (TIMER_WHEEL_SIZE - 1)];
+
+    timer->next = *bucket;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = bucket;
+    *bucket = timer;
+}
+
+// Unlinks a timer from whatever list it is on.
+static void timer_wheel_remove(kernel_timer_t* timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+// Runs the callbacks of every timer in the current bucket that is due.
+// Timers that belong to a later round of the wheel stay where they are.
+static void timer_run_expired() {
+    kernel_timer_t** bucket = &timer_wheel[tick & (TIMER_WHEEL_SIZE - 1)];
+
+    // Detach the bucket first. Callbacks may add or cancel timers, and the
+    // pprev links keep the detached list consistent while they do.
+    kernel_timer_t* pending = *bucket;
+    *bucket = NULL;
+    if (pending) {
+        pending->pprev = &pending;
+    }
+
+    while (pending) {
+        kernel_timer_t* timer = pending;
+        timer_wheel_remove(timer);
+        if ((int32_t)(timer->expires - tick) > 0) {
+            timer_wheel_insert(timer);
+        } else {
+            timer->callback(timer->data);
+        }
+    }
+}
+
+// Arms (or re-arms) a timer.
+void timer_add(kernel_timer_t* timer, uint32_t expires, timer_callback_t callback, void* data) {
+    uint32_t flags = irq_save();
+    if (timer->pprev) {
+        timer_wheel_remove(timer);
+    }
+    timer->expires = expires;
+    timer->callback = callback;
+    timer->data = data;
+    timer_wheel_insert(timer);
+
+    // The boot CPU may be halted with the tick stopped until some later
+    // timer. Wake it so it looks at the wheel again.
+    if (oneshot_ticks && this_cpu()->id != 0) {
+        smp_send_resched(&cpus[0]);
+    }
+    irq_restore(flags);
+}
 
-            // The actual wake-up check
-            if (tick >= process_table[i].wakeup_time) {
-                qemu_debug_string("TIMER: Waking up PID ");
-                qemu_debug_dec(i);
-                qemu_debug_string(" at tick ");
-                qemu_debug_dec(tick);
-                qemu_debug_string("!\n");
+// Disarms a timer.
+bool timer_cancel(kernel_timer_t* timer) {
+    uint32_t flags = irq_save();
+    bool armed = timer->pprev != NULL;
+    if (armed) {
+        timer_wheel_remove(timer);
+    }
+    irq_restore(flags);
+    return armed;
+}
+
+// PIT command bytes for channel 0, lo/hi byte access.
+#define PIT_CMD_ONESHOT  0x30 // Mode 0: interrupt on terminal count
+#define PIT_CMD_PERIODIC 0x34 // Mode 2: rate generator
+#define PIT_CMD_LATCH    0x00 // Latch the current count for reading
+
+// Loads a new mode and count into PIT channel 0. The count starts over right away.
+static void pit_program(uint8_t command, uint16_t count) {
+    port_byte_out(0x43, command);
+    port_byte_out(0x40, (uint8_t)(count & 0xFF));
+    port_byte_out(0x40, (uint8_t)((count >> 8) & 0xFF));
+}
+
+// Reads how many PIT clocks are left before channel 0 fires.
+static uint16_t pit_read_count() {
+    port_byte_out(0x43, PIT_CMD_LATCH);
+    uint8_t lo = port_byte_in(0x40);
+    uint8_t hi = port_byte_in(0x40);
+    return (uint16_t)((hi << 8) | lo);
+}
+
+// The timer vector is also raised with 'int $0x20' to yield the CPU. Only a
+// real IRQ 0 shows up in the master PIC's in-service register.
+static bool timer_irq_in_service() {
+    port_byte_out(0x20, 0x0B); // OCW3: read the ISR on the next read
+    return port_byte_in(0x20) & 0x01;
+}
+
+// Is an IRQ 0 waiting in the master PIC, not delivered yet?
+static bool timer_irq_pending() {
+    port_byte_out(0x20, 0x0A); // OCW3: read the IRR on the next read
+    return port_byte_in(0x20) & 0x01;
+}
+
+// Moves time forward by 'ticks', running the timers of every tick on the way.
+static void timer_advance(uint32_t ticks) {
+    for (uint32_t i = 0; i < ticks; i++) {
+        tick++;
+        timer_run_expired();
+    }
+}
+
+// Looks for the nearest armed timer within 'limit' ticks. Returns the number
+// of ticks until it is due, or 'limit' if there is none that close.
+static uint32_t timer_next_due(uint32_t limit) {
+    uint32_t near = limit < TIMER_WHEEL_SIZE ? limit : TIMER_WHEEL_SIZE;
+    for (uint32_t delta = 1; delta < near; delta++) {
+        for (kernel_timer_t* t = timer_wheel[(tick + delta) & (TIMER_WHEEL_SIZE - 1)]; t; t = t->next) {
+            if ((int32_t)(t->expires - (tick + delta)) <= 0) {
+                return delta;
+            }
+        }
+    }
+    if (near == limit) {
+        return limit;
+    }
 
-                process_table[i].state = TASK_STATE_RUNNING;
+    // Nothing within one turn of the wheel. Whatever is armed is further
+    // out, in any bucket, so look at them all once.
+    uint32_t next = limit;
+    for (int i = 0; i < TIMER_WHEEL_SIZE; i++) {
+        for (kernel_timer_t* t = timer_wheel[i]; t; t = t->next) {
+            uint32_t delta = t->expires - tick;
+            if ((int32_t)delta <= 0) {
+                return 1;
+            }
+            if (delta < next) {
+                next = delta;
             }
         }
     }
+    return next;
+}
+
+// Stops the periodic tick while the idle task halts.
+void timer_idle_enter() {
+    if (oneshot_ticks) {
+        return;
+    }
+    // The APIC timer's 32 bits reach much further than the PIT's 16.
+    uint32_t per_tick = lapic_timer_counts_per_tick();
+    uint32_t limit = per_tick ? 0xFFFFFFFF / per_tick - 1 : 0;
+    if (limit < TIMER_MAX_IDLE_TICKS) {
+        limit = TIMER_MAX_IDLE_TICKS;
+    }
+    uint32_t ticks = timer_next_due(limit);
+    if (ticks <= 1) {
+        return; // The next tick is needed anyway.
+    }
+
+    // The rate generator counts down linearly, so the count tells us how far
+    // we are into the current tick. Fire exactly on a later tick boundary.
+    uint16_t left = pit_read_count();
+    if (left == 0 || left > PIT_TICK_COUNT) {
+        left = PIT_TICK_COUNT;
+    }
+    if (ticks <= TIMER_MAX_IDLE_TICKS) {
+        pit_program(PIT_CMD_ONESHOT, left + (ticks - 1) * PIT_TICK_COUNT);
+    } else {
+        // Masking IRQ 0 would hide a tick that is already waiting.
+        if (timer_irq_pending()) {
+            return;
+        }
+        // A mode command without a count stops the PIT until the next one.
+        port_byte_out(0x43, PIT_CMD_ONESHOT);
+        pic_mask_irq(0);
+        lapic_timer_oneshot(left * (per_tick / PIT_TICK_COUNT) + (ticks - 1) * per_tick);
+        oneshot_lapic = true;
+    }
+    oneshot_ticks = ticks;
+    timer_stats.idle_entries++;
+}
+
+// Catches up after the idle task was woken by some other interrupt.
+void timer_idle_exit() {
+    if (oneshot_ticks <= 1) {
+        return; // Periodic mode, or the one-shot only covers the current tick.
+    }
+
+    if (oneshot_lapic) {
+        // The same as below, in APIC timer counts.
+        uint32_t per_tick = lapic_timer_counts_per_tick();
+        uint32_t left = lapic_timer_remaining();
+        if (left == 0 || left > oneshot_ticks * per_tick) {
+            return;
+        }
+        uint32_t ticks_left = (left + per_tick - 1) / per_tick;
+        uint32_t passed = oneshot_ticks - ticks_left;
+        timer_advance(passed);
+        timer_stats.ticks_skipped += passed;
+
+        lapic_timer_oneshot(left - (ticks_left - 1) * per_tick);
+        oneshot_ticks = 1;
+        return;
+    }
+
+    uint16_t left = pit_read_count();
+    if (left == 0 || left > oneshot_ticks * PIT_TICK_COUNT) {
+        return; // The one-shot is firing right now; its interrupt does the accounting.
+    }
+
+    // Account for the whole ticks that have passed, then let the one-shot run
+    // to the end of the current tick. Its interrupt restores periodic mode.
+    uint32_t ticks_left = (left + PIT_TICK_COUNT - 1) / PIT_TICK_COUNT;
+    uint32_t passed = oneshot_ticks - ticks_left;
+    timer_advance(passed);
+    timer_stats.ticks_skipped += passed;
+
+    pit_program(PIT_CMD_ONESHOT, left - (ticks_left - 1) * PIT_TICK_COUNT);
+    oneshot_ticks = 1;
+}
+
+// Returns the timer interrupt statistics.
+const timer_stats_t* timer_get_stats() {
+    return &timer_stats;
+}
+
+// Timer callback that wakes a task from sleep().
+static void sleep_timer_expired(void* data) {
+    task_struct_t* task = (task_struct_t*)data;
+    if (task->state == TASK_STATE_SLEEPING) {
+        sched_wake(task);
+    }
+}
+
+// Ends an idle one-shot and goes back to the periodic tick, so the next
+// one is on time. Returns the number of ticks the one-shot stood for.
+static uint32_t timer_oneshot_end() {
+    uint32_t ticks = oneshot_ticks;
+    oneshot_ticks = 0;
+    pit_program(PIT_CMD_PERIODIC, PIT_TICK_COUNT);
+    if (oneshot_lapic) {
+        oneshot_lapic = false;
+        lapic_timer_oneshot(0);
+        pit_stale_irq = timer_irq_pending();
+        pic_unmask_irq(0);
+    }
+    timer_stats.ticks_skipped += ticks - 1;
+    return ticks;
+}
+
+// Moves time on by 'ticks' and charges the tick to whoever was running.
+static void timer_tick(uint32_t ticks, bool user) {
+    timer_stats.interrupts++;
+
+    // Wake up the tasks (and run the kernel timers) that are due now.
+    timer_advance(ticks);
+
+    if (multitasking_enabled) {
+        sched_tick(current_task, user);
+    }
+}
+
+void timer_idle_interrupt(bool user) {
+    if (oneshot_lapic) {
+        timer_tick(timer_oneshot_end(), user);
+    }
+}
+
+// The handler that is called on every timer interrupt (IRQ 0).
+static void timer_handler(registers_t *r) {
+    // A software yield only asks for a reschedule, no time has passed. Only
+    // the boot CPU gets IRQ 0; on the others, this is always a yield.
+    if (this_cpu()->id == 0 && timer_irq_in_service()) {
+        // The end of an idle one-shot stands for several ticks.
+        if (pit_stale_irq) {
+            pit_stale_irq = false;
+        } else {
+            timer_tick(oneshot_ticks ? timer_oneshot_end() : 1, (r->cs & 3) == 3);
+        }
+
+        // Acknowledge the tick before switching. The next task does not return
+        // through irq_handler() until it is switched away from, or at all if it is new.
+        port_byte_out(0x20, 0x20);
+    }
 
     // Only call the scheduler if multitasking has officially started!
     if (multitasking_enabled) {
-        // The C handler's only job is to call the assembly switcher.
-        // qemu_debug_string("timer_handler: Fired. Calling task_switch...\n");
-        task_switch(r); // On every timer tick, switch tasks!
+        schedule();
     }
 }
 
@@ -69,17 +338,10 @@ void timer_install() {
     // Install the handler for IRQ 0
     irq_install_handler(0, timer_handler);
 
-    //  Configure the PIT
-    uint32_t frequency = 100; // Target frequency in Hz
-    uint32_t divisor = 1193180 / frequency;
-
-    // Send the command byte to the PIT command port.
-    // Command 0x36 means: Channel 0, Access lo/hi, Mode 3 (square wave).
-    port_byte_out(0x43, 0x36);
-
-    // Send the frequency divisor, low byte then high byte.
-    port_byte_out(0x40, (uint8_t)(divisor & 0xFF));
-    port_byte_out(0x40, (uint8_t)((divisor >> 8) & 0xFF));
+    // Configure the PIT to fire TIMER_HZ times a second.
+    // Mode 2 (rate generator) rather than a square wave, because its count
+    // goes down linearly, which lets the idle code tell where in a tick it is.
+    pit_program(PIT_CMD_PERIODIC, PIT_TICK_COUNT);
 }
 
 // tick getter func
@@ -104,6 +366,13 @@ void delay_ms(uint32_t milliseconds) {
 
 // Puts the current task to sleep for a specified number of milliseconds.
 void sleep(uint32_t milliseconds) {
+    // Without the scheduler there is nobody to switch to, so just wait.
+    if (!multitasking_enabled) {
+        delay_ms(milliseconds);
+        return;
+    }
+
+    uint32_t flags = irq_save();
     uint32_t start_tick = timer_get_ticks();
     // Our timer is at 100Hz, so 1 tick happens every 10ms.
     uint32_t ticks_to_wait = milliseconds / 10;
@@ -113,9 +382,11 @@ void sleep(uint32_t milliseconds) {
         ticks_to_wait = 1;
     }
 
-    // Set the state and wakeup time on the current task's PCB.
+    // Set the state and wakeup time on the current task's PCB, and arm its
+    // timer. The timer wheel wakes it, so nothing scans for sleepers.
     current_task->state = TASK_STATE_SLEEPING;
     current_task->wakeup_time = start_tick + ticks_to_wait;
+    timer_add(&current_task->sleep_timer, current_task->wakeup_time, sleep_timer_expired, current_task);
 
     qemu_debug_string("sleep: PID ");
     qemu_debug_hex(current_task->pid);
@@ -123,9 +394,12 @@ void sleep(uint32_t milliseconds) {
     qemu_debug_hex(current_task->wakeup_time);
     qemu_debug_string(".\n");
 
-    // Atomically enable interrupts and then halt.
-    // This allows the timer interrupt to wake the CPU from its halted state.
-    __asm__ __volatile__("sti\n\thlt");
+    // Give up the CPU. We come back here once the timer has woken us, or
+    // earlier if a signal did. Then the timer is still armed and must go,
+    // or it would fire into a later sleep or a freed task struct.
+    __asm__ __volatile__("int $0x20");
+    timer_cancel(&current_task->sleep_timer);
+    irq_restore(flags);
 }
 
 // PC SPEAKER CODE
@@ -4,6 +4,8 @@
 #include <kernel/io.h>
 #include <kernel/types.h>
 #include <kernel/shell.h>
+#include <kernel/paging.h> // For KERNEL_VIRT_BASE
+#include <kernel/cpu/spinlock.h>
 
 // screen dimensions as constants
 #define VGA_WIDTH 80
@@ -13,18 +15,23 @@
 static int cursor_row = 0;
 static int cursor_col = 0;
 
+// Covers the cursor and the text buffer. Interrupt handlers print too, so
+// it is taken with interrupts disabled, one character at a time.
+static spinlock_t console_lock = SPINLOCK_INIT;
+
 // Define the VGA buffer as a global, constant pointer to a volatile memory region.
-volatile unsigned short* const VGA_BUFFER = (unsigned short*)0xB8000;
+volatile unsigned short* const VGA_BUFFER = (unsigned short*)(KERNEL_VIRT_BASE + 0xB8000);
 
 // Clear the screen by filling it with spaces
 void clear_screen() {
-    int i;
+    uint32_t flags = spin_lock_irqsave(&console_lock);
     for (int i = 0; i < 80 * 25; i++) {
         VGA_BUFFER[i] = (unsigned short)' ' | 0x0F00;
     }
     cursor_row = 0;
     cursor_col = 0;
     update_cursor(cursor_row, cursor_col);
+    spin_unlock_irqrestore(&console_lock, flags);
 }
 
 // Updates the VGA cursor's position.
@@ -59,8 +66,8 @@ void print_char_color(char c, uint8_t color) {
 }
 
 void print_char(char c) {
-    // Disable interrupts to prevent a task switch during this function.
-    __asm__ __volatile__("cli");
+    // Keeps other CPUs and our own interrupt handlers off the cursor.
+    uint32_t flags = spin_lock_irqsave(&console_lock);
 
     // Handle backspace
     if (c == '\b') {
@@ -110,8 +117,7 @@ void print_char(char c) {
     // Update the hardware cursor's position.
     update_cursor(cursor_row, cursor_col);
 
-    // Re-enable interrupts now that we are done.
-    __asm__ __volatile__("sti");
+    spin_unlock_irqrestore(&console_lock, flags);
 }
 
 void print_string(const char* str) {
@@ -182,7 +188,9 @@ int vga_get_cursor_col() {
 
 // Sets the cursor position from a logical row and column.
 void vga_set_cursor_pos(int row, int col) {
+    uint32_t flags = spin_lock_irqsave(&console_lock);
     cursor_row = row;
     cursor_col = col;
     update_cursor(cursor_row, cursor_col);
+    spin_unlock_irqrestore(&console_lock, flags);
 }
\ No newline at end of file
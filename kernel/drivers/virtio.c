@@ -6,6 +6,11 @@
 #include <kernel/memory.h> // For malloc
 #include <kernel/timer.h> // For sleep()
 #include <kernel/string.h> // for memcpy
+#include <kernel/irq.h>    // For irq_install_handler
+#include <kernel/io.h>     // For pic_unmask_irq
+#include <kernel/cpu/wait.h>
+
+extern volatile int multitasking_enabled;
 
 // Forward-declare our new static function before it's used.
 static void virtq_send_buffer(uint16_t q_idx, void* data, uint32_t len);
@@ -35,7 +40,14 @@ static virtqueue_info_t queues[VIRTIO_SND_MAX_QUEUES];
 static virtio_pci_common_cfg_t* virtio_sound_cfg;
 static uint32_t notify_off_multiplier; // Global to store the multiplier
 
-// A static, page-aligned buffer for DMA. Its virtual address will equal its physical address.
+// The ISR status register, once the interrupt is set up. Until then
+// (e.g. while the driver starts up during boot), completions are polled.
+static volatile uint8_t* virtio_isr = NULL;
+
+// Tasks waiting in virtq_send_command_sync() for the device to use a buffer.
+static wait_queue_t virtq_wait = WAIT_QUEUE_INIT;
+
+// A static, page-aligned buffer for DMA. The device is given its physical address (VIRT_TO_PHYS).
 static uint8_t dma_buffer[4096] __attribute__((aligned(4096)));
 
 // Helper to notify the device that a queue has new buffers.
@@ -55,7 +67,7 @@ static void virtq_send_command_sync(uint16_t q_idx, void* cmd, uint32_t cmd_size
     // Copy the command from its virtual stack address into our safe physical buffer.
     memcpy(dma_buffer, cmd, cmd_size);
     // The device will write the response right after the command data.
-    void* dma_resp_phys_addr = dma_buffer + cmd_size;
+    void* dma_resp = dma_buffer + cmd_size;
 
     virtqueue_info_t* q = &queues[q_idx];
 
@@ -64,13 +76,13 @@ static void virtq_send_command_sync(uint16_t q_idx, void* cmd, uint32_t cmd_size
     uint16_t resp_idx = (head_idx + 1) % q->size;
     
     // Setup Descriptor 1: The Command (Driver -> Device)
-    q->desc_table[head_idx].addr = (uint64_t)dma_buffer; // Use the PHYSICAL address of our DMA buffer.
+    q->desc_table[head_idx].addr = (uint64_t)VIRT_TO_PHYS(dma_buffer); // Use the PHYSICAL address of our DMA buffer.
     q->desc_table[head_idx].len = cmd_size;
     q->desc_table[head_idx].flags = VIRTQ_DESC_F_NEXT; // Link to the response buffer descriptor
     q->desc_table[head_idx].next = resp_idx;
 
     // Setup Descriptor 2: The Response (Device -> Driver)
-    q->desc_table[resp_idx].addr = (uint64_t)dma_resp_phys_addr; //  Use the PHYSICAL address for the response part of the buffer.
+    q->desc_table[resp_idx].addr = (uint64_t)VIRT_TO_PHYS(dma_resp); //  Use the PHYSICAL address for the response part of the buffer.
     q->desc_table[resp_idx].len = resp_size;
     q->desc_table[resp_idx].flags = VIRTQ_DESC_F_WRITE; // Device will WRITE to this buffer
     q->desc_table[resp_idx].next = 0;
@@ -85,17 +97,37 @@ static void virtq_send_command_sync(uint16_t q_idx, void* cmd, uint32_t cmd_size
     q->next_avail_idx = (resp_idx + 1) % q->size;
     notify_queue(q_idx);
 
-    // Wait for the device to finish
+    // Wait for the device to finish. The interrupt handler wakes us when
+    // it has used the buffers.
+    if (virtio_isr && multitasking_enabled) {
+        wait_event(&virtq_wait, q->last_used_idx != q->used_ring->idx);
+    }
     while (q->last_used_idx == q->used_ring->idx) {
-        // In a real driver, we'd use interrupts. For now, polling with a small
-        // delay is simple and effective.
+        // No interrupt yet: poll, with a small delay.
         sleep(1); 
     }
     // "Consume" the used ring entry by incrementing our counter.
     q->last_used_idx++;
 
     // Copy the response from the safe physical buffer back to the caller's virtual stack address.
-    memcpy(resp, dma_resp_phys_addr, resp_size);
+    memcpy(resp, dma_resp, resp_size);
+}
+
+// Bit 0 of the ISR status: a queue has used buffers.
+#define VIRTIO_ISR_QUEUE 0x1
+
+static void virtio_irq_handler(registers_t* r) {
+    (void)r;
+    // Reading the register acknowledges the (level-triggered) interrupt.
+    if (*virtio_isr & VIRTIO_ISR_QUEUE) {
+        wake_up(&virtq_wait);
+    }
+}
+
+void virtio_sound_enable_irq(uint8_t irq, volatile uint8_t* isr) {
+    virtio_isr = isr;
+    irq_install_handler(irq, virtio_irq_handler);
+    pic_unmask_irq(irq);
 }
 
 // Initializes the virtio-sound driver.
@@ -108,11 +140,10 @@ void virtio_sound_init(virtio_pci_common_cfg_t* cfg, void* notify_base, uint32_t
     notify_base_addr = notify_base; // Store the notification base virtual address
     notify_off_multiplier = multiplier; // Store the multiplier for later use.
 
-    // The DMA buffer is in identity-mapped low memory, so its virtual address equals
-    // its physical address. We remap this page with the cache disable flag to
-    // ensure the hardware sees our CPU's writes.
+    // The DMA buffer is part of the kernel image in the direct map. We remap its
+    // page with the cache disable flag to ensure the hardware sees our CPU's writes.
     uint32_t dma_addr = (uint32_t)dma_buffer;
-    paging_map_page(kernel_directory, dma_addr, dma_addr, PAGING_FLAG_PRESENT | PAGING_FLAG_RW | PAGING_FLAG_CACHE_DISABLE);
+    paging_map_page(kernel_directory, dma_addr, VIRT_TO_PHYS(dma_addr), PAGING_FLAG_PRESENT | PAGING_FLAG_RW | PAGING_FLAG_CACHE_DISABLE);
 
     // Virtio Initialization Sequence
     // Reset the device by writing 0 to the status register.
@@ -190,9 +221,9 @@ void virtio_sound_init(virtio_pci_common_cfg_t* cfg, void* notify_base, uint32_t
     print_string("    Virtqueue memory allocated.\n");
 
     // Tell the device the physical addresses of these memory regions.
-    queues[0].desc_table = (struct virtq_desc*)q0_desc;
-    queues[0].avail_ring = (struct virtq_avail*)q0_avail;
-    queues[0].used_ring  = (struct virtq_used*)q0_used;
+    queues[0].desc_table = (struct virtq_desc*)PHYS_TO_VIRT(q0_desc);
+    queues[0].avail_ring = (struct virtq_avail*)PHYS_TO_VIRT(q0_avail);
+    queues[0].used_ring  = (struct virtq_used*)PHYS_TO_VIRT(q0_used);
     queues[0].size = q0_size;
     queues[0].last_used_idx = 0;
     queues[0].next_avail_idx = 0;
@@ -215,9 +246,9 @@ void virtio_sound_init(virtio_pci_common_cfg_t* cfg, void* notify_base, uint32_t
     void* q2_desc = pmm_alloc_frame();
     void* q2_avail = pmm_alloc_frame();
     void* q2_used = pmm_alloc_frame();
-    queues[2].desc_table = (struct virtq_desc*)q2_desc;
-    queues[2].avail_ring = (struct virtq_avail*)q2_avail;
-    queues[2].used_ring  = (struct virtq_used*)q2_used;
+    queues[2].desc_table = (struct virtq_desc*)PHYS_TO_VIRT(q2_desc);
+    queues[2].avail_ring = (struct virtq_avail*)PHYS_TO_VIRT(q2_avail);
+    queues[2].used_ring  = (struct virtq_used*)PHYS_TO_VIRT(q2_used);
     queues[2].size = q2_size;
     queues[2].last_used_idx = 0;
     queues[2].next_avail_idx = 0;
@@ -351,7 +382,7 @@ static void virtq_send_buffer(uint16_t q_idx, void* data, uint32_t len) {
     uint16_t head_idx = q->next_avail_idx;
 
     // --- Setup the single descriptor for our data buffer ---
-    q->desc_table[head_idx].addr = (uint64_t)(uint32_t)data;
+    q->desc_table[head_idx].addr = (uint64_t)VIRT_TO_PHYS(data);
     q->desc_table[head_idx].len = len;
     q->desc_table[head_idx].flags = 0; // No flags needed for a simple read-only buffer
     q->desc_table[head_idx].next = 0;
@@ -9,6 +9,7 @@
 #include <kernel/pmm.h>
 #include <kernel/paging.h>
 #include <kernel/debug.h>
+#include <kernel/cpu/spinlock.h>
 
 fat12_bpb_t* bpb; // make global
 static uint8_t* fat_buffer;
@@ -19,9 +20,14 @@ uint32_t root_directory_size; // global ie no static
 // This label is defined in dma_buffer.asm.
 extern uint8_t dma_buffer[];
 
+// Serializes lookups and file loads, which share the FAT and dma_buffer.
+// Loads take many disk commands, so interrupts stay enabled while it is held.
+static spinlock_t fs_lock = SPINLOCK_INIT;
+
 void init_fs() {
     // Read the BIOS Parameter Block (Sector 0) into a temporary buffer.
-    uint8_t* temp_buffer = (uint8_t*)pmm_alloc_frame();
+    void* temp_frame = pmm_alloc_frame();
+    uint8_t* temp_buffer = (uint8_t*)PHYS_TO_VIRT(temp_frame);
     read_disk_sector(0, temp_buffer);
 
     // Allocate a permanent, correctly-sized buffer for the BPB on the heap.
@@ -31,24 +37,16 @@ void init_fs() {
     memcpy(bpb, temp_buffer, sizeof(fat12_bpb_t));
 
     // Now that we've copied the data, we can safely free the temporary buffer.
-    pmm_free_frame(temp_buffer);
+    pmm_free_frame(temp_frame);
 
     // --- FAT BUFFER SETUP ---
     // Calculate the size and number of pages needed for the FAT.
     uint32_t fat_size_bytes = bpb->sectors_per_fat * bpb->bytes_per_sector;
     uint32_t fat_pages_needed = (fat_size_bytes + PMM_FRAME_SIZE - 1) / PMM_FRAME_SIZE;
 
-    // Define a virtual start address for our FAT buffer. Let's use 3MB,
-    // which is safely within our initial 4MB identity map.
-    uint32_t fat_virt_addr = 0x300000;
-    fat_buffer = (uint8_t*)fat_virt_addr;
+    // The FAT lives on the kernel heap, which is mapped in every address space.
+    fat_buffer = (uint8_t*)malloc(fat_pages_needed * PMM_FRAME_SIZE);
 
-    // Allocate physical pages and map them to our contiguous virtual space.
-    for (uint32_t i = 0; i < fat_pages_needed; i++) {
-        void* phys_frame = pmm_alloc_frame();
-        paging_map_page(kernel_directory, fat_virt_addr + (i * PMM_FRAME_SIZE), (uint32_t)phys_frame, PAGING_FLAG_PRESENT | PAGING_FLAG_RW);
-    }
-    
     // Now we can safely read the entire FAT into the virtual buffer.
     for (uint32_t i = 0; i < bpb->sectors_per_fat; i++) {
         read_disk_sector(bpb->reserved_sectors + i, fat_buffer + (i * bpb->bytes_per_sector));
@@ -63,15 +61,8 @@ void init_fs() {
     root_directory_size = (bpb->root_dir_entries * sizeof(fat_dir_entry_t));
     uint32_t root_dir_sectors = (root_directory_size + bpb->bytes_per_sector - 1) / bpb->bytes_per_sector;
 
-    // Define a virtual start address for the root directory buffer, after the FAT.
-    uint32_t root_dir_virt_addr = fat_virt_addr + (fat_pages_needed * PMM_FRAME_SIZE);
-    root_directory_buffer = (uint8_t*)root_dir_virt_addr;
-
-    // Allocate and map pages for the root directory.
-    for (uint32_t i = 0; i < (root_dir_sectors * 512 + PMM_FRAME_SIZE - 1) / PMM_FRAME_SIZE; i++) {
-        void* phys_frame = pmm_alloc_frame();
-        paging_map_page(kernel_directory, root_dir_virt_addr + (i * PMM_FRAME_SIZE), (uint32_t)phys_frame, PAGING_FLAG_PRESENT | PAGING_FLAG_RW);
-    }
+    // Allocate the root directory buffer on the kernel heap as well.
+    root_directory_buffer = (uint8_t*)malloc(root_dir_sectors * 512);
 
     // Read the root directory into the new virtual buffer.
     for (uint32_t i = 0; i < root_dir_sectors; i++) {
@@ -139,7 +130,8 @@ void fs_read_cluster(uint16_t cluster, uint8_t* buffer) {
     read_disk_sector(lba, buffer);
 }
 
-fat_dir_entry_t* fs_find_file(const char* filename) {
+// The body of fs_find_file(), called with fs_lock held.
+static fat_dir_entry_t* fs_lookup(const char* filename) {
     char fat_name[12];
     memset(fat_name, ' ', 11);
     fat_name[11] = '\0'; // Not strictly necessary, but good practice
@@ -183,7 +175,15 @@ fat_dir_entry_t* fs_find_file(const char* filename) {
     return NULL; // File not found
 }
 
-void* fs_read_file(fat_dir_entry_t* entry) {
+fat_dir_entry_t* fs_find_file(const char* filename) {
+    spin_lock(&fs_lock);
+    fat_dir_entry_t* entry = fs_lookup(filename);
+    spin_unlock(&fs_lock);
+    return entry;
+}
+
+// The body of fs_read_file(), called with fs_lock held.
+static void* fs_load(fat_dir_entry_t* entry) {
     //qemu_debug_string("FS: Entered fs_read_file.\n");
     uint32_t size = entry->file_size;
     //qemu_debug_string("FS: File size is ");
@@ -247,4 +247,11 @@ void* fs_read_file(fat_dir_entry_t* entry) {
 
     //qemu_debug_string("FS: Finished reading all clusters.\n");
     return file_buffer;
+}
+
+void* fs_read_file(fat_dir_entry_t* entry) {
+    spin_lock(&fs_lock);
+    void* buffer = fs_load(entry);
+    spin_unlock(&fs_lock);
+    return buffer;
 }
\ No newline at end of file
@@ -14,30 +14,65 @@
 #include <kernel/syscall.h> // User Mode Syscalls
 #include <kernel/debug.h> // debug prints
 #include <kernel/cpu/process.h> // process_init()
+#include <kernel/cpu/sched.h> // ready queues, for the idle loop
+#include <kernel/cpu/fpu.h> // lazy FPU/SSE switching
+#include <kernel/cpu/workqueue.h> // deferred work
+#include <kernel/cpu/smp.h> // application processors
 #include <kernel/pmm.h> // physical memory manager
 #include <kernel/paging.h> // paging creator
 #include <kernel/drivers/sb16.h> // sound card
 #include <kernel/drivers/pci.h> // Peripheral Component Interconnect bus driver
+#include <kernel/ksm.h> // same-page merging
+#include <kernel/reclaim.h> // swapping out cold pages
+#include <kernel/swap.h> // disk swap area
 
 // Make the global flag visible to kmain
 extern volatile int multitasking_enabled;
 
 // Let kmain know about the new assembly function
-extern void start_multitasking(cpu_state_t* cpu_state);
-
-// Tell this file about the process table defined in process.c
-extern task_struct_t process_table[MAX_PROCESSES];
+extern void start_multitasking(uint32_t esp);
 
 // Helper for debug prints
 static inline void outb(unsigned short port, unsigned char data) {
     __asm__ __volatile__("outb %0, %1" : : "a"(data), "Nd"(port));
 }
 
-// This is our new dedicated idle task. It does nothing but halt.
+// This is our dedicated idle task, one per CPU. The boot CPU's merges
+// duplicate user pages in the background; otherwise they just halt.
 void idle_task() {
     qemu_debug_string("idle_task: entered.\n");
+    bool boot_cpu = this_cpu()->id == 0;
     while (1) {
-        __asm__ __volatile__("hlt");
+        // The scan runs with interrupts disabled, so the idle task is never
+        // preempted in the middle of a merge pass.
+        __asm__ __volatile__("cli");
+        if (boot_cpu) {
+            ksm_scan();
+        }
+
+        if (!sched_has_ready()) {
+            // Nothing to run: stop the periodic tick until the next timer is
+            // due, then halt. Any interrupt brings us back here. The other
+            // CPUs may use the kernel while we sleep. Only the boot CPU has
+            // the PIT; the others keep their APIC tick, which is what lets
+            // them pick up work from busier CPUs.
+            if (boot_cpu) {
+                timer_idle_enter();
+            }
+            unlock_kernel();
+            __asm__ __volatile__("sti\n\thlt\n\tcli");
+            lock_kernel();
+            if (boot_cpu) {
+                timer_idle_exit();
+            }
+        }
+
+        // If the interrupt woke a task, switch to it now instead of waiting
+        // for the next tick.
+        if (sched_has_ready()) {
+            __asm__ __volatile__("int $0x20");
+        }
+        __asm__ __volatile__("sti");
     }
 }
 
@@ -58,6 +93,12 @@ void kmain() {
     idt_install();
     qemu_debug_string("idt_inst ");
 
+    // Install the kernel's GDT
+    // The bootloader's GDT lives in low memory, which paging_init unmaps, so
+    // the CPU must be using our own (higher-half) table before that happens.
+    gdt_install();
+    qemu_debug_string("gdt_inst ");
+
     // Initialize the Physical Memory Manager.
     // We'll assume 16MB of RAM for now. (16 * 1024 * 1024 = 16777216)
     pmm_init(16777216);
@@ -86,16 +127,10 @@ void kmain() {
     qemu_debug_hex((uint32_t)frame3);
     qemu_debug_string(" (should be same as frame 1)\n");
 
-    // Initialize and enable paging, which allocates frames from the PMM.
+    // Switch to the kernel's final page directory, which allocates frames from the PMM.
     paging_init();
     qemu_debug_string("paging_init ");
 
-    // Install the kernel's GDT
-    // Reload the GDT AFTER paging is enabled. This ensures the CPU
-    // is using the correct descriptor table in the new memory map.
-    gdt_install();
-    qemu_debug_string("gdt_inst ");
-
     // Now, initialize the rest of the systems that depend on the GDT.
     // Install the TSS right after the GDT
     tss_install(); 
@@ -104,15 +139,33 @@ void kmain() {
     // Initialize the general-purpose heap allocator FIRST.
     init_memory(); 
     qemu_debug_string("mem_init ");
+
+    // From now on, running out of frames swaps cold user pages out, first into
+    // compressed RAM and then to the swap area on disk.
+    swap_init();
+    reclaim_init();
+    qemu_debug_string("reclaim_init ");
  
     // Now that malloc() is safe to use, initialize the filesystem driver.
     init_fs();
     qemu_debug_string("fs_init ");
 
+    // Turn on the FPU and SSE. Tasks get their FPU state on first use.
+    fpu_init();
+    qemu_debug_string("fpu_init ");
+
     // Initialize the process table BEFORE syscalls and interrupts
     process_init(); // Sets up idle_task and shell_task
     qemu_debug_string("proc_init ");
 
+    // Start the kernel worker thread for deferred work.
+    workqueue_init();
+    qemu_debug_string("wq_init ");
+
+    // Wake the other CPUs. They wait for the kernel lock until we go idle.
+    smp_init();
+    qemu_debug_string("smp_init ");
+
     // Syscall install after TSS
     syscall_install();
     qemu_debug_string("sysc_inst ");
@@ -156,7 +209,7 @@ void kmain() {
 
     // Start multitasking by jumping to the first task
     qemu_debug_string("kmain: Calling start_multitasking...\n");
-    start_multitasking(&process_table[0].cpu_state);
+    start_multitasking(current_task->kernel_esp);
     qemu_debug_string("kmain: Returned from start_multitasking (this is an error).\n");
 
     // This part of kmain should never be reached.
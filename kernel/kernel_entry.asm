@@ -7,13 +7,26 @@ extern kmain, bss_start, bss_end
 ; Make '_start' visible to the linker
 global _start
 
+; The application processors use it on their way up too (see smp_boot.asm)
+global boot_page_directory
+
+; The kernel is linked at this virtual address plus its physical address.
+KERNEL_VIRT_BASE equ 0xC0000000
+KERNEL_PDE_INDEX equ (KERNEL_VIRT_BASE >> 22)
+
+; Size of the stack kmain (and the kernel tasks it starts) runs on.
+BOOT_STACK_SIZE equ 16384
+
+; This code runs at the physical load address with paging disabled, so every
+; symbol from the higher half has to be converted to its physical address.
+section .boot progbits alloc exec nowrite align=16
 _start:
     ; --- Clear the .bss section ---
     ; This is critical for C code to work correctly, as it ensures
     ; all static/global variables are initialized to zero.
-    mov edi, bss_start      ; Put the starting address of .bss into EDI
+    mov edi, bss_start - KERNEL_VIRT_BASE ; Physical start of .bss
     mov ecx, bss_end        ; Put the ending address of .bss into ECX
-    sub ecx, edi            ; ECX now holds the size of .bss in bytes
+    sub ecx, bss_start      ; ECX now holds the size of .bss in bytes
     add ecx, 3              ; Add 3 to handle sizes that aren't a multiple of 4
     shr ecx, 2              ; Divide by 4 to get the number of 4-byte chunks (dwords)
 
@@ -21,7 +34,39 @@ _start:
     cld                     ; Clear the direction flag, so `stosd` increments EDI
     rep stosd               ; Write EAX to [EDI] and repeat ECX times
 
-    ; The bootloader has already set up the segments and stack.
+    ; --- Build the boot page directory ---
+    ; Map the first 4MB twice with a single 4MB page: at 0 (so this code keeps
+    ; running after paging is on) and at KERNEL_VIRT_BASE (where the rest of
+    ; the kernel is linked). paging_init replaces this directory later.
+    ; 0x83 = Present | Read/Write | 4MB page.
+    mov dword [boot_page_directory - KERNEL_VIRT_BASE], 0x83
+    mov dword [boot_page_directory - KERNEL_VIRT_BASE + KERNEL_PDE_INDEX * 4], 0x83
+
+    ; Enable 4MB pages (CR4.PSE).
+    mov eax, cr4
+    or eax, 0x10
+    mov cr4, eax
+
+    mov eax, boot_page_directory - KERNEL_VIRT_BASE
+    mov cr3, eax
+
+    ; Enable paging. We also set Write Protect, so that kernel-mode writes to
+    ; read-only user pages fault too. Copy-on-write depends on this.
+    mov eax, cr0
+    or eax, 0x80010000      ; Set bit 31 (PG) and bit 16 (WP)
+    mov cr0, eax
+
+    ; Jump to the higher half. An absolute jump through a register is needed,
+    ; a relative jump would stay in low memory.
+    mov eax, higher_half
+    jmp eax
+
+section .text
+higher_half:
+    ; The stack the bootloader gave us is in low memory, which is about to
+    ; be unmapped. Switch to one inside the kernel image.
+    mov esp, boot_stack_top
+
     ; We can now safely call our main C function.
     call kmain
 
@@ -29,4 +74,12 @@ _start:
     cli
 hang:
     hlt
-    jmp hang
\ No newline at end of file
+    jmp hang
+
+section .bss nobits alloc noexec write align=4096
+alignb 4096
+boot_page_directory:
+    resb 4096
+boot_stack:
+    resb BOOT_STACK_SIZE
+boot_stack_top:
@@ -0,0 +1,189 @@
+// myos/kernel/mm/ksm.c
+
+#include <kernel/ksm.h>
+#include <kernel/paging.h>
+#include <kernel/pmm.h>
+#include <kernel/string.h>      // For memset and memcmp
+#include <kernel/timer.h>       // For timer_get_ticks
+#include <kernel/cpu/process.h> // For the process table
+#include <kernel/debug.h>
+
+// One entry in the merge table. It remembers a frame we have seen during the
+// current pass, and which PTE maps it, so we can write-protect that mapping later.
+typedef struct {
+    uint32_t hash;       // Hash of the page contents
+    uint32_t frame;      // Physical address of the frame
+    uint32_t table_phys; // Physical address of the page table that maps it
+    uint16_t index;      // Index of the PTE within that page table
+    uint8_t  used;       // Is this slot in use?
+    uint8_t  protected;  // Is the mapping already read-only copy-on-write?
+} ksm_entry_t;
+
+// The table is rebuilt from scratch on every pass, so it never holds stale frames.
+static ksm_entry_t ksm_table[KSM_TABLE_SIZE];
+static ksm_stats_t ksm_stats;
+static uint32_t last_scan_tick = 0;
+static uint32_t pass_pages_scanned = 0;
+
+// FNV-1a hash over a whole page, one dword at a time.
+static uint32_t ksm_hash_page(const uint32_t* data) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < PMM_FRAME_SIZE / 4; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Points a PTE at the frame recorded in a table entry and drops its old frame.
+// Both mappings end up read-only with the copy-on-write flag set.
+static void ksm_merge(ksm_entry_t* entry, pte_t* pte) {
+    // Make the first mapping read-only too, otherwise its owner could still
+    // write to the frame we are about to share.
+    if (!entry->protected) {
+        page_table_t* owner = (page_table_t*)PHYS_TO_VIRT(entry->table_phys);
+        owner->entries[entry->index] = (owner->entries[entry->index] & ~PAGING_FLAG_RW) | PAGING_FLAG_COW;
+        entry->protected = 1;
+    }
+
+    uint32_t old_frame = *pte & ~0xFFF;
+    *pte = entry->frame | ((*pte & 0xFFF) & ~PAGING_FLAG_RW) | PAGING_FLAG_COW;
+    pmm_free_frame((void*)old_frame); // Only drops this mapping's reference.
+
+    ksm_stats.pages_merged++;
+}
+
+// Looks at a single user page and merges it with an identical one if we have seen it.
+static void ksm_scan_page(page_table_t* table, uint32_t table_phys, int index) {
+    pte_t* pte = &table->entries[index];
+    uint32_t frame = *pte & ~0xFFF;
+    pass_pages_scanned++;
+
+    // An extra reference without copy-on-write means the frame is pinned by
+    // a futex waiter, which must find its word at the same address.
+    if (!(*pte & PAGING_FLAG_COW) && pmm_get_frame_refs((void*)frame) > 1) {
+        return;
+    }
+
+    // A page written since the last pass is probably still changing. Merging it
+    // would just cause a copy-on-write fault right away, so let it settle first.
+    if (*pte & PAGING_FLAG_DIRTY) {
+        *pte &= ~PAGING_FLAG_DIRTY;
+        return;
+    }
+
+    const uint32_t* data = (const uint32_t*)PHYS_TO_VIRT(frame);
+    uint32_t hash = ksm_hash_page(data);
+
+    // Open addressing with linear probing.
+    for (uint32_t probe = 0; probe < KSM_TABLE_SIZE; probe++) {
+        ksm_entry_t* entry = &ksm_table[(hash + probe) % KSM_TABLE_SIZE];
+
+        if (!entry->used) {
+            // First time we see this content during this pass. Remember it.
+            entry->used = 1;
+            entry->hash = hash;
+            entry->frame = frame;
+            entry->table_phys = table_phys;
+            entry->index = index;
+            entry->protected = !(*pte & PAGING_FLAG_RW);
+            break;
+        }
+
+        if (entry->hash != hash) {
+            continue;
+        }
+
+        // Already mapped to the same frame, nothing to do.
+        if (entry->frame == frame) {
+            break;
+        }
+
+        // Same hash: compare the full contents to rule out a collision.
+        const void* other = PHYS_TO_VIRT(entry->frame);
+        bool same = memcmp(data, other, PMM_FRAME_SIZE) == 0;
+
+        if (same) {
+            if (pmm_ref_frame((void*)entry->frame)) {
+                ksm_merge(entry, pte);
+            }
+            break;
+        }
+    }
+
+}
+
+// Walks every user page of a process through the direct map of its page tables.
+static void ksm_scan_task(task_struct_t* task) {
+    page_directory_t* dir = (page_directory_t*)PHYS_TO_VIRT((uint32_t)task->page_directory);
+
+    // Entries 768 and up are kernel space.
+    for (int i = 0; i < 768; i++) {
+        pde_t pde = dir->entries[i];
+        if (!(pde & PAGING_FLAG_PRESENT)) {
+            continue;
+        }
+
+        uint32_t table_phys = pde & ~0xFFF;
+        page_table_t* table = (page_table_t*)PHYS_TO_VIRT(table_phys);
+        for (int j = 0; j < PAGE_TABLE_ENTRIES; j++) {
+            uint32_t wanted = PAGING_FLAG_PRESENT | PAGING_FLAG_USER;
+            if ((table->entries[j] & wanted) == wanted) {
+                ksm_scan_page(table, table_phys, j);
+            }
+        }
+    }
+
+}
+
+// Runs one merge pass over all user processes, at most once per KSM_SCAN_INTERVAL.
+// It is called from the idle task with interrupts disabled, while the kernel's
+// page directory is active, so no other mapping of these pages is cached in the TLB.
+void ksm_scan() {
+    uint32_t now = timer_get_ticks();
+    if (now - last_scan_tick < KSM_SCAN_INTERVAL) {
+        return;
+    }
+    last_scan_tick = now;
+
+    memset(ksm_table, 0, sizeof(ksm_table));
+    pass_pages_scanned = 0;
+
+    for (task_struct_t* task = task_list; task; task = task->task_next) {
+        // Zombies are about to be freed and kernel tasks have no user pages.
+        if (task->state == TASK_STATE_UNUSED || task->state == TASK_STATE_ZOMBIE) {
+            continue;
+        }
+        if (!task->page_directory || task->page_directory == kernel_directory) {
+            continue;
+        }
+        // Another CPU's TLB would keep the old, writable mapping. That
+        // includes other threads of the same program.
+        if (process_dir_running_elsewhere(task->page_directory)) {
+            continue;
+        }
+        ksm_scan_task(task);
+    }
+
+    // Count how much sharing there is now that the pass is complete.
+    uint32_t shared = 0;
+    uint32_t sharing = 0;
+    for (int i = 0; i < KSM_TABLE_SIZE; i++) {
+        if (ksm_table[i].used) {
+            uint32_t refs = pmm_get_frame_refs((void*)ksm_table[i].frame);
+            if (refs > 1) {
+                shared++;
+                sharing += refs - 1;
+            }
+        }
+    }
+
+    ksm_stats.full_scans++;
+    ksm_stats.pages_scanned = pass_pages_scanned;
+    ksm_stats.pages_shared = shared;
+    ksm_stats.pages_sharing = sharing;
+}
+
+// Returns the current merge statistics.
+const ksm_stats_t* ksm_get_stats() {
+    return &ksm_stats;
+}
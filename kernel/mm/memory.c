@@ -4,10 +4,7 @@
 #include <kernel/io.h>     // port_byte_out
 #include <kernel/pmm.h>
 #include <kernel/paging.h> // to paging functions
-
-// This symbol is defined by the linker script
-extern uint32_t kernel_end;
-extern uint32_t pmm_bitmap_size; // Make pmm_bitmap_size visible
+#include <kernel/cpu/spinlock.h>
 
 // We now need a pointer to the kernel's page directory.
 extern page_directory_t* kernel_directory;
@@ -26,15 +23,14 @@ static uint32_t heap_end;
 // Head of our new free list
 static block_header_t* free_list_head = NULL;
 
-void init_memory() {
-    // The heap starts right after the PMM's bitmap.
-    // We calculate this based on the kernel_end symbol from the linker.
-    heap_top = (uint32_t)&kernel_end + pmm_bitmap_size;
+// Covers the free list and the top of the heap. Interrupt handlers do not
+// allocate, but sections that run with interrupts disabled do.
+static spinlock_t heap_lock = SPINLOCK_INIT;
 
-    // Align the heap_top to the next page boundary for safety.
-    if (heap_top % PMM_FRAME_SIZE != 0) {
-        heap_top = (heap_top / PMM_FRAME_SIZE + 1) * PMM_FRAME_SIZE;
-    }
+void init_memory() {
+    // The heap has its own window in kernel space, whose page tables are
+    // shared by every address space.
+    heap_top = KERNEL_HEAP_START;
 
     // The heap is initially one page in size.
     heap_end = heap_top + PMM_FRAME_SIZE;
@@ -44,11 +40,8 @@ void init_memory() {
     paging_map_page(kernel_directory, heap_top, (uint32_t)frame, PAGING_FLAG_PRESENT | PAGING_FLAG_RW);
 }
 
-void* malloc(uint32_t size) {
-    if (size == 0) {
-        return NULL;
-    }
-
+// The body of malloc(), called with heap_lock held.
+static void* heap_alloc(uint32_t size) {
     // This new implementation uses a pointer-to-a-pointer to make
     // list manipulation cleaner and to avoid the compiler bug.
     block_header_t** link = &free_list_head;
@@ -71,6 +64,9 @@ void* malloc(uint32_t size) {
     // Check if there is enough space in the currently mapped heap.
     while (heap_top + sizeof(block_header_t) + size > heap_end) {
         // Not enough space. We need to expand the heap by one page.
+        if (heap_end >= KERNEL_HEAP_START + KERNEL_HEAP_SIZE) {
+            return NULL; // The heap window is full.
+        }
         void* frame = pmm_alloc_frame();
         if (!frame) {
             // Out of physical memory!
@@ -91,6 +87,16 @@ void* malloc(uint32_t size) {
     return (void*)(new_block + 1); // Return pointer to the user area
 }
 
+void* malloc(uint32_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+    void* ptr = heap_alloc(size);
+    spin_unlock_irqrestore(&heap_lock, flags);
+    return ptr;
+}
+
 void free(void* ptr) {
     if (!ptr) {
         return; // Do nothing if a null pointer is freed
@@ -100,6 +106,8 @@ void free(void* ptr) {
     block_header_t* header = (block_header_t*)ptr - 1;
 
     // Add it to the front of the free list
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
     header->next = free_list_head;
     free_list_head = header;
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
@@ -3,21 +3,18 @@
 #include <kernel/paging.h>
 #include <kernel/pmm.h>
 #include <kernel/types.h>
-#include <kernel/string.h> // For memset
+#include <kernel/string.h> // For memset, memcpy
 #include <kernel/debug.h>
-
-// A virtual address in the kernel's space that we reserve for temporary mappings.
-// This must be an address that we know is not used for anything else.
-#define TEMP_PAGETABLE_ADDR 0xFFBFF000
-#define TEMP_PAGEDIR_ADDR   0xFFBFE000 // A different, unused virtual page
+#include <kernel/io.h>     // For irq_save/irq_restore
+#include <kernel/zram.h>   // For pages swapped to compressed RAM
+#include <kernel/swap.h>   // For pages swapped to disk
+#include <kernel/cpu/process.h> // For current_task
 
 // our assembly functions
 extern void load_page_directory(page_directory_t* dir);
-extern void enable_paging();
 
 // The kernel's page directory, now globally visible.
 page_directory_t* kernel_directory = NULL;
-extern task_struct_t* current_task;
 
 // A virtual address pointer to the page tables of the current page directory.
 #define CURRENT_PAGE_TABLES ((page_table_t*)0xFFC00000)
@@ -25,9 +22,30 @@ extern task_struct_t* current_task;
 // A virtual address pointer to the current page directory, thanks to our recursive mapping.
 #define CURRENT_PAGE_DIR ((page_directory_t*)0xFFFFF000)
 
+// Number of copy-on-write faults we have resolved so far.
+static uint32_t cow_fault_count = 0;
+
 
-// This function sets up and enables paging.
+// Creates zeroed page tables for a range of kernel PDEs. They are never freed
+// and never replaced, which is what lets every directory share them.
+static bool paging_alloc_kernel_tables(page_directory_t* dir, uint32_t virt_start, uint32_t size) {
+    for (uint32_t pd_idx = virt_start >> 22; pd_idx < (virt_start + size + 0x3FFFFF) >> 22; pd_idx++) {
+        page_table_t* table = (page_table_t*)pmm_alloc_frame();
+        if (!table) {
+            return false;
+        }
+        memset(PHYS_TO_VIRT(table), 0, sizeof(page_table_t));
+        dir->entries[pd_idx] = (pde_t)table | PAGING_FLAG_PRESENT | PAGING_FLAG_RW;
+    }
+    return true;
+}
+
+// This function sets up the kernel's final page directory and switches to it.
+// The boot code in kernel_entry.asm already enabled paging with a temporary
+// directory that maps the first 4MB at KERNEL_VIRT_BASE, which is where the
+// PMM hands out its first frames from.
 void paging_init() {
+    uint32_t mem_size_bytes = pmm_total_frames * PMM_FRAME_SIZE;
     //qemu_debug_string("PAGING_INIT: start\n");
 
     kernel_directory = (page_directory_t*)pmm_alloc_frame();
@@ -35,48 +53,42 @@ void paging_init() {
         qemu_debug_string("PAGING_INIT: PANIC! no frame for page directory\n");
         return;
     }
-    //qemu_debug_string("PAGING_INIT: kernel_directory allocated\n");
-    memset(kernel_directory, 0, sizeof(page_directory_t));
-    //qemu_debug_string("PAGING_INIT: kernel_directory zeroed\n");
-
-    // We will identity map the first 4MB of memory.
-    page_table_t* first_pt = (page_table_t*)pmm_alloc_frame();
-    if (!first_pt) {
-        qemu_debug_string("PAGING_INIT: PANIC! no frame for page table\n");
+    page_directory_t* dir = (page_directory_t*)PHYS_TO_VIRT(kernel_directory);
+    memset(dir, 0, sizeof(page_directory_t));
+
+    // Map all of physical memory at KERNEL_VIRT_BASE. This covers the kernel
+    // image, VGA memory, and every frame the PMM hands out, so the kernel can
+    // reach any frame without a temporary mapping.
+    if (!paging_alloc_kernel_tables(dir, KERNEL_VIRT_BASE, mem_size_bytes)) {
+        qemu_debug_string("PAGING_INIT: PANIC! no frame for direct map\n");
         return;
     }
-    //qemu_debug_string("PAGING_INIT: first_pt allocated\n");
-    memset(first_pt, 0, sizeof(page_table_t));
-    //qemu_debug_string("PAGING_INIT: first_pt zeroed\n");
-
-    // Loop through all 1024 entries in the page table to map 4MB.
-    for (int i = 0; i < 1024; i++) {
-        uint32_t phys_addr = i * 0x1000;
-        // The USER flag is no longer needed here, as the PDE provides protection.
-        pte_t page = phys_addr | PAGING_FLAG_PRESENT | PAGING_FLAG_RW;
-        first_pt->entries[i] = page;
+    for (uint32_t phys_addr = 0; phys_addr < mem_size_bytes; phys_addr += PMM_FRAME_SIZE) {
+        uint32_t virt_addr = KERNEL_VIRT_BASE + phys_addr;
+        page_table_t* table = (page_table_t*)PHYS_TO_VIRT(dir->entries[virt_addr >> 22] & ~0xFFF);
+        table->entries[(virt_addr >> 12) & 0x3FF] = phys_addr | PAGING_FLAG_PRESENT | PAGING_FLAG_RW;
     }
-    //qemu_debug_string("PAGING_INIT: first_pt entries filled\n");
 
-    // Put the newly created page table into the first entry of the page directory.
-    // The USER flag is NOT set, protecting the kernel from user-mode access.
-    kernel_directory->entries[0] = (pde_t)first_pt | PAGING_FLAG_PRESENT | PAGING_FLAG_RW ;
-    //qemu_debug_string("PAGING_INIT: page directory entry [0] set\n");
+    // The heap and device windows start out empty, but their page tables must
+    // exist now so that they are shared with every directory cloned later.
+    if (!paging_alloc_kernel_tables(dir, KERNEL_HEAP_START, KERNEL_HEAP_SIZE) ||
+        !paging_alloc_kernel_tables(dir, KERNEL_MMIO_START, KERNEL_MMIO_SIZE)) {
+        qemu_debug_string("PAGING_INIT: PANIC! no frame for kernel page tables\n");
+        return;
+    }
 
     // Add the recursive mapping.
     // The last entry of the page directory is made to point to the directory's physical address.
     uint32_t page_dir_phys_addr = (uint32_t)kernel_directory;
-    kernel_directory->entries[1023] = page_dir_phys_addr | PAGING_FLAG_PRESENT | PAGING_FLAG_RW;
+    dir->entries[1023] = page_dir_phys_addr | PAGING_FLAG_PRESENT | PAGING_FLAG_RW;
     //emu_debug_string("PAGING_INIT: Recursive mapping set for entry 1023.\n");
 
+    // From here on the low identity mapping of the boot directory is gone.
     load_page_directory(kernel_directory);
     //qemu_debug_string("PAGING_INIT: CR3 loaded with page directory address\n");
-
-    enable_paging();
-    //qemu_debug_string("PAGING_INIT: Paging bit set in CR0. MMU is now active.\n");
 }
 
-// Clones a page directory and its tables.
+// Creates a new address space: empty user space plus the shared kernel half.
 page_directory_t* paging_clone_directory(page_directory_t* src_phys) {
     //qemu_debug_string("PAGING: clone_directory started.\n");
     page_directory_t* new_dir_phys = (page_directory_t*)pmm_alloc_frame();
@@ -88,89 +100,66 @@ page_directory_t* paging_clone_directory(page_directory_t* src_phys) {
     }
     //qemu_debug_string("PAGING: new_dir_phys allocated.\n");
 
-    // Temporarily map the new directory so we can write to it safely.
-    paging_map_page(CURRENT_PAGE_DIR, TEMP_PAGEDIR_ADDR, (uint32_t)new_dir_phys, PAGING_FLAG_PRESENT | PAGING_FLAG_RW);
+    // Write to the new directory through the direct map.
+    page_directory_t* new_dir_virt = (page_directory_t*)PHYS_TO_VIRT(new_dir_phys);
 
-    // We can safely write to new_dir_phys because it's in identity-mapped low memory.
-    page_directory_t* new_dir_virt = (page_directory_t*)TEMP_PAGEDIR_ADDR;
-    //qemu_debug_string("PAGING: before zero out the new directory.\n");
-
-    // Zero out the new directory.
+    // Zero out the new directory. This leaves all of user space (entries 0-767) empty.
     memset(new_dir_virt, 0, sizeof(page_directory_t));
-   //qemu_debug_string("PAGING: after zero out the new directory.\n");
-
-    // Read from the source directory using the reliable recursive mapping.
-    // This ensures we are reading from the true, active page directory.
-    page_directory_t* src_virt = CURRENT_PAGE_DIR;
 
-    // Copy the mapping for the first 4MB, which contains the kernel.
-    new_dir_virt->entries[0] = src_virt->entries[0];
-
-    //qemu_debug_string("PAGING: before copy kernel space entries.\n");
-    // Copy kernel-space entries (upper 1GB, entries 768-1022).
+    // Share the kernel's page tables (entries 768-1022) by reference. They are
+    // all created at boot and never change, so the copies never go stale.
+    page_directory_t* kernel_dir_virt = (page_directory_t*)PHYS_TO_VIRT(kernel_directory);
     for (int i = 768; i < 1023; i++) {
-        if (src_virt->entries[i] & PAGING_FLAG_PRESENT) {
-            new_dir_virt->entries[i] = src_virt->entries[i];
-        }
+        new_dir_virt->entries[i] = kernel_dir_virt->entries[i];
     }
-    //qemu_debug_string("PAGING: Kernel entries copied.\n");
 
     // Set the recursive mapping for the new directory to point to itself.
     new_dir_virt->entries[1023] = (uint32_t)new_dir_phys | PAGING_FLAG_PRESENT | PAGING_FLAG_RW;
     //qemu_debug_string("PAGING: Recursive mapping set for new directory.\n");
 
-        // Unmap the temporary page.
-    paging_map_page(CURRENT_PAGE_DIR, TEMP_PAGEDIR_ADDR, 0, 0);
-
     //qemu_debug_string("PAGING: clone_directory finished successfully.\n");
     return new_dir_phys;
 }
 
+// Gives back whatever a user page table entry holds: a frame, or a slot in
+// one of the swap areas.
+static void paging_free_entry(pte_t pte) {
+    if (pte & PAGING_FLAG_PRESENT) {
+        pmm_free_frame((void*)(pte & ~0xFFF));
+    } else if (pte & PAGING_FLAG_SWAP_DISK) {
+        swap_free_entry(pte);
+    } else if (pte & PAGING_FLAG_SWAPPED) {
+        zram_free_entry(pte);
+    }
+}
+
 // It frees the page tables and pages of a given directory.
 void paging_free_directory(page_directory_t* dir_phys) {
     // err check
     if (!dir_phys) return;
 
-    // Temporarily map the directory we want to free into our current address space.
-    paging_map_page(CURRENT_PAGE_DIR, TEMP_PAGEDIR_ADDR, (uint32_t)dir_phys, PAGING_FLAG_PRESENT | PAGING_FLAG_RW);
-    page_directory_t* dir_virt = (page_directory_t*)TEMP_PAGEDIR_ADDR;
+    page_directory_t* dir_virt = (page_directory_t*)PHYS_TO_VIRT(dir_phys);
     
-    // Free all user-space pages and page tables (entries 1 to 767).
-    // We start at 1 because entry 0 maps the kernel's low memory, which is shared
-    // and should never be freed by a user process.
-    for (int i = 1; i < 768; i++) {
-        // Access the PDE using the safe VIRTUAL address.
+    // Free all user-space pages and page tables (entries 0 to 767).
+    // The kernel's page tables above that are shared and must never be freed.
+    for (int i = 0; i < 768; i++) {
         pde_t pde = dir_virt->entries[i];
 
         if (pde & PAGING_FLAG_PRESENT) {
             // Get the PHYSICAL address of the page table from the directory entry.
             page_table_t* pt_phys = (page_table_t*)(pde & ~0xFFF);
-
-            // To safely read the contents of this page table, we must temporarily
-            // map it into our CURRENT (kernel) address space.
-            paging_map_page(kernel_directory, TEMP_PAGETABLE_ADDR, (uint32_t)pt_phys, PAGING_FLAG_PRESENT | PAGING_FLAG_RW);
-
-            // Now we can access the page table through a safe virtual pointer.
-            page_table_t* pt_virt = (page_table_t*)TEMP_PAGETABLE_ADDR;
+            page_table_t* pt_virt = (page_table_t*)PHYS_TO_VIRT(pt_phys);
 
             // Iterate through the page table and free every physical frame it points to.
             for (int j = 0; j < 1024; j++) {
-                if (pt_virt->entries[j] & PAGING_FLAG_PRESENT) {
-                    pmm_free_frame((void*)(pt_virt->entries[j] & ~0xFFF));
-                }
+                paging_free_entry(pt_virt->entries[j]);
             }
 
-            // After we're done with this page table, unmap it from our temporary slot.
-            paging_map_page(kernel_directory, TEMP_PAGETABLE_ADDR, 0, 0);
-
             // And finally, free the physical frame that held the page table itself.
             pmm_free_frame(pt_phys);
         }
     }
 
-    // Unmap the directory itself.
-    paging_map_page(CURRENT_PAGE_DIR, TEMP_PAGEDIR_ADDR, 0, 0);
-
     // Finally, free the physical frame that held the page directory.
     pmm_free_frame(dir_phys);
 
@@ -183,6 +172,28 @@ void paging_free_directory(page_directory_t* dir_phys) {
     // using is now gone.
 }
 
+// Unmaps the user pages from 'start' up to 'end' in any directory, and frees
+// what they held. The page tables stay.
+void paging_unmap_range(page_directory_t* dir_phys, uint32_t start, uint32_t end) {
+    page_directory_t* dir_virt = (page_directory_t*)PHYS_TO_VIRT(dir_phys);
+    uint32_t cr3;
+    __asm__ __volatile__("mov %%cr3, %0" : "=r"(cr3));
+
+    for (uint32_t addr = start & ~0xFFF; addr < end && addr < KERNEL_VIRT_BASE; addr += PMM_FRAME_SIZE) {
+        pde_t pde = dir_virt->entries[addr >> 22];
+        if (!(pde & PAGING_FLAG_PRESENT)) {
+            continue;
+        }
+        page_table_t* table = (page_table_t*)PHYS_TO_VIRT(pde & ~0xFFF);
+        pte_t* pte = &table->entries[(addr >> 12) & 0x3FF];
+        paging_free_entry(*pte);
+        *pte = 0;
+        if ((uint32_t)dir_phys == cr3) {
+            __asm__ __volatile__("invlpg (%0)" : : "b"(addr) : "memory");
+        }
+    }
+}
+
 // Revert to the original version that correctly uses recursive mapping for the active directory.
 pte_t* paging_get_page(page_directory_t* dir, uint32_t virt_addr, bool create, uint32_t flags) {
     uint32_t pd_idx = virt_addr >> 22;
@@ -190,14 +201,20 @@ pte_t* paging_get_page(page_directory_t* dir, uint32_t virt_addr, bool create, u
 
     // Use the magic virtual address for the currently active page directory.
     if (!(CURRENT_PAGE_DIR->entries[pd_idx] & PAGING_FLAG_PRESENT)) {
+        // Kernel page tables are all created at boot. A new one here would
+        // only exist in this directory, so refuse instead.
+        if (create && virt_addr >= KERNEL_VIRT_BASE) {
+            qemu_debug_string("PAGING: No kernel page table for ");
+            qemu_debug_hex(virt_addr);
+            qemu_debug_string("\n");
+            return NULL;
+        }
         if (create) {
             uint32_t new_table_phys = (uint32_t)pmm_alloc_frame();
             if (!new_table_phys) {
                 return NULL; // Out of memory
             }
-            // We use the physical address here because it's in low memory
-            // and identity-mapped.
-            memset((void*)new_table_phys, 0, sizeof(page_table_t));
+            memset(PHYS_TO_VIRT(new_table_phys), 0, sizeof(page_table_t));
             CURRENT_PAGE_DIR->entries[pd_idx] = new_table_phys | (flags & 0x7);
 
             // Invalidate the TLB for the page table's virtual address
@@ -232,10 +249,99 @@ void paging_switch_directory(page_directory_t* dir) {
     //qemu_debug_string("PAGING: after loading page dir\n");
 }
 
+// Resolves page faults that are part of normal operation rather than bugs.
+// This handles writes to copy-on-write pages and accesses to swapped-out pages.
+bool paging_handle_fault(uint32_t fault_addr, uint32_t err_code) {
+    pte_t* pte = paging_get_page(CURRENT_PAGE_DIR, fault_addr, false, 0);
+    if (!pte) {
+        return false;
+    }
+    uint32_t page_addr = fault_addr & ~0xFFF;
+
+    // Threads of one program share the directory. If another CPU already
+    // swapped the page in or broke its copy-on-write, only our TLB is stale.
+    uint32_t needed = PAGING_FLAG_PRESENT | PAGING_FLAG_RW | (err_code & PAGING_FAULT_USER ? PAGING_FLAG_USER : 0);
+    bool writable = (*pte & needed) == needed;
+    if ((!(err_code & PAGING_FAULT_PRESENT) && (*pte & PAGING_FLAG_PRESENT)) ||
+        ((err_code & PAGING_FAULT_WRITE) && writable)) {
+        __asm__ __volatile__("invlpg (%0)" : : "b"(page_addr) : "memory");
+        return true;
+    }
+
+    // A page that is not present may have been swapped out.
+    if (!(err_code & PAGING_FAULT_PRESENT)) {
+        if (!(*pte & PAGING_FLAG_SWAPPED)) {
+            return false;
+        }
+        if (*pte & PAGING_FLAG_SWAP_DISK) {
+            return swap_load_page(pte, page_addr);
+        }
+        return zram_load_page(pte, page_addr);
+    }
+
+    // Otherwise only a write to a copy-on-write page is expected.
+    if (!(err_code & PAGING_FAULT_WRITE) || !(*pte & PAGING_FLAG_COW)) {
+        return false;
+    }
+
+    uint32_t old_frame = *pte & ~0xFFF;
+    uint32_t flags = ((*pte & 0xFFF) & ~PAGING_FLAG_COW) | PAGING_FLAG_RW;
+
+    if (pmm_get_frame_refs((void*)old_frame) > 1) {
+        // Other mappings still share this frame, so give this one a private copy.
+        void* new_frame = pmm_alloc_frame();
+        if (!new_frame) {
+            qemu_debug_string("PAGING: No frame to break copy-on-write page.\n");
+            return false;
+        }
+        void* copy = PHYS_TO_VIRT(new_frame);
+        memcpy(copy, (void*)page_addr, PMM_FRAME_SIZE);
+
+        *pte = (uint32_t)new_frame | flags;
+        pmm_free_frame((void*)old_frame); // Drops only our reference.
+    } else {
+        // We are the last user, so the frame can simply become writable again.
+        *pte = old_frame | flags;
+    }
+    __asm__ __volatile__("invlpg (%0)" : : "b"(page_addr) : "memory");
+
+    cow_fault_count++;
+    return true;
+}
+
+bool paging_user_access(uint32_t start, uint32_t size, bool write) {
+    if (start >= KERNEL_VIRT_BASE || size > KERNEL_VIRT_BASE - start) {
+        return false;
+    }
+    page_directory_t* dir = current_task->page_directory;
+    for (uint32_t page = start & ~0xFFF; page < start + size; page += PMM_FRAME_SIZE) {
+        pte_t* pte = paging_get_page(dir, page, false, 0);
+        if (!pte) {
+            return false;
+        }
+        if (!(*pte & PAGING_FLAG_PRESENT) && (*pte & PAGING_FLAG_SWAPPED)) {
+            paging_handle_fault(page, PAGING_FAULT_USER);
+        }
+        if (write && (*pte & PAGING_FLAG_PRESENT) && (*pte & PAGING_FLAG_COW)) {
+            paging_handle_fault(page, PAGING_FAULT_PRESENT | PAGING_FAULT_WRITE | PAGING_FAULT_USER);
+        }
+        uint32_t wanted = PAGING_FLAG_PRESENT | PAGING_FLAG_USER | (write ? PAGING_FLAG_RW : 0);
+        if ((*pte & wanted) != wanted) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns how many copy-on-write faults have been resolved.
+uint32_t paging_get_cow_fault_count() {
+    return cow_fault_count;
+}
+
 // Dumps debug information about the PDE and PTE for a given virtual address.
 void paging_dump_entry_for_addr(uint32_t virt_addr) {
     // Disable interrupts to ensure the paging structures aren't changed while we read them.
-    __asm__ __volatile__("cli");
+    uint32_t flags = irq_save();
 
     qemu_debug_string("-- PAGING DUMP for VA: ");
     qemu_debug_hex(virt_addr);
@@ -270,5 +376,5 @@ void paging_dump_entry_for_addr(uint32_t virt_addr) {
         qemu_debug_hex(pte & ~0xFFF);
         qemu_debug_string("\n");
     }
-    __asm__ __volatile__("sti");
+    irq_restore(flags);
 }
\ No newline at end of file
@@ -1,18 +1,41 @@
 // myos/kernel/mm/pmm.c
 
 #include <kernel/pmm.h>
+#include <kernel/paging.h> // For VIRT_TO_PHYS
 #include <kernel/types.h>
 #include <kernel/string.h> // For memset
 #include <kernel/debug.h>  // For qemu_debug_string
+#include <kernel/cpu/spinlock.h>
 
 // This symbol is defined by the linker script
 extern uint32_t kernel_end;
 
+// Video memory and BIOS ROMs sit here in the first megabyte. These are not RAM,
+// so the PMM must never hand them out.
+#define PMM_LOW_MEM_HOLE_START 0x9F000
+#define PMM_LOW_MEM_HOLE_END   0x100000
+
 // A bitmap for tracking free physical memory frames.
 uint32_t* pmm_bitmap = NULL; // points to array of bits
 uint32_t pmm_total_frames = 0; // no of 4kb frames to manage
 uint32_t pmm_bitmap_size = 0;
 
+// Per-frame reference counts, stored right after the bitmap. A frame that is
+// mapped into several address spaces (e.g. a page merged by KSM) is only
+// returned to the bitmap when its last user frees it.
+uint8_t* pmm_refcounts = NULL;
+uint32_t pmm_refcounts_size = 0;
+
+// Covers the bitmap and the reference counts. The page fault handler
+// allocates frames, so it is taken with interrupts disabled. It is never
+// held across the reclaim handler.
+static spinlock_t pmm_lock = SPINLOCK_INIT;
+
+// Called when the bitmap runs out of free frames, to try to make room.
+static pmm_reclaim_t reclaim_handler = NULL;
+// Guards against re-entering the reclaim handler from its own allocations.
+static bool reclaiming = false;
+
 // Helper function to set a bit in the bitmap (mark a frame as used).
 static inline void pmm_set_bit(uint32_t frame_idx) {
     uint32_t dword_idx = frame_idx / 32;
@@ -47,15 +70,24 @@ void pmm_init(uint32_t mem_size_bytes) {
     // Mark all frames as initially available.
     memset(pmm_bitmap, 0, pmm_bitmap_size);
 
-    // Calculate how many frames are used by the kernel itself, plus the PMM bitmap.
-    // This is the highest memory address that is off-limits.
-    uint32_t reserved_area_end = (uint32_t)&kernel_end + pmm_bitmap_size;
+    // The reference counts live directly after the bitmap, one byte per frame.
+    pmm_refcounts = (uint8_t*)pmm_bitmap + pmm_bitmap_size;
+    pmm_refcounts_size = (pmm_total_frames + 3) & ~3;
+    memset(pmm_refcounts, 0, pmm_refcounts_size);
+
+    // Calculate how many frames are used by the kernel itself, plus the PMM bitmap
+    // and reference counts. This is the highest memory address that is off-limits.
+    // The kernel runs in the higher half, so convert back to a physical address.
+    uint32_t reserved_area_end = VIRT_TO_PHYS(pmm_get_free_addr());
     uint32_t reserved_frames = (reserved_area_end + PMM_FRAME_SIZE - 1) / PMM_FRAME_SIZE;
 
     // Mark all of these frames as "used" so we never allocate them.
     for (uint32_t i = 0; i < reserved_frames; i++) {
         pmm_set_bit(i);
     }
+    for (uint32_t i = PMM_LOW_MEM_HOLE_START / PMM_FRAME_SIZE; i < PMM_LOW_MEM_HOLE_END / PMM_FRAME_SIZE; i++) {
+        pmm_set_bit(i);
+    }
     
     qemu_debug_string("PMM: Initialized. Total frames: ");
     qemu_debug_hex(pmm_total_frames);
@@ -64,8 +96,8 @@ void pmm_init(uint32_t mem_size_bytes) {
     qemu_debug_string("\n");
 }
 
-// Allocates a single 4KB frame of physical memory.
-void* pmm_alloc_frame() {
+// Scans the bitmap for the first free frame and claims it. Called with pmm_lock held.
+static void* pmm_find_free_frame() {
     // Find the first free frame by scanning the bitmap.
     for (uint32_t dword = 0; dword < pmm_bitmap_size / 4; dword++) {
         // Optimization: If the dword is all 1s, all 32 frames are used. Skip it.
@@ -75,6 +107,7 @@ void* pmm_alloc_frame() {
                 if (!(pmm_bitmap[dword] & (1 << bit))) {
                     uint32_t frame_idx = dword * 32 + bit;
                     pmm_set_bit(frame_idx);
+                    pmm_refcounts[frame_idx] = 1;
                     return (void*)(frame_idx * PMM_FRAME_SIZE);
                 }
             }
@@ -85,22 +118,74 @@ void* pmm_alloc_frame() {
     return NULL; 
 }
 
+// Allocates a single 4KB frame of physical memory.
+// If memory is exhausted, the reclaim handler gets a chance to free a frame.
+void* pmm_alloc_frame() {
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    void* frame = pmm_find_free_frame();
+    spin_unlock_irqrestore(&pmm_lock, flags);
+
+    // Reclaiming frees frames itself, so it runs without pmm_lock.
+    if (!frame && reclaim_handler && !reclaiming) {
+        reclaiming = true;
+        if (reclaim_handler()) {
+            flags = spin_lock_irqsave(&pmm_lock);
+            frame = pmm_find_free_frame();
+            spin_unlock_irqrestore(&pmm_lock, flags);
+        }
+        reclaiming = false;
+    }
+    return frame;
+}
+
+// Registers the function that is called when no free frames are left.
+void pmm_set_reclaim_handler(pmm_reclaim_t handler) {
+    reclaim_handler = handler;
+}
+
 // Frees a previously allocated physical memory frame.
+// Shared frames only drop a reference; the last free releases the frame.
 void pmm_free_frame(void* addr) {
     uint32_t frame_idx = (uint32_t)addr / PMM_FRAME_SIZE;
-    pmm_clear_bit(frame_idx);
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    if (pmm_refcounts[frame_idx] > 1) {
+        pmm_refcounts[frame_idx]--;
+    } else {
+        pmm_refcounts[frame_idx] = 0;
+        pmm_clear_bit(frame_idx);
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+// Takes an extra reference on an allocated frame.
+// Returns false if the frame's count is saturated and cannot be shared further.
+bool pmm_ref_frame(void* addr) {
+    uint32_t frame_idx = (uint32_t)addr / PMM_FRAME_SIZE;
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    bool ok = pmm_refcounts[frame_idx] != 0xFF;
+    if (ok) {
+        pmm_refcounts[frame_idx]++;
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return ok;
+}
+
+// Returns how many users currently hold a reference to the frame.
+uint32_t pmm_get_frame_refs(void* addr) {
+    return pmm_refcounts[(uint32_t)addr / PMM_FRAME_SIZE];
 }
 
 // Returns the first memory address available for use after the PMM bitmap.
 void* pmm_get_free_addr() {
-    // The bitmap is an array of uint32_t. We can get its end address
-    // by taking the start address and adding its size in bytes.
-    return (void*)((uint32_t)pmm_bitmap + pmm_bitmap_size);
+    // The bitmap is followed by the reference counts. We can get the end
+    // address by adding both of their sizes to the bitmap's start address.
+    return (void*)((uint32_t)pmm_bitmap + pmm_bitmap_size + pmm_refcounts_size);
 }
 
 // count the number of free frames.
 uint32_t pmm_get_free_frame_count() {
     uint32_t free_count = 0;
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
     // Iterate through every dword in the bitmap
     for (uint32_t dword = 0; dword < pmm_bitmap_size / 4; dword++) {
         // If the dword is all 1s, all 32 frames are used. Skip it.
@@ -113,5 +198,6 @@ uint32_t pmm_get_free_frame_count() {
             }
         }
     }
+    spin_unlock_irqrestore(&pmm_lock, flags);
     return free_count;
 }
\ No newline at end of file
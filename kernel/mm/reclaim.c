@@ -0,0 +1,141 @@
+// myos/kernel/mm/reclaim.c
+
+#include <kernel/reclaim.h>
+#include <kernel/zram.h>
+#include <kernel/swap.h>
+#include <kernel/paging.h>
+#include <kernel/pmm.h>
+#include <kernel/io.h>          // For irq_save
+#include <kernel/cpu/process.h> // For the process table
+#include <kernel/debug.h>
+
+// Position of the clock hand: task (by PID, as it may exit), page directory
+// entry and page table entry.
+static int clock_pid = 0;
+static int clock_pde = 0;
+static int clock_pte = 0;
+
+// Only user processes own pages we can swap. Zombies are about to be freed anyway.
+// An address space that runs on another CPU (in any of its threads) is
+// left alone, since that CPU's TLB would still map the pages we take away.
+static bool reclaim_is_user_task(task_struct_t* task) {
+    if (task->state == TASK_STATE_UNUSED || task->state == TASK_STATE_ZOMBIE) {
+        return false;
+    }
+    if (!task->page_directory || task->page_directory == kernel_directory) {
+        return false;
+    }
+    return !process_dir_running_elsewhere(task->page_directory);
+}
+
+// Returns true if a PTE maps a private user page that swapping could free.
+bool reclaim_can_swap(pte_t pte) {
+    uint32_t wanted = PAGING_FLAG_PRESENT | PAGING_FLAG_USER;
+    if ((pte & wanted) != wanted) {
+        return false;
+    }
+    // Swapping out one mapping of a shared frame would not free it.
+    return pmm_get_frame_refs((void*)(pte & ~0xFFF)) == 1;
+}
+
+// Moves the clock hand to the next user page that has not been accessed since
+// the hand last passed it, clearing accessed bits on the way (second chance).
+// This approximates LRU. The returned PTE is reached through the direct map,
+// so the caller can rewrite it whichever address space it belongs to.
+static pte_t* reclaim_find_victim(uint32_t* virt_addr, bool* is_current) {
+    uint32_t cr3;
+    __asm__ __volatile__("mov %%cr3, %0" : "=r"(cr3));
+
+    // The first lap may only clear accessed bits, so the second one finds a
+    // victim if there is any swappable page at all. The extra step covers the
+    // partial lap over the task the hand starts in.
+    int tasks = 0;
+    for (task_struct_t* task = task_list; task; task = task->task_next) {
+        tasks++;
+    }
+
+    for (int step = 0; step <= 2 * tasks; step++) {
+        task_struct_t* task = process_find(clock_pid);
+        if (!task) {
+            // The task the hand was in is gone, start over from the oldest.
+            task = task_list;
+            clock_pde = 0;
+            clock_pte = 0;
+        }
+
+        if (reclaim_is_user_task(task)) {
+            bool current = (uint32_t)task->page_directory == cr3;
+            page_directory_t* dir = (page_directory_t*)PHYS_TO_VIRT((uint32_t)task->page_directory);
+
+            // Entries 768 and up are kernel space.
+            for (; clock_pde < 768; clock_pde++, clock_pte = 0) {
+                pde_t pde = dir->entries[clock_pde];
+                if (!(pde & PAGING_FLAG_PRESENT)) {
+                    continue;
+                }
+
+                page_table_t* table = (page_table_t*)PHYS_TO_VIRT(pde & ~0xFFF);
+                for (; clock_pte < PAGE_TABLE_ENTRIES; clock_pte++) {
+                    pte_t* pte = &table->entries[clock_pte];
+                    if (!reclaim_can_swap(*pte)) {
+                        continue;
+                    }
+
+                    uint32_t virt = (clock_pde << 22) | (clock_pte << 12);
+                    if (*pte & PAGING_FLAG_ACCESSED) {
+                        *pte &= ~PAGING_FLAG_ACCESSED;
+                        if (current) {
+                            __asm__ __volatile__("invlpg (%0)" : : "b"(virt) : "memory");
+                        }
+                        continue;
+                    }
+
+                    clock_pte++; // The hand moves past the victim.
+                    *virt_addr = virt;
+                    *is_current = current;
+                    return pte;
+                }
+            }
+        }
+
+        clock_pid = task->task_next ? task->task_next->pid : task_list->pid;
+        clock_pde = 0;
+        clock_pte = 0;
+    }
+    return NULL;
+}
+
+// Registers the reclaim path with the PMM.
+void reclaim_init() {
+    pmm_set_reclaim_handler(reclaim_frame);
+}
+
+// Swaps out cold user pages until one frame is actually freed. The first
+// victims may only seed a new zram pool page, so this can take a few rounds.
+bool reclaim_frame() {
+    unsigned int flags = irq_save();
+    bool freed = false;
+
+    for (int i = 0; i < RECLAIM_TRIES && !freed; i++) {
+        uint32_t virt_addr;
+        bool is_current;
+        pte_t* pte = reclaim_find_victim(&virt_addr, &is_current);
+        if (!pte) {
+            break;
+        }
+
+        // Compressed RAM is much faster than the disk, so it gets the page first.
+        reclaim_result_t result = zram_store_page(pte, virt_addr, is_current);
+        if (result == RECLAIM_REJECTED || result == RECLAIM_FULL) {
+            result = swap_store_pages(pte, virt_addr, is_current);
+        }
+        freed = result == RECLAIM_FREED;
+    }
+
+
+    if (!freed) {
+        qemu_debug_string("RECLAIM: Could not free a frame.\n");
+    }
+    irq_restore(flags);
+    return freed;
+}
@@ -0,0 +1,181 @@
+// myos/kernel/mm/swap.c
+
+#include <kernel/swap.h>
+#include <kernel/paging.h>
+#include <kernel/pmm.h>
+#include <kernel/disk.h>
+#include <kernel/string.h> // For memcpy
+#include <kernel/debug.h>
+
+// A slot holds the flags of the swapped-out PTE, plus this marker while in use.
+#define SWAP_SLOT_USED 0x8000
+
+// The PTE bits that mark a page as living in the disk swap area.
+#define SWAP_DISK_ENTRY (PAGING_FLAG_SWAPPED | PAGING_FLAG_SWAP_DISK)
+
+static uint16_t swap_slots[SWAP_PAGES];
+static swap_stats_t swap_stats;
+static bool swap_enabled = false;
+
+// Bounce buffer for one cluster. Swap I/O runs with interrupts disabled, so one is enough.
+static uint8_t swap_buffer[SWAP_CLUSTER_PAGES * PMM_FRAME_SIZE];
+
+// Checks that the disk is big enough to hold the swap area.
+void swap_init() {
+    uint32_t sectors = disk_get_sector_count();
+    if (sectors < SWAP_START_LBA + SWAP_PAGES * SWAP_SECTORS_PER_PAGE) {
+        qemu_debug_string("SWAP: Disk has no swap area, disk swap disabled.\n");
+        return;
+    }
+
+    swap_enabled = true;
+    swap_stats.total_slots = SWAP_PAGES;
+    qemu_debug_string("SWAP: ");
+    qemu_debug_dec(SWAP_PAGES);
+    qemu_debug_string(" pages of swap at LBA ");
+    qemu_debug_dec(SWAP_START_LBA);
+    qemu_debug_string("\n");
+}
+
+// Finds 'count' consecutive free slots (first fit). Returns the first one, or -1.
+static int swap_find_slots(int count) {
+    int run = 0;
+    for (int i = 0; i < SWAP_PAGES; i++) {
+        run = (swap_slots[i] & SWAP_SLOT_USED) ? 0 : run + 1;
+        if (run == count) {
+            return i - count + 1;
+        }
+    }
+    return -1;
+}
+
+// Writes a cold page and the cold pages right after it to the swap area.
+reclaim_result_t swap_store_pages(pte_t* pte, uint32_t virt_addr, bool is_current) {
+    if (!swap_enabled) {
+        return RECLAIM_FULL;
+    }
+
+    // Gather the victim and the following pages of the same page table that
+    // have not been touched either. Programs tend to use neighbouring pages
+    // together, so they are likely to be wanted back together as well.
+    int index = (virt_addr >> 12) & 0x3FF;
+    int count = 1;
+    while (count < SWAP_CLUSTER_PAGES && index + count < PAGE_TABLE_ENTRIES) {
+        pte_t next = pte[count];
+        if (!reclaim_can_swap(next) || (next & PAGING_FLAG_ACCESSED)) {
+            break;
+        }
+        count++;
+    }
+
+    int first = swap_find_slots(count);
+    if (first < 0) {
+        // The swap area is fragmented, fall back to the single victim.
+        count = 1;
+        first = swap_find_slots(1);
+        if (first < 0) {
+            return RECLAIM_FULL;
+        }
+    }
+
+    // Copy the pages into the bounce buffer and write them with a single command.
+    for (int k = 0; k < count; k++) {
+        const void* src = PHYS_TO_VIRT(pte[k] & ~0xFFF);
+        memcpy(swap_buffer + k * PMM_FRAME_SIZE, src, PMM_FRAME_SIZE);
+    }
+
+    uint32_t lba = SWAP_START_LBA + first * SWAP_SECTORS_PER_PAGE;
+    if (!write_disk_sectors(lba, count * SWAP_SECTORS_PER_PAGE, swap_buffer)) {
+        qemu_debug_string("SWAP: Write error, keeping pages in memory.\n");
+        return RECLAIM_REJECTED;
+    }
+
+    for (int k = 0; k < count; k++) {
+        uint32_t frame = pte[k] & ~0xFFF;
+        swap_slots[first + k] = ((pte[k] & 0xFFF) & ~(PAGING_FLAG_ACCESSED | PAGING_FLAG_DIRTY)) | SWAP_SLOT_USED;
+        pte[k] = ((uint32_t)(first + k) << 12) | SWAP_DISK_ENTRY;
+        if (is_current) {
+            __asm__ __volatile__("invlpg (%0)" : : "b"(virt_addr + k * PMM_FRAME_SIZE) : "memory");
+        }
+        pmm_free_frame((void*)frame);
+    }
+
+    swap_stats.used_slots += count;
+    swap_stats.pages_out += count;
+    swap_stats.clusters_out++;
+    return RECLAIM_FREED;
+}
+
+// Reads a swapped-out page back, along with the neighbours from its cluster.
+bool swap_load_page(pte_t* pte, uint32_t virt_addr) {
+    uint32_t slot = *pte >> 12;
+    if (slot >= SWAP_PAGES || !(swap_slots[slot] & SWAP_SLOT_USED)) {
+        return false;
+    }
+
+    // This may itself swap out other pages (and use the bounce buffer), so do
+    // it before reading anything.
+    void* frame = pmm_alloc_frame();
+    if (!frame) {
+        qemu_debug_string("SWAP: No frame to swap a page back in.\n");
+        return false;
+    }
+
+    // Read ahead the following pages if they were written in the same cluster,
+    // which is the case when their PTEs point at the following slots.
+    int index = (virt_addr >> 12) & 0x3FF;
+    int count = 1;
+    while (count < SWAP_CLUSTER_PAGES && index + count < PAGE_TABLE_ENTRIES && slot + count < SWAP_PAGES &&
+           pte[count] == (((slot + count) << 12) | SWAP_DISK_ENTRY)) {
+        count++;
+    }
+
+    uint32_t lba = SWAP_START_LBA + slot * SWAP_SECTORS_PER_PAGE;
+    if (!read_disk_sectors(lba, count * SWAP_SECTORS_PER_PAGE, swap_buffer)) {
+        qemu_debug_string("SWAP: Read error on slot ");
+        qemu_debug_dec(slot);
+        qemu_debug_string("\n");
+        pmm_free_frame(frame);
+        return false;
+    }
+
+    int loaded = 0;
+    for (int k = 0; k < count; k++) {
+        // Read-ahead is only worth it while there are free frames. It must
+        // not push other pages out to make room.
+        if (k > 0) {
+            frame = pmm_get_free_frame_count() > 0 ? pmm_alloc_frame() : NULL;
+            if (!frame) {
+                break;
+            }
+        }
+
+        void* dest = PHYS_TO_VIRT(frame);
+        memcpy(dest, swap_buffer + k * PMM_FRAME_SIZE, PMM_FRAME_SIZE);
+
+        pte[k] = (uint32_t)frame | (swap_slots[slot + k] & 0xFFF);
+        __asm__ __volatile__("invlpg (%0)" : : "b"(virt_addr + k * PMM_FRAME_SIZE) : "memory");
+        swap_slots[slot + k] = 0;
+        loaded++;
+    }
+
+    swap_stats.used_slots -= loaded;
+    swap_stats.pages_in += loaded;
+    swap_stats.readahead_pages += loaded - 1;
+    swap_stats.faults++;
+    return true;
+}
+
+// Releases the swap slot referenced by a swapped-out PTE.
+void swap_free_entry(pte_t pte) {
+    uint32_t slot = pte >> 12;
+    if ((pte & SWAP_DISK_ENTRY) == SWAP_DISK_ENTRY && slot < SWAP_PAGES && (swap_slots[slot] & SWAP_SLOT_USED)) {
+        swap_slots[slot] = 0;
+        swap_stats.used_slots--;
+    }
+}
+
+// Returns the current swap statistics.
+const swap_stats_t* swap_get_stats() {
+    return &swap_stats;
+}
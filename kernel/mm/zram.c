@@ -0,0 +1,300 @@
+// myos/kernel/mm/zram.c
+
+#include <kernel/zram.h>
+#include <kernel/paging.h>
+#include <kernel/pmm.h>
+#include <kernel/string.h>      // For memcpy
+#include <kernel/debug.h>
+
+// LZSS parameters: a match is 2 bytes holding a 4-bit length and a 12-bit offset.
+#define LZ_MIN_MATCH  3
+#define LZ_MAX_MATCH  (LZ_MIN_MATCH + 15)
+#define LZ_MAX_OFFSET 0xFFF
+#define LZ_HASH_SIZE  4096
+
+// A page that lives in the pool. Its PTE holds the slot index in the address bits.
+typedef struct {
+    uint16_t pool_idx;   // Pool page that holds the compressed data
+    uint16_t offset;     // Offset of the data within that pool page
+    uint16_t size;       // Compressed size, 0 for same-filled pages
+    uint16_t pte_flags;  // Flags of the original PTE, restored on swap-in
+    uint32_t same_value; // The repeated dword of a same-filled page
+    uint8_t  used;       // Is this slot in use?
+} zram_slot_t;
+
+// A frame that compressed pages are packed into, one after the other.
+typedef struct {
+    uint32_t frame;      // Physical address of the frame, 0 if this entry is free
+    uint16_t top;        // Where the next compressed page goes
+    uint16_t live_bytes; // Bytes still owned by slots; the frame is freed at 0
+} zram_pool_page_t;
+
+static zram_slot_t zram_slots[ZRAM_MAX_SLOTS];
+static zram_pool_page_t zram_pool[ZRAM_MAX_POOL_PAGES];
+static int current_pool = -1; // Pool page we are currently filling
+static zram_stats_t zram_stats;
+
+// Scratch space for compression. We run with interrupts disabled, so one copy is enough.
+static uint8_t zram_buffer[ZRAM_MAX_COMPRESSED + 17];
+static uint16_t lz_hash_table[LZ_HASH_SIZE];
+
+// Compresses one page with a simple LZSS scheme. Every group starts with a flag
+// byte; each of its 8 bits says whether the next item is a literal byte (0) or
+// a back-reference (1). Returns the compressed size, or 0 if it exceeds max_out.
+static uint32_t lz_compress(const uint8_t* in, uint8_t* out, uint32_t max_out) {
+    memset(lz_hash_table, 0, sizeof(lz_hash_table));
+    uint32_t ip = 0;
+    uint32_t op = 0;
+
+    while (ip < PMM_FRAME_SIZE) {
+        // A full group is at most 1 flag byte + 8 matches of 2 bytes.
+        if (op + 17 > max_out) {
+            return 0;
+        }
+        uint32_t flag_pos = op++;
+        uint8_t flags = 0;
+
+        for (int bit = 0; bit < 8 && ip < PMM_FRAME_SIZE; bit++) {
+            uint32_t match_len = 0;
+            uint32_t match_off = 0;
+
+            if (ip + LZ_MIN_MATCH <= PMM_FRAME_SIZE) {
+                uint32_t hash = ((in[ip] << 8) ^ (in[ip + 1] << 4) ^ in[ip + 2]) & (LZ_HASH_SIZE - 1);
+                uint32_t candidate = lz_hash_table[hash]; // Stored as position + 1, 0 means empty
+                lz_hash_table[hash] = ip + 1;
+
+                if (candidate) {
+                    candidate--;
+                    uint32_t offset = ip - candidate;
+                    if (offset <= LZ_MAX_OFFSET) {
+                        uint32_t len = 0;
+                        while (len < LZ_MAX_MATCH && ip + len < PMM_FRAME_SIZE && in[candidate + len] == in[ip + len]) {
+                            len++;
+                        }
+                        if (len >= LZ_MIN_MATCH) {
+                            match_len = len;
+                            match_off = offset;
+                        }
+                    }
+                }
+            }
+
+            if (match_len) {
+                flags |= (1 << bit);
+                out[op++] = ((match_len - LZ_MIN_MATCH) << 4) | (match_off >> 8);
+                out[op++] = match_off & 0xFF;
+                ip += match_len;
+            } else {
+                out[op++] = in[ip++];
+            }
+        }
+        out[flag_pos] = flags;
+    }
+    return op;
+}
+
+// Expands data produced by lz_compress back into a full page.
+static bool lz_decompress(const uint8_t* in, uint32_t in_len, uint8_t* out) {
+    uint32_t ip = 0;
+    uint32_t op = 0;
+
+    while (ip < in_len && op < PMM_FRAME_SIZE) {
+        uint8_t flags = in[ip++];
+        for (int bit = 0; bit < 8 && ip < in_len && op < PMM_FRAME_SIZE; bit++) {
+            if (flags & (1 << bit)) {
+                if (ip + 2 > in_len) {
+                    return false;
+                }
+                uint32_t len = (in[ip] >> 4) + LZ_MIN_MATCH;
+                uint32_t offset = ((in[ip] & 0x0F) << 8) | in[ip + 1];
+                ip += 2;
+                if (offset == 0 || offset > op || op + len > PMM_FRAME_SIZE) {
+                    return false;
+                }
+                // Copy byte by byte, the source may overlap what we are writing.
+                for (uint32_t i = 0; i < len; i++, op++) {
+                    out[op] = out[op - offset];
+                }
+            } else {
+                out[op++] = in[ip++];
+            }
+        }
+    }
+    return op == PMM_FRAME_SIZE;
+}
+
+// Compresses a victim page into the pool and turns its PTE into a swap entry.
+reclaim_result_t zram_store_page(pte_t* pte, uint32_t virt_addr, bool is_current) {
+    uint32_t frame = *pte & ~0xFFF;
+
+    int slot_idx = -1;
+    for (int i = 0; i < ZRAM_MAX_SLOTS; i++) {
+        if (!zram_slots[i].used) {
+            slot_idx = i;
+            break;
+        }
+    }
+    if (slot_idx < 0) {
+        zram_stats.misses++;
+        return RECLAIM_FULL;
+    }
+    zram_slot_t* slot = &zram_slots[slot_idx];
+
+    // Pages filled with a single value (mostly zeroes) need no data at all.
+    const uint32_t* data = (const uint32_t*)PHYS_TO_VIRT(frame);
+    bool same = true;
+    for (int i = 1; i < PMM_FRAME_SIZE / 4; i++) {
+        if (data[i] != data[0]) {
+            same = false;
+            break;
+        }
+    }
+    uint32_t size = 0;
+    slot->same_value = data[0];
+    if (!same) {
+        size = lz_compress((const uint8_t*)data, zram_buffer, ZRAM_MAX_COMPRESSED);
+    }
+
+    if (!same && size == 0) {
+        zram_stats.rejected++;
+        return RECLAIM_REJECTED;
+    }
+
+    bool frame_pooled = false;
+    if (size > 0) {
+        if (current_pool < 0 || zram_pool[current_pool].top + size > PMM_FRAME_SIZE) {
+            int pool_idx = -1;
+            for (int i = 0; i < ZRAM_MAX_POOL_PAGES; i++) {
+                if (!zram_pool[i].frame) {
+                    pool_idx = i;
+                    break;
+                }
+            }
+            if (pool_idx < 0) {
+                zram_stats.misses++;
+                return RECLAIM_FULL;
+            }
+
+            // Memory is exhausted, so the victim's own frame becomes the new pool
+            // page. Its data is already in the buffer. Later victims fill it up.
+            zram_pool[pool_idx].frame = frame;
+            zram_pool[pool_idx].top = 0;
+            zram_pool[pool_idx].live_bytes = 0;
+            current_pool = pool_idx;
+            frame_pooled = true;
+            zram_stats.pool_pages++;
+        }
+
+        zram_pool_page_t* pool = &zram_pool[current_pool];
+        uint8_t* dest = (uint8_t*)PHYS_TO_VIRT(pool->frame);
+        memcpy(dest + pool->top, zram_buffer, size);
+
+        slot->pool_idx = current_pool;
+        slot->offset = pool->top;
+        pool->top += size;
+        pool->live_bytes += size;
+    } else {
+        zram_stats.same_pages++;
+    }
+
+    slot->size = size;
+    slot->pte_flags = (*pte & 0xFFF) & ~(PAGING_FLAG_ACCESSED | PAGING_FLAG_DIRTY);
+    slot->used = 1;
+
+    // Not present, so the next access faults and brings the page back.
+    *pte = ((uint32_t)slot_idx << 12) | PAGING_FLAG_SWAPPED;
+    if (is_current) {
+        __asm__ __volatile__("invlpg (%0)" : : "b"(virt_addr) : "memory");
+    }
+
+    zram_stats.pages_stored++;
+    zram_stats.orig_bytes += PMM_FRAME_SIZE;
+    zram_stats.compressed_bytes += size;
+
+    if (frame_pooled) {
+        return RECLAIM_POOLED;
+    }
+    pmm_free_frame((void*)frame);
+    return RECLAIM_FREED;
+}
+
+// Gives a slot back, and the pool page it lived in once that page is empty.
+static void zram_release_slot(uint32_t slot_idx) {
+    zram_slot_t* slot = &zram_slots[slot_idx];
+
+    if (slot->size == 0) {
+        zram_stats.same_pages--;
+    } else {
+        zram_pool_page_t* pool = &zram_pool[slot->pool_idx];
+        pool->live_bytes -= slot->size;
+        if (pool->live_bytes == 0) {
+            if (slot->pool_idx == current_pool) {
+                pool->top = 0; // Keep filling it from the start.
+            } else {
+                pmm_free_frame((void*)pool->frame);
+                pool->frame = 0;
+                zram_stats.pool_pages--;
+            }
+        }
+    }
+
+    zram_stats.pages_stored--;
+    zram_stats.orig_bytes -= PMM_FRAME_SIZE;
+    zram_stats.compressed_bytes -= slot->size;
+    slot->used = 0;
+}
+
+// Brings a swapped-out page back into memory after a fault on it.
+bool zram_load_page(pte_t* pte, uint32_t virt_addr) {
+    uint32_t slot_idx = *pte >> 12;
+    if (slot_idx >= ZRAM_MAX_SLOTS || !zram_slots[slot_idx].used) {
+        return false;
+    }
+
+    // This may itself swap out other pages, but never the one we are loading.
+    void* frame = pmm_alloc_frame();
+    if (!frame) {
+        qemu_debug_string("ZRAM: No frame to swap a page back in.\n");
+        return false;
+    }
+    zram_slot_t* slot = &zram_slots[slot_idx];
+
+    bool ok = true;
+    uint32_t* dest = (uint32_t*)PHYS_TO_VIRT(frame);
+    if (slot->size == 0) {
+        for (int i = 0; i < PMM_FRAME_SIZE / 4; i++) {
+            dest[i] = slot->same_value;
+        }
+    } else {
+        const uint8_t* src = (const uint8_t*)PHYS_TO_VIRT(zram_pool[slot->pool_idx].frame);
+        ok = lz_decompress(src + slot->offset, slot->size, (uint8_t*)dest);
+    }
+
+    if (!ok) {
+        qemu_debug_string("ZRAM: Corrupt compressed page in slot ");
+        qemu_debug_dec(slot_idx);
+        qemu_debug_string("\n");
+        pmm_free_frame(frame);
+        return false;
+    }
+
+    *pte = (uint32_t)frame | slot->pte_flags;
+    __asm__ __volatile__("invlpg (%0)" : : "b"(virt_addr) : "memory");
+
+    zram_release_slot(slot_idx);
+    zram_stats.hits++;
+    return true;
+}
+
+// Releases the pool slot referenced by a swapped-out PTE.
+void zram_free_entry(pte_t pte) {
+    uint32_t slot_idx = pte >> 12;
+    if ((pte & (PAGING_FLAG_SWAPPED | PAGING_FLAG_SWAP_DISK)) == PAGING_FLAG_SWAPPED && slot_idx < ZRAM_MAX_SLOTS && zram_slots[slot_idx].used) {
+        zram_release_slot(slot_idx);
+    }
+}
+
+// Returns the current pool statistics.
+const zram_stats_t* zram_get_stats() {
+    return &zram_stats;
+}
@@ -13,12 +13,13 @@
 #include <kernel/debug.h> // debug printing
 #include <kernel/drivers/sb16.h> // sound blaster 16
 #include <kernel/drivers/virtio.h> // virtio driver
-
-// Let the shell know about the process table defined in process.c
-extern task_struct_t process_table[MAX_PROCESSES];
-
-// Make the global current_task pointer visible to this file.
-extern task_struct_t* current_task;
+#include <kernel/ksm.h> // same-page merging stats
+#include <kernel/zram.h> // compressed swap stats
+#include <kernel/swap.h> // disk swap stats
+#include <kernel/paging.h> // for PHYS_TO_VIRT
+#include <kernel/cpu/sched.h> // for scheduling policies
+#include <kernel/cpu/workqueue.h> // for running slow commands in the background
+#include <kernel/cpu/signal.h> // for kill
 
 // global variables to hold the shell's state
 char history_buffer[HISTORY_SIZE][MAX_CMD_LEN];
@@ -28,9 +29,298 @@ char current_line[MAX_CMD_LEN];
 int cursor_pos = 0;
 int line_len = 0;
 
+// CPU bandwidth group that programs started with 'run' are put in.
+static int run_group = 0;
+
 // Forward-declaration for our command processor
 void process_command();
 
+// The virtio-sound test waits for the device after every command, so it runs
+// on the system work queue instead of blocking the shell.
+static work_t vsbeep_work;
+
+static void vsbeep_work_fn(void* data) {
+    (void)data;
+    virtio_sound_beep();
+    print_string(" test complete.\n");
+}
+
+// 'top' remembers each task's TSC cycles at the last refresh, by PID.
+static uint64_t top_last_cycles[PID_MAX];
+
+// Prints a number and pads it with spaces to 'width' characters.
+static void print_dec_padded(uint32_t n, int width) {
+    int digits = 1;
+    for (uint32_t v = n; v >= 10; v /= 10) {
+        digits++;
+    }
+    print_dec(n);
+    while (digits++ < width) {
+        print_char(' ');
+    }
+}
+
+// Prints a fixed point load average with two decimals.
+static void print_load(uint32_t load) {
+    uint32_t frac = ((load & (FIXED_1 - 1)) * 100) >> FSHIFT;
+    print_dec(load >> FSHIFT);
+    print_char('.');
+    if (frac < 10) {
+        print_char('0');
+    }
+    print_dec(frac);
+}
+
+// TSC cycles a task has used, with the stretch it is running right now.
+static uint64_t top_task_cycles(task_struct_t* task, uint64_t now) {
+    uint64_t cycles = task->usage.user_cycles + task->usage.system_cycles;
+    if (task->on_cpu && now > task->tsc_mark) {
+        cycles += now - task->tsc_mark;
+    }
+    return cycles;
+}
+
+// Shows every task's share of a CPU over the last second, its CPU time and
+// context switches, and the load averages. Redraws every second until a
+// key is pressed. 100% is one whole CPU.
+static void shell_top() {
+    uint64_t last = rdtsc();
+    for (task_struct_t* task = task_list; task; task = task->task_next) {
+        top_last_cycles[task->pid] = top_task_cycles(task, last);
+    }
+    keyboard_flush();
+
+    while (1) {
+        for (int i = 0; i < 10; i++) {
+            if (keyboard_has_char()) {
+                keyboard_read_char();
+                clear_screen();
+                return;
+            }
+            sleep(100);
+        }
+
+        // Scaled down, so the percentages work in 32 bits.
+        uint64_t now = rdtsc();
+        uint32_t elapsed = (uint32_t)((now - last) >> 10);
+        last = now;
+
+        clear_screen();
+        uint32_t loads[3];
+        sched_get_loadavg(loads);
+        print_string("top - up ");
+        print_dec(timer_get_ticks() / TIMER_HZ);
+        print_string("s, load average: ");
+        print_load(loads[0]);
+        print_string(", ");
+        print_load(loads[1]);
+        print_string(", ");
+        print_load(loads[2]);
+        print_string(", CPUs: ");
+        print_dec(smp_cpu_count);
+        print_string("\n\n");
+
+        print_string("PID  | %CPU | User ms  | Sys ms   | Vol    | Invol  | Name\n");
+        print_string("--------------------------------------------------------------\n");
+        for (task_struct_t* task = task_list; task; task = task->task_next) {
+            uint64_t cycles = top_task_cycles(task, now);
+            uint64_t before = top_last_cycles[task->pid];
+            uint32_t delta = (uint32_t)((cycles >= before ? cycles - before : cycles) >> 10);
+            top_last_cycles[task->pid] = cycles;
+
+            print_dec_padded(task->pid, 5);
+            print_string("| ");
+            print_dec_padded(elapsed ? delta * 100 / elapsed : 0, 5);
+            print_string("| ");
+            print_dec_padded(task->usage.utime * (1000 / TIMER_HZ), 9);
+            print_string("| ");
+            print_dec_padded(task->usage.stime * (1000 / TIMER_HZ), 9);
+            print_string("| ");
+            print_dec_padded(task->usage.nvcsw, 7);
+            print_string("| ");
+            print_dec_padded(task->usage.nivcsw, 7);
+            print_string("| ");
+            print_string(task->name);
+            print_string("\n");
+        }
+        print_string("\nPress any key to quit.");
+    }
+}
+
+// Prints a wake-up latency histogram, one line per bucket that is in use,
+// with a bar scaled to the fullest bucket.
+static void print_latency_hist(const sched_latency_t* lat) {
+    uint32_t most = 0;
+    for (int i = 0; i < SCHED_LAT_BUCKETS; i++) {
+        if (lat->hist[i] > most) {
+            most = lat->hist[i];
+        }
+    }
+    if (most == 0) {
+        print_string("No wake-ups measured.\n");
+        return;
+    }
+
+    print_string("Wake-ups: "); print_dec(lat->count);
+    print_string(", avg "); print_dec(lat->total_us / lat->count);
+    print_string("us, max "); print_dec(lat->max_us); print_string("us\n");
+    for (int i = 0; i < SCHED_LAT_BUCKETS; i++) {
+        if (lat->hist[i] == 0) {
+            continue;
+        }
+        print_dec_padded(i ? 1u << i : 0, 6);
+        if (i == SCHED_LAT_BUCKETS - 1) {
+            print_string(" and up  ");
+        } else {
+            print_string("- ");
+            print_dec_padded((2u << i) - 1, 7);
+        }
+        print_string("us | ");
+        print_dec_padded(lat->hist[i], 8);
+        for (uint32_t n = lat->hist[i] * 40 / most; n > 0; n--) {
+            print_char('*');
+        }
+        print_string("\n");
+    }
+}
+
+// 'latency' shows how long woken tasks waited for a CPU, per task and for
+// all of them, and how long the ready queues were. 'latency <pid>' shows
+// one task's histogram, 'latency reset' starts over.
+static void shell_latency(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+        sched_reset_stats();
+        print_string("Latency stats cleared.");
+        return;
+    }
+    if (argc > 1) {
+        task_struct_t* task = process_find(atoi(argv[1]));
+        if (!task) {
+            print_string("Invalid PID.");
+            return;
+        }
+        print_string(task->name); print_string(":\n");
+        print_latency_hist(&task->latency);
+        return;
+    }
+
+    print_string("PID  | Wakeups  | Avg us   | Max us   | Name\n");
+    print_string("--------------------------------------------------\n");
+    for (task_struct_t* task = task_list; task; task = task->task_next) {
+        if (task->latency.count == 0) {
+            continue;
+        }
+        print_dec_padded(task->pid, 5);
+        print_string("| ");
+        print_dec_padded(task->latency.count, 9);
+        print_string("| ");
+        print_dec_padded(task->latency.total_us / task->latency.count, 9);
+        print_string("| ");
+        print_dec_padded(task->latency.max_us, 9);
+        print_string("| ");
+        print_string(task->name);
+        print_string("\n");
+    }
+
+    sched_latency_t all;
+    sched_get_latency(&all);
+    print_string("\nAll tasks:\n");
+    print_latency_hist(&all);
+
+    // Ready queue length, with two decimals for the average.
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        sched_rq_stats_t stats;
+        sched_get_rq_stats(cpu, &stats);
+        if (!cpus[cpu].online || stats.samples == 0) {
+            continue;
+        }
+        uint32_t avg = stats.total * 100 / stats.samples;
+        print_string("\nCPU "); print_dec(cpu);
+        print_string(" queue: avg "); print_dec(avg / 100); print_char('.');
+        if (avg % 100 < 10) {
+            print_char('0');
+        }
+        print_dec(avg % 100);
+        print_string(", max "); print_dec(stats.max);
+        print_string(" over "); print_dec(stats.samples); print_string(" ticks");
+    }
+}
+
+// Letter for a task state, as in the prev_state of a sched_switch record.
+static char trace_state_char(task_state_t state) {
+    switch (state) {
+        case TASK_STATE_RUNNING:  return 'R';
+        case TASK_STATE_SLEEPING: return 'S';
+        case TASK_STATE_WAITING:  return 'D';
+        case TASK_STATE_ZOMBIE:   return 'Z';
+        default:                  return '?';
+    }
+}
+
+// 'trace on|off' records context switches, 'trace show' prints the records
+// taken so far and empties the trace. They also go to the QEMU debug
+// console, in the format of Linux's sched_switch event, for tools that
+// read that.
+static void shell_trace(int argc, char* argv[]) {
+    if (argc == 2 && strcmp(argv[1], "on") == 0) {
+        sched_trace_enable(true);
+        print_string("Tracing context switches.");
+        return;
+    }
+    if (argc == 2 && strcmp(argv[1], "off") == 0) {
+        sched_trace_enable(false);
+        print_string("Tracing stopped.");
+        return;
+    }
+    if (argc != 2 || strcmp(argv[1], "show") != 0) {
+        print_string("Usage: trace on | off | show\n");
+        print_string(sched_trace_enabled() ? "Tracing is on." : "Tracing is off.");
+        return;
+    }
+
+    sched_switch_t recs[16];
+    int n;
+    while ((n = sched_trace_read(recs, 16)) > 0) {
+        for (int i = 0; i < n; i++) {
+            const sched_switch_t* rec = &recs[i];
+            char state[2] = { trace_state_char(rec->prev_state), 0 };
+            uint32_t usec = rec->time_us % 1000000;
+
+            print_string("["); print_dec(rec->cpu); print_string("] ");
+            print_dec(rec->time_us / 1000000); print_char('.');
+            for (uint32_t d = 100000; d > 1 && usec < d; d /= 10) {
+                print_char('0');
+            }
+            print_dec(usec);
+            print_string(" "); print_dec(rec->prev_pid);
+            print_string(" "); print_string(state);
+            print_string(" ==> "); print_dec(rec->next_pid);
+            if (rec->wait_us) {
+                print_string(" (waited "); print_dec(rec->wait_us); print_string("us)");
+            }
+            print_string("\n");
+
+            qemu_debug_string("sched_switch: cpu=");
+            qemu_debug_dec(rec->cpu);
+            qemu_debug_string(" time_us=");
+            qemu_debug_dec(rec->time_us);
+            qemu_debug_string(" prev_pid=");
+            qemu_debug_dec(rec->prev_pid);
+            qemu_debug_string(" prev_state=");
+            qemu_debug_string(state);
+            qemu_debug_string(" ==> next_pid=");
+            qemu_debug_dec(rec->next_pid);
+            qemu_debug_string(" wait_us=");
+            qemu_debug_dec(rec->wait_us);
+            qemu_debug_string("\n");
+        }
+    }
+    if (sched_trace_lost()) {
+        print_dec(sched_trace_lost());
+        print_string(" records were dropped, the trace was full.");
+    }
+}
+
 // Initialize the shell.
 void shell_init() {
     // Clear the current line and set cursor to the start.
@@ -218,7 +508,14 @@ void process_command() {
         print_string("  dump  - Dump the first 128b of root dir buffer\n");
         print_string("  run  - Run user mode program\n");
         print_string("  ps  - Show process list\n");
-        print_string("  kill - Reap a zombie process by PID\n");
+        print_string("  top - Show CPU usage per process, live\n");
+        print_string("  latency - Wake-up latency per process: [<pid> | reset]\n");
+        print_string("  trace - Context switch trace: on | off | show\n");
+        print_string("  kill - Signal a process (default SIGTERM), or reap a zombie\n");
+        print_string("  cgroup - CPU groups: set <id> <quota_ms> <period_ms> | use <id>\n");
+        print_string("  ksm - Show same-page merging stats\n");
+        print_string("  zram - Show compressed swap stats\n");
+        print_string("  swap - Show disk swap stats\n");
         print_string("  vsbeep - beep using Virtual I/O driver\n");
         print_string("  vsprobe - debug Virtual I/O critical values\n");
         print_string("\n");
@@ -233,6 +530,12 @@ void process_command() {
         print_string("Uptime (seconds): ");
         print_hex(timer_get_ticks() / 100);
 
+        // How many ticks went by without an interrupt while the CPU was idle.
+        const timer_stats_t* stats = timer_get_stats();
+        print_string("\nTimer interrupts: "); print_dec(stats->interrupts);
+        print_string("\nIdle ticks skipped: "); print_dec(stats->ticks_skipped);
+        print_string(" (in "); print_dec(stats->idle_entries); print_string(" idle periods)");
+
     // reboot command
     } else if (strcmp(argv[0], "reboot") == 0) {
         print_string("Rebooting system...");
@@ -262,7 +565,8 @@ void process_command() {
         if (argc > 1) {
             fat_dir_entry_t* file_entry = fs_find_file(argv[1]);
             if (file_entry) {
-                __asm__ __volatile__("cli"); // Disable interrupts
+                // The filesystem and the console lock themselves, so the
+                // load runs with interrupts enabled.
                 uint8_t* buffer = (uint8_t*)fs_read_file(file_entry);
                 if (buffer) {
                     for (uint32_t i = 0; i < file_entry->file_size; i++) {
@@ -271,7 +575,6 @@ void process_command() {
                     // free the buffer to prev mem leaks
                     free(buffer);
                 }
-                __asm__ __volatile__("sti"); // Re-enable interrupts
             } else {
                 print_string("File not found: ");
                 print_string(argv[1]);
@@ -370,17 +673,18 @@ void process_command() {
             int child_pid = exec_program(argc - 1, &argv[1]);
         
             if (child_pid >= 0) {
-                // exec_program succeeded and returned with interrupts disabled.
-                // We can now safely set our state to waiting.
-                current_task->state = TASK_STATE_WAITING;
+                // Programs go into the group chosen with 'cgroup use'.
+                task_struct_t* child = process_find(child_pid);
+                if (child) {
+                    sched_set_group(child, sched_get_group(run_group));
+                }
 
-                // We yield the CPU. The IRET from the interrupt handler
-                // will automatically re-enable interrupts for us.
-                __asm__ __volatile__("int $0x20");
-            } else {
-                // exec_program failed, but it left interrupts disabled.
-                // We must re-enable them before continuing the shell.
-                __asm__ __volatile__("sti");
+                // Sleep until it exits (it may have done so already), and free it.
+                int status;
+                if (process_waitpid(child_pid, &status) == child_pid && status != 0) {
+                    print_string("Exit status: ");
+                    print_dec(status);
+                }
             }
         } else {
             print_string("Usage: run <filename>");
@@ -388,63 +692,190 @@ void process_command() {
 
     // ps command
     } else if (strcmp(argv[0], "ps") == 0) {
-        print_string("PID  | State      | Name\n");
-        print_string("----------------------------------\n");
-        for (int i = 0; i < MAX_PROCESSES; i++) {
-            if (process_table[i].state != TASK_STATE_UNUSED) {
-                print_dec(process_table[i].pid);
+        print_string("PID  | State      | Prio | Grp | CPU | Name\n");
+        print_string("-----------------------------------------------------\n");
+        for (task_struct_t* task = task_list; task; task = task->task_next) {
+            print_dec(task->pid);
+            print_string("    | ");
+            
+            // Print the state as a string
+            switch (task->state) {
+                case TASK_STATE_RUNNING:
+                    print_string("Running    | ");
+                    break;
+                case TASK_STATE_SLEEPING:
+                    print_string("Sleeping   | ");
+                    break;
+                case TASK_STATE_WAITING:
+                    print_string("Waiting    | ");
+                    break;
+                case TASK_STATE_ZOMBIE:
+                    print_string("Zombie     | ");
+                    break;
+                default:
+                    print_string("Unknown    | ");
+                    break;
+            }
+
+            // The scheduler level, 0 is the most important. Real-time
+            // tasks show their real-time priority instead.
+            if (task->policy == SCHED_FIFO) {
+                print_string("rt");
+                print_dec(task->rt_priority);
+                print_string("  | ");
+            } else {
+                print_dec(task->priority);
                 print_string("    | ");
-                
-                // Print the state as a string
-                switch (process_table[i].state) {
-                    case TASK_STATE_RUNNING:
-                        print_string("Running    | ");
-                        break;
-                    case TASK_STATE_ZOMBIE:
-                        print_string("Zombie     | ");
-                        break;
-                    default:
-                        print_string("Unknown    | ");
-                        break;
+            }
+
+            // Which CPU bandwidth group it is charged to.
+            for (int g = 0; g < SCHED_MAX_GROUPS; g++) {
+                if (task->group == sched_get_group(g)) {
+                    print_dec(g);
+                }
+            }
+            print_string("   | ");
+
+            // The CPU it is running on, or last ran on ('*' while running).
+            print_dec(task->cpu);
+            print_string(task->on_cpu ? "*  | " : "   | ");
+
+            print_string(task->name);
+            print_string("\n");
+        }
+
+        // CPU usage of every group that is in use or limited.
+        for (int g = 0; g < SCHED_MAX_GROUPS; g++) {
+            sched_group_t* group = sched_get_group(g);
+            if (group->total_ticks == 0 && group->quota == 0) {
+                continue;
+            }
+            print_string("\nGroup "); print_dec(g);
+            print_string(": "); print_dec(group->total_ticks); print_string(" ticks used");
+            if (group->quota) {
+                print_string(", "); print_dec(group->used); print_string("/"); print_dec(group->quota);
+                print_string(" this period of "); print_dec(group->period);
+                print_string(", throttled "); print_dec(group->throttle_count); print_string(" times");
+                if (group->throttled) {
+                    print_string(" (now)");
                 }
-                
-                print_string(process_table[i].name);
-                print_string("\n");
             }
         }
+        print_string("\nCPUs online: "); print_dec(smp_cpu_count);
+
+    // top command
+    } else if (strcmp(argv[0], "top") == 0) {
+        shell_top();
+
+    // latency command
+    } else if (strcmp(argv[0], "latency") == 0) {
+        shell_latency(argc, argv);
+
+    // trace command
+    } else if (strcmp(argv[0], "trace") == 0) {
+        shell_trace(argc, argv);
 
     // kill command
     } else if (strcmp(argv[0], "kill") == 0) {
         if (argc < 2) {
-            print_string("Usage: kill <pid>");
+            print_string("Usage: kill <pid> [signal]");
         } else {
             int pid_to_kill = atoi(argv[1]);
-            if (pid_to_kill > 0 && pid_to_kill < MAX_PROCESSES) {
-                task_struct_t* task = &process_table[pid_to_kill];
+            task_struct_t* task = pid_to_kill > 0 ? process_find(pid_to_kill) : NULL;
+            if (task) {
                 if (task->state == TASK_STATE_ZOMBIE) {
-                    // The reaper (the shell) is now responsible for freeing the memory.
-                    paging_free_directory(task->page_directory);
-                    pmm_free_frame(task->kernel_stack);
-
-                    // "Reap" the zombie by clearing its entire PCB entry.
-                    memset(task, 0, sizeof(task_struct_t));
-                    task->state = TASK_STATE_UNUSED;
+                    // Freeing the address space takes a while, so the reaper
+                    // work item does it and the shell is ready again at once.
+                    process_reap_later(task);
 
-                    print_string("Reaped zombie PID ");
+                    print_string("Reaping zombie PID ");
                     print_dec(pid_to_kill);
-
-                    // We log the frame count AFTER freeing to confirm it was restored.
-                    qemu_debug_string("SHELL: Reaped zombie. Free frames: ");
-                    qemu_debug_dec(pmm_get_free_frame_count());
-                    qemu_debug_string("\n");
                 } else {
-                    print_string("Cannot kill non-zombie process.");
+                    int sig = argc > 2 ? atoi(argv[2]) : SIGTERM;
+                    if (signal_send(task, sig) == 0) {
+                        print_string("Sent signal ");
+                        print_dec(sig);
+                        print_string(" to PID ");
+                        print_dec(pid_to_kill);
+                    } else {
+                        print_string("Cannot signal that process.");
+                    }
                 }
             } else {
                 print_string("Invalid PID.");
             }
         }
 
+    // cgroup command
+    } else if (strcmp(argv[0], "cgroup") == 0) {
+        if (argc == 5 && strcmp(argv[1], "set") == 0) {
+            sched_group_t* group = sched_get_group(atoi(argv[2]));
+            // The limits are given in ms, the scheduler counts 10ms ticks.
+            uint32_t quota = (atoi(argv[3]) + 9) / 10;
+            uint32_t period = (atoi(argv[4]) + 9) / 10;
+            if (!group || sched_group_set_limit(group, quota, period) != 0) {
+                print_string("Invalid group or limit.");
+            } else {
+                print_string("Group "); print_string(argv[2]);
+                print_string(" limited to "); print_dec(quota);
+                print_string(" of every "); print_dec(period); print_string(" ticks");
+            }
+        } else if (argc == 3 && strcmp(argv[1], "use") == 0) {
+            int id = atoi(argv[2]);
+            if (sched_get_group(id)) {
+                run_group = id;
+                print_string("Programs now start in group "); print_dec(id);
+            } else {
+                print_string("Invalid group.");
+            }
+        } else {
+            print_string("Usage: cgroup set <id> <quota_ms> <period_ms> | cgroup use <id>\n");
+            print_string("Programs start in group "); print_dec(run_group);
+        }
+
+    // ksm command
+    } else if (strcmp(argv[0], "ksm") == 0) {
+        const ksm_stats_t* stats = ksm_get_stats();
+        print_string("Full scans:    "); print_dec(stats->full_scans);
+        print_string("\nPages scanned: "); print_dec(stats->pages_scanned);
+        print_string("\nPages shared:  "); print_dec(stats->pages_shared);
+        print_string("\nPages sharing: "); print_dec(stats->pages_sharing);
+        print_string("\nPages merged:  "); print_dec(stats->pages_merged);
+        print_string("\nCOW faults:    "); print_dec(paging_get_cow_fault_count());
+
+    // zram command
+    } else if (strcmp(argv[0], "zram") == 0) {
+        const zram_stats_t* stats = zram_get_stats();
+        print_string("Pages stored:     "); print_dec(stats->pages_stored);
+        print_string(" ("); print_dec(stats->same_pages); print_string(" same-filled)");
+        print_string("\nOriginal size:    "); print_dec(stats->orig_bytes / 1024); print_string(" KB");
+        print_string("\nCompressed size:  "); print_dec(stats->compressed_bytes / 1024); print_string(" KB");
+        print_string("\nPool frames:      "); print_dec(stats->pool_pages);
+        if (stats->pool_pages > 0) {
+            // Ratio of the memory the pages would need to what the pool really uses.
+            uint32_t ratio = stats->orig_bytes * 10 / (stats->pool_pages * PMM_FRAME_SIZE);
+            print_string("\nRatio:            "); print_dec(ratio / 10);
+            print_string("."); print_dec(ratio % 10); print_string(":1");
+        }
+        print_string("\nSwap-in hits:     "); print_dec(stats->hits);
+        print_string("\nPool full:        "); print_dec(stats->misses);
+        print_string("\nRejected pages:   "); print_dec(stats->rejected);
+
+    // swap command
+    } else if (strcmp(argv[0], "swap") == 0) {
+        const swap_stats_t* stats = swap_get_stats();
+        if (stats->total_slots == 0) {
+            print_string("No swap area on this disk.");
+        } else {
+            print_string("Slots used:      "); print_dec(stats->used_slots);
+            print_string(" / "); print_dec(stats->total_slots);
+            print_string("\nPages out:       "); print_dec(stats->pages_out);
+            print_string(" in "); print_dec(stats->clusters_out); print_string(" writes");
+            print_string("\nPages in:        "); print_dec(stats->pages_in);
+            print_string(" ("); print_dec(stats->readahead_pages); print_string(" read ahead)");
+            print_string("\nSwap-in faults:  "); print_dec(stats->faults);
+        }
+
     // deprecated pc spkr and sb16 beep cmds
     /* // beep command
     } else if (strcmp(argv[0], "beep") == 0) {
@@ -470,8 +901,12 @@ void process_command() {
     // vsbeep command
     } else if (strcmp(argv[0], "vsbeep") == 0) {
         print_string("Testing virtio-sound control queue...");
-        virtio_sound_beep();
-        print_string(" test complete.");
+        if (!vsbeep_work.fn) {
+            work_init(&vsbeep_work, vsbeep_work_fn, NULL);
+        }
+        if (!queue_work(system_wq, &vsbeep_work)) {
+            print_string(" already running.");
+        }
 
     // vsprobe command
     } else if (strcmp(argv[0], "vsprobe") == 0) {
@@ -504,7 +939,7 @@ void shell_redraw_line() {
     int current_row = vga_get_cursor_row();
 
     // Define a pointer directly to the VGA text-mode buffer.
-    volatile unsigned short* video_memory = (unsigned short*)0xB8000;
+    volatile unsigned short* video_memory = (unsigned short*)PHYS_TO_VIRT(0xB8000);
     // Define our standard text color (white on black).
     uint8_t color = 0x0F;
 
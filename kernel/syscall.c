@@ -7,22 +7,30 @@
 #include <kernel/timer.h>       // sleep()
 #include <kernel/io.h>          // port_byte_out()
 #include <kernel/shell.h>       // restart_shell()
-#include <kernel/cpu/tss.h>     // tss_entry
 #include <kernel/memory.h>      // free()
 #include <kernel/debug.h>       // debug print
+#include <kernel/paging.h>      // paging_user_access()
 #include <kernel/cpu/process.h> 
+#include <kernel/cpu/sched.h>     // sched_wake(), sched_setscheduler(), sched_yield()
+#include <kernel/cpu/futex.h>
+#include <kernel/cpu/signal.h>
+#include <kernel/cpu/ring.h>
 #include <kernel/string.h>
 
 #define MAX_SYSCALLS 32
 
-// We need access to the TSS to get the kernel stack pointer.
-extern struct tss_entry_struct tss_entry;
+// The SYSENTER MSRs: the kernel code segment (SS is the next one, and
+// SYSEXIT uses the user segments 16 and 24 bytes on), the stack and the
+// entry point.
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
 
-// We need access to the current task pointer
-extern task_struct_t* current_task; 
+// CPUID leaf 1, EDX: SYSENTER and SYSEXIT
+#define CPUID_SEP (1 << 11)
 
-// Make the process table visible to this file
-extern task_struct_t process_table[MAX_PROCESSES];
+// The SYSENTER entry stub, in isr.asm
+extern void sysenter_entry();
 
 // The system call dispatch table
 static syscall_t syscall_table[MAX_SYSCALLS];
@@ -43,20 +51,18 @@ static void sys_getchar(registers_t *r) {
 
 // Syscall 3: Exit the current program and return to the shell.
 static void sys_exit(registers_t *r) {
-    __asm__ __volatile__("cli"); // Disable interrupts during this critical operation
+    // Once we are a zombie we must not be switched away before the final
+    // yield. The yield never returns, so the flags are never restored.
+    irq_save();
     qemu_debug_string("SYSCALL: Entering sys_exit (syscall 3).\n");
 
     // Get a pointer to the task that is exiting.
     task_struct_t* task_to_exit = current_task;
 
-    // If the shell is waiting for a child, wake it up.
-    if (process_table[1].state == TASK_STATE_WAITING) {
-        process_table[1].state = TASK_STATE_RUNNING;
-    }
-
-    // We NO LONGER free memory here. We only mark the task as a zombie.
-    // The scheduler will still save its state, but it won't be run again.
-    task_to_exit->state = TASK_STATE_ZOMBIE;
+    // We NO LONGER free memory here. We only mark the task as a zombie,
+    // which also wakes its parent (e.g. the shell) if it waits for it.
+    // The scheduler switches away from it and never picks it again.
+    process_exit(task_to_exit, (int)r->ebx); // EBX = exit status
 
     qemu_debug_string("SYSCALL: PID ");
     qemu_debug_hex(task_to_exit->pid);
@@ -64,8 +70,7 @@ static void sys_exit(registers_t *r) {
     qemu_debug_dec(pmm_get_free_frame_count()); // Log the count, which should NOT change.
     qemu_debug_string("\n");
 
-    // Re-enable interrupts and call the scheduler.
-    __asm__ __volatile__("sti"); // Re-enable interrupts
+    // Call the scheduler. It never picks a zombie again.
     __asm__ __volatile__("int $0x20"); // Fire timer IRQ to invoke scheduler
 }
 
@@ -81,6 +86,200 @@ static void sys_sleep(registers_t *r) {
     sleep(ms);
 }
 
+// Syscall 6: Change the scheduling policy of the current task.
+// EBX = policy, ECX = real-time priority, EDX = runtime (ms), ESI = period (ms).
+static void sys_sched_setscheduler(registers_t *r) {
+    // Our timer is at 100Hz, so round up to whole 10ms ticks.
+    uint32_t runtime = (r->edx + 9) / 10;
+    uint32_t period = (r->esi + 9) / 10;
+    r->eax = sched_setscheduler(current_task, (int)r->ebx, (int)r->ecx, runtime, period);
+}
+
+// Syscall 7: Give up the CPU without sleeping.
+static void sys_yield(registers_t *r) {
+    (void)r;
+    sched_yield();
+}
+
+// Syscall 8: Give up the CPU, and the rest of our time slice, to another task.
+// EBX = PID of the task to run. Returns 0, or -1 if it cannot run right now.
+static void sys_yield_to(registers_t *r) {
+    task_struct_t* target = process_find((int)r->ebx);
+    if (!target) {
+        r->eax = -1;
+        return;
+    }
+    r->eax = sched_yield_to(target);
+}
+
+// Waits for the child 'pid' (-1 for any) and frees it, for waitpid and
+// thread_join. ECX = where to store its exit status, or 0.
+static void wait_for_child(registers_t *r, int pid) {
+    uint32_t user_status = r->ecx;
+    if (user_status && !paging_user_access(user_status, sizeof(int), true)) {
+        r->eax = -1; // Not memory we could write
+        return;
+    }
+    int status;
+    int child = process_waitpid(pid, &status);
+    if (child >= 0 && user_status) {
+        // We may have slept long enough for the page to be swapped out.
+        if (!paging_user_access(user_status, sizeof(int), true)) {
+            r->eax = -1;
+            return;
+        }
+        *(int*)user_status = status;
+    }
+    r->eax = child;
+}
+
+// Syscall 9: Wait for a child to exit and free it.
+// EBX = PID of the child, or -1 for any. ECX = where to store its exit status, or 0.
+// Returns the child's PID, or -1 if there is no such child.
+static void sys_waitpid(registers_t *r) {
+    wait_for_child(r, (int)r->ebx);
+}
+
+// Syscall 10: Start a thread in our own address space.
+// EBX = where it starts, ECX and EDX = its two arguments.
+// Returns its PID, or -1 if it could not be created.
+static void sys_thread_create(registers_t *r) {
+    if (r->ebx >= KERNEL_VIRT_BASE) {
+        r->eax = -1; // Not a user address
+        return;
+    }
+    r->eax = thread_create(r->ebx, r->ecx, r->edx);
+}
+
+// Syscall 11: End the calling thread. EBX = its exit status, for thread_join.
+// A thread ends like any task; the address space goes with the last one.
+static void sys_thread_exit(registers_t *r) {
+    sys_exit(r);
+}
+
+// Syscall 12: Wait for a thread we created to end and free it.
+// EBX = its PID. ECX = where to store its exit status, or 0.
+// Returns its PID, or -1 if it is not one of our threads.
+static void sys_thread_join(registers_t *r) {
+    task_struct_t* thread = process_find((int)r->ebx);
+    if (!thread || !thread->is_thread || thread->page_directory != current_task->page_directory) {
+        r->eax = -1;
+        return;
+    }
+    wait_for_child(r, thread->pid);
+}
+
+// Syscall 13: Sleep until the word at EBX is woken with futex_wake, if it
+// still holds ECX. EDX = timeout in ms, 0 for none.
+// Returns FUTEX_WOKEN, FUTEX_CHANGED, FUTEX_TIMEDOUT, FUTEX_INTERRUPTED
+// or FUTEX_FAULT.
+static void sys_futex_wait(registers_t *r) {
+    r->eax = futex_wait(r->ebx, r->ecx, r->edx);
+}
+
+// Syscall 14: Wake up to ECX tasks waiting on the word at EBX.
+// Returns how many were woken, or -1 for a bad address.
+static void sys_futex_wake(registers_t *r) {
+    r->eax = futex_wake(r->ebx, (int)r->ecx);
+}
+
+// Syscall 15: Set the handler of a signal.
+// EBX = signal, ECX = handler (or SIG_DFL/SIG_IGN), EDX = code that makes
+// the sigreturn syscall when a handler returns (0 keeps the current one).
+// Returns the old handler, or -1.
+static void sys_sigaction(registers_t *r) {
+    r->eax = signal_action((int)r->ebx, r->ecx, r->edx);
+}
+
+// Syscall 16: Send a signal. EBX = PID, ECX = signal (0 only checks the PID).
+// Returns 0, or -1 if the task cannot take it.
+static void sys_kill(registers_t *r) {
+    r->eax = signal_send(process_find((int)r->ebx), (int)r->ecx);
+}
+
+// Syscall 17: Get SIGALRM in EBX milliseconds (0 cancels the alarm).
+// Returns the milliseconds the previous alarm had left.
+static void sys_alarm(registers_t *r) {
+    r->eax = signal_alarm(r->ebx);
+}
+
+// Syscall 18: Return from a signal handler to where the signal came in.
+// Restores every register, so nothing is returned.
+static void sys_sigreturn(registers_t *r) {
+    if (!signal_return(r)) {
+        r->eax = -1;
+    }
+}
+
+// Syscall 19: Change the blocked signals. EBX = SIG_BLOCK, SIG_UNBLOCK or
+// SIG_SETMASK, ECX = the set. Returns the old mask.
+static void sys_sigprocmask(registers_t *r) {
+    r->eax = signal_mask((int)r->ebx, r->ecx);
+}
+
+// Syscall 20: Sleep until a signal arrives. Returns -1 after its handler ran.
+static void sys_pause(registers_t *r) {
+    signal_pause();
+    r->eax = -1;
+}
+
+// Syscall 21: Get CPU usage. EBX = RUSAGE_SELF or RUSAGE_CHILDREN,
+// ECX = where to store the rusage_t. Returns 0, or -1 on bad arguments.
+static void sys_getrusage(registers_t *r) {
+    uint32_t user_usage = r->ecx;
+    int who = (int)r->ebx;
+    if (who != RUSAGE_SELF && who != RUSAGE_CHILDREN) {
+        r->eax = -1;
+        return;
+    }
+    // Filled in here first, so a bad pointer never leaves half a struct behind.
+    rusage_t usage;
+    sched_getrusage(current_task, who, &usage);
+    if (!user_usage || !paging_user_access(user_usage, sizeof(rusage_t), true)) {
+        r->eax = -1;
+        return;
+    }
+    memcpy((void*)user_usage, &usage, sizeof(rusage_t));
+    r->eax = 0;
+}
+
+// Syscall 22: Register a submission/completion ring (see ring.h).
+// EBX = its address in our memory (0 unregisters), ECX = slots per ring.
+// Returns 0, or -1 on bad arguments.
+static void sys_ring_setup(registers_t *r) {
+    r->eax = ring_setup(r->ebx, r->ecx);
+}
+
+// Syscall 23: Run the submissions queued on our ring and post their
+// completions. EBX = most to run, 0 for all. Returns how many ran, or -1.
+static void sys_ring_enter(registers_t *r) {
+    r->eax = ring_enter(r->ebx);
+}
+
+// Whether SYSENTER works. The check must match syscall_has_sysenter() in
+// the user library, or programs would use it where it is not set up.
+static bool sysenter_supported() {
+    uint32_t eax, ebx, ecx, edx;
+    __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+
+    // The Pentium Pro sets the bit without having the instructions.
+    uint32_t family = (eax >> 8) & 0xF;
+    uint32_t model = (eax >> 4) & 0xF;
+    uint32_t stepping = eax & 0xF;
+    return (edx & CPUID_SEP) && !(family == 6 && model < 3 && stepping < 3);
+}
+
+void syscall_init_cpu() {
+    if (!sysenter_supported()) {
+        return;
+    }
+    // SYSENTER starts on top of the CPU's sysenter_stack, which is right
+    // below its TSS. The stub finds the task's kernel stack in the TSS.
+    wrmsr(MSR_SYSENTER_CS, 0x08);
+    wrmsr(MSR_SYSENTER_ESP, (uint32_t)&this_cpu()->tss);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+}
+
 void syscall_install() {
     // Install the syscalls at unique indexes
     syscall_table[1] = &sys_test_print;
@@ -88,13 +287,37 @@ void syscall_install() {
     syscall_table[3] = &sys_exit;
     syscall_table[4] = &sys_play_sound;
     syscall_table[5] = &sys_sleep;
+    syscall_table[6] = &sys_sched_setscheduler;
+    syscall_table[7] = &sys_yield;
+    syscall_table[8] = &sys_yield_to;
+    syscall_table[9] = &sys_waitpid;
+    syscall_table[10] = &sys_thread_create;
+    syscall_table[11] = &sys_thread_exit;
+    syscall_table[12] = &sys_thread_join;
+    syscall_table[13] = &sys_futex_wait;
+    syscall_table[14] = &sys_futex_wake;
+    syscall_table[15] = &sys_sigaction;
+    syscall_table[16] = &sys_kill;
+    syscall_table[17] = &sys_alarm;
+    syscall_table[18] = &sys_sigreturn;
+    syscall_table[19] = &sys_sigprocmask;
+    syscall_table[20] = &sys_pause;
+    syscall_table[21] = &sys_getrusage;
+    syscall_table[22] = &sys_ring_setup;
+    syscall_table[23] = &sys_ring_enter;
+
+    syscall_init_cpu();
 }
 
-// The main C-level handler for all system calls
+// The main C-level handler for all system calls, from int 0x80 and SYSENTER.
+// Both build the same registers_t.
 void syscall_handler(registers_t *r) {
     // Get the syscall number from the EAX register
     uint32_t syscall_num = r->eax;
 
+    lock_kernel();
+    sched_syscall_enter(current_task);
+
     // Check if the number is valid (and not 0)
     if (syscall_num > 0 && syscall_num < MAX_SYSCALLS && syscall_table[syscall_num] != 0) {
         // If it is, look up the handler in our table
@@ -107,4 +330,9 @@ void syscall_handler(registers_t *r) {
         print_hex(syscall_num);
         print_char('\n');
     }
+
+    // Signals sent meanwhile (or by this very call) are taken on the way out.
+    sched_syscall_exit(current_task);
+    signal_deliver(r);
+    unlock_kernel();
 }
\ No newline at end of file
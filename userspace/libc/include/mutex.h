@@ -0,0 +1,67 @@
+// myos/userspace/libc/include/mutex.h
+
+#ifndef MUTEX_H
+#define MUTEX_H
+
+#include <syscall.h>
+
+// A lock between threads that only enters the kernel when it has to wait
+// or when there is somebody to wake. The word is 0 when unlocked, 1 when
+// locked, and 2 when locked and someone may be sleeping on it.
+typedef struct {
+    volatile int state;
+} mutex_t;
+
+#define MUTEX_INIT { 0 }
+
+static inline void mutex_lock(mutex_t* m) {
+    int c = __sync_val_compare_and_swap(&m->state, 0, 1);
+    if (c == 0) {
+        return; // Uncontended: no syscall at all.
+    }
+    // Mark it contended, then sleep until the owner lets go. Whoever gets it
+    // this way keeps the 2, since other sleepers may still be waiting.
+    if (c != 2) {
+        c = __sync_lock_test_and_set(&m->state, 2);
+    }
+    while (c != 0) {
+        syscall_futex_wait(&m->state, 2, 0);
+        c = __sync_lock_test_and_set(&m->state, 2);
+    }
+}
+
+static inline void mutex_unlock(mutex_t* m) {
+    // Only a contended lock has anybody to wake.
+    if (__sync_fetch_and_sub(&m->state, 1) != 1) {
+        m->state = 0;
+        syscall_futex_wake(&m->state, 1);
+    }
+}
+
+// A condition variable. The sequence number changes on every signal, so a
+// waiter that read it before unlocking the mutex cannot miss one.
+typedef struct {
+    volatile int seq;
+} cond_t;
+
+#define COND_INIT { 0 }
+
+// Unlocks 'm', sleeps until signalled (or spuriously), and locks 'm' again.
+static inline void cond_wait(cond_t* c, mutex_t* m) {
+    int seq = c->seq;
+    mutex_unlock(m);
+    syscall_futex_wait(&c->seq, seq, 0);
+    mutex_lock(m);
+}
+
+static inline void cond_signal(cond_t* c) {
+    __sync_fetch_and_add(&c->seq, 1);
+    syscall_futex_wake(&c->seq, 1);
+}
+
+static inline void cond_broadcast(cond_t* c) {
+    __sync_fetch_and_add(&c->seq, 1);
+    syscall_futex_wake(&c->seq, 0x7FFFFFFF);
+}
+
+#endif
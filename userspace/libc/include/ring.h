@@ -0,0 +1,106 @@
+// myos/userspace/libc/include/ring.h
+
+#ifndef USER_RING_H
+#define USER_RING_H
+
+#include <syscall.h>
+
+// Batched syscalls. Requests are queued in a submission ring in our own
+// memory, and one syscall_ring_enter() runs them all and posts a
+// completion for each, instead of one trap per request. The layout and
+// operations are the kernel's (see its ring.h).
+#define RING_MAX_ENTRIES 256
+
+#define RING_OP_NOP        0 // Completes with 0
+#define RING_OP_PRINT      1 // string; printed with a newline
+#define RING_OP_READ       2 // file name, buffer, length, offset; completes with the bytes read
+#define RING_OP_WRITE      3 // buffer, length; written to the console
+#define RING_OP_SLEEP      4 // milliseconds
+#define RING_OP_PLAY_SOUND 5 // frequency
+
+#define RING_ERROR -1
+
+typedef struct {
+    volatile uint32_t sq_head;   // Submissions the kernel took
+    volatile uint32_t sq_tail;   // Submissions we queued
+    volatile uint32_t cq_head;   // Completions we took
+    volatile uint32_t cq_tail;   // Completions the kernel posted
+    uint32_t entries;
+} ring_header_t;
+
+typedef struct {
+    uint32_t op;
+    uint32_t user_data;          // Handed back in the completion
+    uint32_t args[4];
+} ring_sqe_t;
+
+typedef struct {
+    uint32_t user_data;
+    int32_t result;
+} ring_cqe_t;
+
+// Bytes a ring with 'entries' slots needs.
+#define RING_SIZE(entries) (sizeof(ring_header_t) + (entries) * (sizeof(ring_sqe_t) + sizeof(ring_cqe_t)))
+
+// Our view of a registered ring.
+typedef struct {
+    ring_header_t* header;
+    ring_sqe_t* sq;
+    ring_cqe_t* cq;
+    uint32_t mask;
+} ring_t;
+
+// Registers 'mem' (RING_SIZE(entries) bytes, 4-byte aligned) as our ring.
+// Returns 0, or -1 on bad arguments.
+static inline int ring_init(ring_t* ring, void* mem, uint32_t entries) {
+    if (syscall_ring_setup(mem, entries) < 0) {
+        return -1;
+    }
+    ring->header = (ring_header_t*)mem;
+    ring->sq = (ring_sqe_t*)(ring->header + 1);
+    ring->cq = (ring_cqe_t*)(ring->sq + entries);
+    ring->mask = entries - 1;
+    return 0;
+}
+
+// Queues one request. Nothing runs until ring_submit(). Returns 0, or -1
+// if the submission ring is full.
+static inline int ring_queue(ring_t* ring, uint32_t op, uint32_t user_data,
+                             uint32_t arg0, uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    uint32_t tail = ring->header->sq_tail;
+    if (tail - ring->header->sq_head > ring->mask) {
+        return -1;
+    }
+    ring_sqe_t* sqe = &ring->sq[tail & ring->mask];
+    sqe->op = op;
+    sqe->user_data = user_data;
+    sqe->args[0] = arg0;
+    sqe->args[1] = arg1;
+    sqe->args[2] = arg2;
+    sqe->args[3] = arg3;
+
+    // The kernel must see the whole entry once it sees the new tail.
+    __asm__ __volatile__("" : : : "memory");
+    ring->header->sq_tail = tail + 1;
+    return 0;
+}
+
+// Runs everything queued, in one syscall. Returns how many ran.
+static inline int ring_submit(ring_t* ring) {
+    (void)ring;
+    return syscall_ring_enter(0);
+}
+
+// Takes the oldest completion into 'out'. Returns 0, or -1 if there is none.
+static inline int ring_complete(ring_t* ring, ring_cqe_t* out) {
+    uint32_t head = ring->header->cq_head;
+    if (head == ring->header->cq_tail) {
+        return -1;
+    }
+    *out = ring->cq[head & ring->mask];
+    __asm__ __volatile__("" : : : "memory");
+    ring->header->cq_head = head + 1;
+    return 0;
+}
+
+#endif
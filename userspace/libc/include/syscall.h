@@ -5,44 +5,299 @@
 #ifndef SYSCALL_H
 #define SYSCALL_H
 
+// What syscall_futex_wait returns (same values as the kernel's futex.h).
+#define FUTEX_WOKEN        0
+#define FUTEX_CHANGED      1
+#define FUTEX_TIMEDOUT     2
+#define FUTEX_INTERRUPTED  3
+#define FUTEX_FAULT       -1
+
+// Signals and handler values (same as the kernel's signal.h).
+#define SIGINT   2
+#define SIGKILL  9
+#define SIGUSR1  10
+#define SIGSEGV  11
+#define SIGUSR2  12
+#define SIGALRM  14
+#define SIGTERM  15
+#define SIGCHLD  17
+#define SIG_DFL  ((void (*)(int))0)
+#define SIG_IGN  ((void (*)(int))1)
+#define SIG_BLOCK   0
+#define SIG_UNBLOCK 1
+#define SIG_SETMASK 2
+
+// CPU usage from syscall_getrusage (same layout as the kernel's sched.h).
+#define RUSAGE_SELF      0
+#define RUSAGE_CHILDREN -1
+typedef struct {
+    uint32_t utime_ms;       // Time in user mode
+    uint32_t stime_ms;       // Time in the kernel
+    uint64_t user_cycles;    // The same, in TSC cycles
+    uint64_t system_cycles;
+    uint32_t nvcsw;          // Voluntary context switches
+    uint32_t nivcsw;         // Involuntary context switches
+} rusage_t;
+
+// Scheduling policies for syscall_sched_setscheduler (same values as the kernel's sched.h).
+#define SCHED_NORMAL 0
+#define SCHED_FIFO   1
+
+// 1 if the CPU has SYSENTER, 0 if not, -1 until syscall_has_sysenter() asked.
+static int syscall_sep = -1;
+
+// Whether syscalls can use SYSENTER. The test is the kernel's (see
+// syscall_init_cpu), which sets it up on every CPU that passes it.
+static inline int syscall_has_sysenter() {
+    if (syscall_sep < 0) {
+        uint32_t eax, ebx, ecx, edx;
+        __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+
+        // The Pentium Pro sets the SEP bit without having the instructions.
+        uint32_t family = (eax >> 8) & 0xF;
+        uint32_t model = (eax >> 4) & 0xF;
+        uint32_t stepping = eax & 0xF;
+        syscall_sep = (edx & (1 << 11)) && !(family == 6 && model < 3 && stepping < 3);
+    }
+    return syscall_sep;
+}
+
+// Makes syscall 'num' with up to four arguments in EBX, ECX, EDX and ESI,
+// and returns what the kernel left in EAX. SYSENTER is much cheaper than
+// int 0x80, which stays for CPUs without it. For SYSENTER we also pass our
+// stack pointer in EBP and where to return to in EDI; SYSEXIT returns
+// through ECX and EDX, so those are lost.
+static inline uint32_t syscall_invoke(uint32_t num, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t arg4) {
+    uint32_t result;
+    if (syscall_has_sysenter()) {
+        __asm__ __volatile__ (
+            "push %%ebp\n\t"
+            "movl %%esp, %%ebp\n\t"
+            "movl $1f, %%edi\n\t"
+            "sysenter\n"
+            "1:\n\t"
+            "pop %%ebp"
+            : "=a"(result), "+c"(arg2), "+d"(arg3)
+            : "a"(num), "b"(arg1), "S"(arg4)
+            : "edi", "memory", "cc"
+        );
+    } else {
+        __asm__ __volatile__ (
+            "int $0x80"
+            : "=a"(result)
+            : "a"(num), "b"(arg1), "c"(arg2), "d"(arg3), "S"(arg4)
+            : "memory", "cc"
+        );
+    }
+    return result;
+}
+
 // A simple C wrapper for our "print" syscall.
-// It uses inline assembly to load the registers and call int 0x80.
 static inline void syscall_print(const char* message) {
     // EAX=1 for our print syscall
     // EBX=message pointer
-    __asm__ __volatile__ ("int $0x80" : : "a"(1), "b"(message));
+    syscall_invoke(1, (uint32_t)message, 0, 0, 0);
 }
 
 // Wrapper for the "getchar" syscall.
 static inline char syscall_getchar() {
     char result;
     // EAX=2 for our getchar syscall. The kernel's return value will be in EAX.
-    __asm__ __volatile__ (
-        "int $0x80"
-        : "=a"(result)  // Output: store the final value of EAX into 'result'.
-        : "a"(2)        // Input: set EAX to 2 before the interrupt.
-    );
+    result = syscall_invoke(2, 0, 0, 0, 0);
     return result;
 }
 
-// Wrapper for the "exit" syscall. It does not return.
-static inline void syscall_exit() {
+// Wrapper for the "exit" syscall. It does not return. The status goes to
+// the parent's waitpid.
+static inline void syscall_exit(int status) {
     // EAX=3 for our exit syscall
-    __asm__ __volatile__ ("int $0x80" : : "a"(3));
+    // EBX=exit status
+    syscall_invoke(3, (uint32_t)status, 0, 0, 0);
 }
 
 // Wrapper for the "play_sound" syscall.
 static inline void syscall_play_sound(uint32_t frequency) {
     // EAX=4 for our play_sound syscall
     // EBX=frequency
-    __asm__ __volatile__ ("int $0x80" : : "a"(4), "b"(frequency));
+    syscall_invoke(4, frequency, 0, 0, 0);
 }
 
 // Wrapper for the "sleep" syscall.
 static inline void syscall_sleep(uint32_t ms) {
     // EAX=5 for our sleep syscall
     // EBX=milliseconds
-    __asm__ __volatile__ ("int $0x80" : : "a"(5), "b"(ms));
+    syscall_invoke(5, ms, 0, 0, 0);
+}
+
+// Wrapper for the "sched_setscheduler" syscall. Returns 0, or -1 on bad arguments.
+// A SCHED_FIFO task (priority 1-8, higher wins) runs before all normal tasks,
+// but only for runtime_ms in every period_ms.
+static inline int syscall_sched_setscheduler(int policy, int priority, uint32_t runtime_ms, uint32_t period_ms) {
+    int result;
+    // EAX=6, EBX=policy, ECX=priority, EDX=runtime, ESI=period
+    result = syscall_invoke(6, (uint32_t)policy, (uint32_t)priority, runtime_ms, period_ms);
+    return result;
+}
+
+// Wrapper for the "yield" syscall. Lets other tasks run, then returns.
+static inline void syscall_yield() {
+    // EAX=7 for our yield syscall
+    syscall_invoke(7, 0, 0, 0, 0);
+}
+
+// Wrapper for the "yield_to" syscall. Runs the task with the given PID next and
+// hands it the rest of our time slice. Returns 0, or -1 if it cannot run now.
+static inline int syscall_yield_to(int pid) {
+    int result;
+    // EAX=8, EBX=pid
+    result = syscall_invoke(8, (uint32_t)pid, 0, 0, 0);
+    return result;
+}
+
+// Wrapper for the "waitpid" syscall. Waits for a child (pid -1 = any) to
+// exit and stores its exit status, if 'status' is not NULL. Returns the
+// child's PID, or -1 if there is no such child.
+static inline int syscall_waitpid(int pid, int* status) {
+    int result;
+    // EAX=9, EBX=pid, ECX=status pointer
+    result = syscall_invoke(9, (uint32_t)pid, (uint32_t)status, 0, 0);
+    return result;
+}
+
+// Wrapper for the "thread_exit" syscall. Ends the calling thread; the status
+// goes to thread_join. Does not return.
+static inline void syscall_thread_exit(int status) {
+    // EAX=11, EBX=exit status
+    syscall_invoke(11, (uint32_t)status, 0, 0, 0);
+}
+
+// Where every thread starts: runs fn(arg), and ends the thread with what it returns.
+static inline void thread_start(int (*fn)(void* arg), void* arg) {
+    syscall_thread_exit(fn(arg));
+}
+
+// Wrapper for the "thread_create" syscall. Runs fn(arg) in a new thread that
+// shares our memory but has its own stack. Returns its ID for
+// syscall_thread_join, or -1 if it could not be created.
+static inline int syscall_thread_create(int (*fn)(void* arg), void* arg) {
+    int result;
+    // EAX=10, EBX=where it starts, ECX and EDX=its arguments
+    result = syscall_invoke(10, (uint32_t)thread_start, (uint32_t)fn, (uint32_t)arg, 0);
+    return result;
+}
+
+// Wrapper for the "thread_join" syscall. Waits for a thread we created to
+// end and stores what its function returned, if 'status' is not NULL.
+// Returns the thread's ID, or -1 if it is not one of ours.
+static inline int syscall_thread_join(int tid, int* status) {
+    int result;
+    // EAX=12, EBX=thread ID, ECX=status pointer
+    result = syscall_invoke(12, (uint32_t)tid, (uint32_t)status, 0, 0);
+    return result;
+}
+
+// Wrapper for the "futex_wait" syscall. Sleeps until another task calls
+// syscall_futex_wake on the same word, if it still holds 'val'. A timeout
+// of 0 waits for ever. Returns one of the FUTEX_ values above.
+static inline int syscall_futex_wait(volatile int* addr, int val, uint32_t timeout_ms) {
+    int result;
+    // EAX=13, EBX=address, ECX=expected value, EDX=timeout
+    result = syscall_invoke(13, (uint32_t)addr, (uint32_t)val, timeout_ms, 0);
+    return result;
+}
+
+// Wrapper for the "futex_wake" syscall. Wakes up to 'count' tasks waiting on
+// the word. Returns how many were woken.
+static inline int syscall_futex_wake(volatile int* addr, int count) {
+    int result;
+    // EAX=14, EBX=address, ECX=count
+    result = syscall_invoke(14, (uint32_t)addr, (uint32_t)count, 0, 0);
+    return result;
+}
+
+// Wrapper for the "sigreturn" syscall. Only for signal_restorer below.
+static inline void syscall_sigreturn() {
+    // EAX=18. The kernel restores every register, so it does not return here.
+    syscall_invoke(18, 0, 0, 0, 0);
+}
+
+// Where every signal handler returns to. It goes back to wherever the
+// signal interrupted the program.
+static inline void signal_restorer() {
+    syscall_sigreturn();
+}
+
+// Wrapper for the "sigaction" syscall. Runs 'handler' (or SIG_DFL, SIG_IGN)
+// when 'sig' arrives. Returns the old handler's address, or -1 on error.
+static inline int syscall_sigaction(int sig, void (*handler)(int sig)) {
+    int result;
+    // EAX=15, EBX=signal, ECX=handler, EDX=restorer
+    result = syscall_invoke(15, (uint32_t)sig, (uint32_t)handler, (uint32_t)signal_restorer, 0);
+    return result;
+}
+
+// Wrapper for the "kill" syscall. Sends 'sig' to the task with the given PID.
+// Returns 0, or -1 if it cannot take signals.
+static inline int syscall_kill(int pid, int sig) {
+    int result;
+    // EAX=16, EBX=pid, ECX=signal
+    result = syscall_invoke(16, (uint32_t)pid, (uint32_t)sig, 0, 0);
+    return result;
+}
+
+// Wrapper for the "alarm" syscall. Sends us SIGALRM in 'ms' milliseconds
+// (0 cancels). Returns the milliseconds the previous alarm had left.
+static inline uint32_t syscall_alarm(uint32_t ms) {
+    uint32_t result;
+    // EAX=17, EBX=milliseconds
+    result = syscall_invoke(17, ms, 0, 0, 0);
+    return result;
+}
+
+// Wrapper for the "sigprocmask" syscall. 'how' is SIG_BLOCK, SIG_UNBLOCK or
+// SIG_SETMASK, 'set' has bit n for signal n. Returns the old mask.
+static inline uint32_t syscall_sigprocmask(int how, uint32_t set) {
+    uint32_t result;
+    // EAX=19, EBX=how, ECX=set
+    result = syscall_invoke(19, (uint32_t)how, set, 0, 0);
+    return result;
+}
+
+// Wrapper for the "pause" syscall. Sleeps until a signal handler has run
+// (or a signal ends the program).
+static inline void syscall_pause() {
+    // EAX=20
+    syscall_invoke(20, 0, 0, 0, 0);
+}
+
+// Wrapper for the "getrusage" syscall. Fills 'usage' with our own CPU time
+// (RUSAGE_SELF) or that of the children we waited for (RUSAGE_CHILDREN).
+// Returns 0, or -1 on bad arguments.
+static inline int syscall_getrusage(int who, rusage_t* usage) {
+    int result;
+    // EAX=21, EBX=who, ECX=usage pointer
+    result = syscall_invoke(21, (uint32_t)who, (uint32_t)usage, 0, 0);
+    return result;
+}
+
+// Wrapper for the "ring_setup" syscall. Registers a submission/completion
+// ring of 'entries' slots (a power of two) at 'mem'; see ring.h, which
+// does this for you. Returns 0, or -1 on bad arguments.
+static inline int syscall_ring_setup(void* mem, uint32_t entries) {
+    int result;
+    // EAX=22, EBX=ring address, ECX=slots
+    result = syscall_invoke(22, (uint32_t)mem, entries, 0, 0);
+    return result;
+}
+
+// Wrapper for the "ring_enter" syscall. Runs up to 'to_submit' queued
+// submissions (0 = all) and posts their completions. Returns how many ran,
+// or -1 if we have no ring.
+static inline int syscall_ring_enter(uint32_t to_submit) {
+    int result;
+    // EAX=23, EBX=most to run
+    result = syscall_invoke(23, to_submit, 0, 0, 0);
+    return result;
 }
 
 #endif
\ No newline at end of file
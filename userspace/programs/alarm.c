@@ -0,0 +1,32 @@
+// myos/userspace/programs/alarm.c
+
+#include <syscall.h>
+
+#define ALARMS 3
+
+// Set by the handler, read by the main loop.
+static volatile int alarms = 0;
+
+static void on_alarm(int sig) {
+    (void)sig;
+    alarms++;
+    syscall_print("  alarm went off");
+}
+
+// Sleeps in pause() until ALARMS alarms of 500ms each have gone off,
+// without polling in between.
+void user_program_main(int argc, char* argv[]) {
+    (void)argc;
+    (void)argv;
+    if (syscall_sigaction(SIGALRM, on_alarm) < 0) {
+        syscall_print("alarm: sigaction failed");
+        syscall_exit(1);
+    }
+
+    while (alarms < ALARMS) {
+        syscall_alarm(500);
+        syscall_pause();
+    }
+    syscall_print("alarm: done");
+    syscall_exit(0);
+}
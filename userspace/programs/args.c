@@ -24,5 +24,5 @@ void user_program_main(int argc, char* argv[]) {
         syscall_print("\n");
     }
 
-    syscall_exit();
+    syscall_exit(0);
 }
\ No newline at end of file
@@ -17,5 +17,5 @@ void user_program_main() {
     syscall_print(buffer);
 
     // Instead of looping forever, exit the program.
-    syscall_exit();
+    syscall_exit(0);
 }
\ No newline at end of file
@@ -0,0 +1,61 @@
+// myos/userspace/programs/ring.c
+
+#include <syscall.h>
+#include <ring.h>
+
+#define ENTRIES 16
+
+// The ring, shared with the kernel. Static, so it is in our own memory.
+static uint32_t ring_mem[RING_SIZE(ENTRIES) / sizeof(uint32_t)];
+
+static char file_buf[128];
+
+// Prints the file, sleeps and prints again, all queued up front and run
+// by a single ring_enter instead of one syscall each. A second batch
+// writes out what the read brought in.
+void user_program_main(int argc, char* argv[]) {
+    (void)argc;
+    (void)argv;
+    ring_t ring;
+    if (ring_init(&ring, ring_mem, ENTRIES) < 0) {
+        syscall_print("ring: ring_setup failed");
+        syscall_exit(1);
+    }
+
+    ring_queue(&ring, RING_OP_PRINT, 0, (uint32_t)"ring: first of a batch", 0, 0, 0);
+    ring_queue(&ring, RING_OP_READ, 1, (uint32_t)"test.txt", (uint32_t)file_buf, sizeof(file_buf), 0);
+    ring_queue(&ring, RING_OP_SLEEP, 2, 200, 0, 0, 0);
+    ring_queue(&ring, RING_OP_PRINT, 3, (uint32_t)"ring: last of a batch, after 200ms", 0, 0, 0);
+    if (ring_submit(&ring) != 4) {
+        syscall_print("ring: not everything ran");
+        syscall_exit(1);
+    }
+
+    // Completions come back in order, tagged with their user_data.
+    int read_bytes = RING_ERROR;
+    int failed = 0;
+    ring_cqe_t cqe;
+    while (ring_complete(&ring, &cqe) == 0) {
+        if (cqe.user_data == 1) {
+            read_bytes = cqe.result;
+        } else if (cqe.result != 0) {
+            failed = 1;
+        }
+    }
+    if (read_bytes < 0) {
+        syscall_print("ring: could not read test.txt");
+        syscall_exit(1);
+    }
+
+    ring_queue(&ring, RING_OP_WRITE, 4, (uint32_t)file_buf, read_bytes, 0, 0);
+    ring_queue(&ring, RING_OP_PRINT, 5, (uint32_t)"", 0, 0, 0);
+    ring_submit(&ring);
+    while (ring_complete(&ring, &cqe) == 0) {
+        if (cqe.result < 0) {
+            failed = 1;
+        }
+    }
+
+    syscall_print(failed ? "ring: failed" : "ring: 6 requests in 2 syscalls");
+    syscall_exit(failed);
+}
@@ -0,0 +1,62 @@
+// myos/userspace/programs/threads.c
+
+#include <syscall.h>
+#include <mutex.h>
+
+#define THREADS 4
+#define ROUNDS  3
+#define ADDS    10000
+
+// Written by the threads, read by the main thread once they are joined.
+static int results[THREADS];
+
+// Every thread adds to it ADDS times per round, under the lock.
+static mutex_t counter_lock = MUTEX_INIT;
+static int counter = 0;
+
+// Each thread prints its number a few times and adds to the counter,
+// sleeping in between so the others get to run, and returns it times ten.
+static int worker(void* arg) {
+    int n = (int)arg;
+    char line[] = "  thread N running";
+    line[9] = '0' + n;
+    for (int i = 0; i < ROUNDS; i++) {
+        syscall_print(line);
+        for (int j = 0; j < ADDS; j++) {
+            mutex_lock(&counter_lock);
+            counter++;
+            mutex_unlock(&counter_lock);
+        }
+        syscall_sleep(50);
+    }
+    results[n] = n * 10;
+    return n * 10;
+}
+
+void user_program_main(int argc, char* argv[]) {
+    (void)argc;
+    (void)argv;
+    int tids[THREADS];
+
+    for (int i = 0; i < THREADS; i++) {
+        tids[i] = syscall_thread_create(worker, (void*)i);
+        if (tids[i] < 0) {
+            syscall_print("threads: thread_create failed");
+            syscall_exit(1);
+        }
+    }
+
+    int failed = 0;
+    for (int i = 0; i < THREADS; i++) {
+        int status;
+        if (syscall_thread_join(tids[i], &status) != tids[i] || status != results[i]) {
+            failed = 1;
+        }
+    }
+    if (counter != THREADS * ROUNDS * ADDS) {
+        syscall_print("threads: the counter lost updates");
+        failed = 1;
+    }
+    syscall_print(failed ? "threads: failed" : "threads: all joined, counter is right");
+    syscall_exit(failed);
+}
@@ -10,6 +10,8 @@ void user_program_main() {
     // Call the kernel's print function via our syscall wrapper.
     syscall_print(message);
 
-    // Loop forever
-    while(1) {}
+    // Sleep until a signal ends us (e.g. 'kill <pid>' in the shell).
+    while(1) {
+        syscall_pause();
+    }
 }
\ No newline at end of file
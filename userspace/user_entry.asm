@@ -28,4 +28,5 @@ _start_user_program:
     ; Our C function has returned. We must now exit the program cleanly
     ; by performing the syscall directly. The syscall number for exit is 3.
     mov eax, 3          ; Put the syscall number for 'exit' into EAX
+    xor ebx, ebx        ; Exit status 0
     int 0x80            ; Trigger the system call interrupt
\ No newline at end of file